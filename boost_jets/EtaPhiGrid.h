@@ -0,0 +1,139 @@
+#ifndef EtaPhiGrid_h
+#define EtaPhiGrid_h
+
+// Eta-phi binning kernel shared by constituents_image.cpp, fatjet_image.cpp
+// and image_builder.cpp.
+//
+// The grid is NBins x NBins over [etaMin, etaMax) x [-pi, pi), row-major in
+// eta, i.e. the same layout as a TH2F(NBins, etaMin, etaMax, NBins, -pi, pi)
+// filled at (eta bin, phi bin). With absEta the |eta| is binned. Phi is
+// wrapped into [-pi, pi) instead of being dropped when it comes out of a
+// producer as e.g. pi + epsilon.
+//
+// Bin indices are computed in blocks with reciprocal bin widths and no
+// branches, so that the index pass vectorizes; out-of-range eta gets bin -1.
+// Only the scatter-add into the grid is scalar. NBins = 0 takes the number
+// of bins at run time.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+template <int NBins>
+class EtaPhiGrid {
+public:
+    static constexpr float kPi = 3.14159265358979324f;
+    static constexpr float kTwoPi = 2.f * kPi;
+
+    EtaPhiGrid(float etaMin, float etaMax, bool absEta = true, int nBins = NBins)
+        : nBins_(NBins > 0 ? NBins : nBins),
+          etaMin_(etaMin),
+          etaMax_(etaMax),
+          absEta_(absEta),
+          invEtaWidth_(nBins_ / (etaMax - etaMin)),
+          invPhiWidth_(nBins_ / kTwoPi) {}
+
+    int nBins() const { return NBins > 0 ? NBins : nBins_; }
+    int size() const { return nBins() * nBins(); }
+    float etaMin() const { return etaMin_; }
+    float etaMax() const { return etaMax_; }
+    static constexpr float phiMin() { return -kPi; }
+    static constexpr float phiMax() { return kPi; }
+
+    // Flat bin (etaBin * nBins + phiBin) of one point, -1 outside the eta range.
+    int bin(float eta, float phi) const {
+        int b;
+        if (absEta_) indexBlock<true>(&eta, &phi, &b, 1);
+        else indexBlock<false>(&eta, &phi, &b, 1);
+        return b;
+    }
+
+    // Adds weight[i] to sum and 1 to count (either may be null) at the bin
+    // of (eta[i], phi[i]) for i < n. The arrays can be raw pointers, RVecs or
+    // TTreeReaderArrays; they are copied block by block into local buffers,
+    // padded to a full block so that the index pass has a fixed trip count.
+    template <typename EtaArray, typename PhiArray, typename WeightArray>
+    void fill(const EtaArray& eta, const PhiArray& phi, const WeightArray& weight, size_t n, float* sum,
+              float* count = nullptr) const {
+        constexpr int kBlock = 256;
+        float etaBlock[kBlock], phiBlock[kBlock];
+        int bins[kBlock];
+        for (size_t start = 0; start < n; start += kBlock) {
+            const int m = std::min<size_t>(kBlock, n - start);
+            for (int i = 0; i < m; ++i) {
+                etaBlock[i] = eta[start + i];
+                phiBlock[i] = phi[start + i];
+            }
+            std::fill(etaBlock + m, etaBlock + kBlock, kOutside);
+            std::fill(phiBlock + m, phiBlock + kBlock, 0.f);
+
+            if (absEta_) indexBlock<true>(etaBlock, phiBlock, bins, kBlock);
+            else indexBlock<false>(etaBlock, phiBlock, bins, kBlock);
+
+            if (sum != nullptr) {
+                int current = bins[0];
+                float run = weight[start];
+                for (int i = 1; i < m; ++i) {
+                    const float w = weight[start + i];
+                    if (bins[i] == current) {
+                        run += w;
+                    } else {
+                        if (current >= 0) sum[current] += run;
+                        current = bins[i];
+                        run = w;
+                    }
+                }
+                if (current >= 0) sum[current] += run;
+            }
+            if (count != nullptr) {
+                for (int i = 0; i < m; ++i) {
+                    if (bins[i] >= 0) count[bins[i]] += 1.f;
+                }
+            }
+        }
+    }
+
+private:
+    static constexpr float kOutside = -1e4f;  // padding, outside any grid
+    static constexpr uint32_t kLimitBits = 0x46800000u;  // 16384.f, bound of |eta| and |phi|
+
+    // x with its magnitude limited to 16384, NaN and infinities included.
+    // Done on the bits, with an integer compare, to stay branch-free.
+    static float limitMagnitude(float x) {
+        uint32_t bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+        bits = (bits & 0x7fffffffu) > kLimitBits ? (bits & 0x80000000u) | kLimitBits : bits;
+        std::memcpy(&x, &bits, sizeof(x));
+        return x;
+    }
+
+    // Floors go through int conversion of (x + 1) - 1 and the range test is
+    // done on integers, since float compares and std::floor keep GCC from
+    // if-converting the loop without -ffast-math. Eta and phi are limited
+    // first, so that every conversion is in the int range: a NaN or huge eta
+    // then fails the range test, a NaN phi lands in some bin of the row.
+    template <bool AbsEta>
+    void indexBlock(const float* eta, const float* phi, int* bins, int m) const {
+        const int n = nBins();
+        for (int i = 0; i < m; ++i) {
+            const float e = limitMagnitude(AbsEta ? std::fabs(eta[i]) : eta[i]);
+            const int etaBin = static_cast<int>((e - etaMin_) * invEtaWidth_ + 1.f) - 1;
+            const float p = limitMagnitude(phi[i]) + kPi;
+            const int turns = static_cast<int>(p * (1.f / kTwoPi) + 1.f) - 1;
+            const int phiBin = std::min(std::max(static_cast<int>((p - kTwoPi * turns) * invPhiWidth_), 0), n - 1);
+            const bool inside = (etaBin >= 0) & (etaBin < n);
+            bins[i] = (etaBin * n + phiBin) | -int(!inside);
+        }
+    }
+
+    int nBins_;
+    float etaMin_;
+    float etaMax_;
+    bool absEta_;
+    float invEtaWidth_;
+    float invPhiWidth_;
+};
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef FatJetCuts_h
+#define FatJetCuts_h
+
+// Fat jet selection of FatJet_Sel.py, loaded from the same key = value file
+// (fatjet_cuts.cfg) and turned into RDataFrame expressions.
+
+#include <fstream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct FatJetCuts {
+    std::vector<std::string> hltPaths;
+
+    std::optional<double> forwardPtMax;
+    std::optional<double> forwardEtaMin;
+    std::optional<double> forwardEtaMax;
+    std::optional<double> forwardTau21;
+
+    std::optional<double> centralPtMin;
+    std::optional<double> centralEtaMax;
+    std::optional<double> centralMassMin;
+    std::optional<double> centralMassMax;
+    std::optional<double> centralTau21;
+
+    bool needsTau21() const { return forwardTau21.has_value() || centralTau21.has_value(); }
+
+    // " && ".join(HLT_paths); "true" when no path is configured.
+    std::string triggerSelection() const {
+        std::string expr;
+        for (const std::string& path : hltPaths) {
+            if (!expr.empty()) expr += " && ";
+            expr += path + "==true";
+        }
+        return expr.empty() ? "true" : expr;
+    }
+
+    std::string forwardMask() const {
+        std::vector<std::string> terms;
+        if (forwardPtMax) terms.push_back("FatJet_pt <= " + number(*forwardPtMax));
+        if (forwardEtaMin) terms.push_back("abs(FatJet_eta) >= " + number(*forwardEtaMin));
+        if (forwardEtaMax) terms.push_back("abs(FatJet_eta) <= " + number(*forwardEtaMax));
+        if (forwardTau21) terms.push_back("FatJet_tau21 < " + number(*forwardTau21));
+        return join(terms);
+    }
+
+    std::string centralMask() const {
+        std::vector<std::string> terms;
+        if (centralPtMin) terms.push_back("FatJet_pt >= " + number(*centralPtMin));
+        if (centralEtaMax) terms.push_back("abs(FatJet_eta) <= " + number(*centralEtaMax));
+        if (centralMassMin) terms.push_back("FatJet_mass > " + number(*centralMassMin));
+        if (centralMassMax) terms.push_back("FatJet_mass < " + number(*centralMassMax));
+        if (centralTau21) terms.push_back("FatJet_tau21 < " + number(*centralTau21));
+        return join(terms);
+    }
+
+    // Everything the selection depends on, for the result cache key.
+    std::string fingerprint() const {
+        return triggerSelection() + "|" + centralMask() + "|" + forwardMask();
+    }
+
+    static FatJetCuts load(const std::string& fileName) {
+        std::ifstream in(fileName);
+        if (!in) throw std::runtime_error("cannot open cut file " + fileName);
+
+        FatJetCuts cuts;
+        const std::map<std::string, std::optional<double> FatJetCuts::*> numeric = {
+            {"forward.pt_max", &FatJetCuts::forwardPtMax},
+            {"forward.eta_min", &FatJetCuts::forwardEtaMin},
+            {"forward.eta_max", &FatJetCuts::forwardEtaMax},
+            {"forward.tau21", &FatJetCuts::forwardTau21},
+            {"central.pt_min", &FatJetCuts::centralPtMin},
+            {"central.eta_max", &FatJetCuts::centralEtaMax},
+            {"central.mass_min", &FatJetCuts::centralMassMin},
+            {"central.mass_max", &FatJetCuts::centralMassMax},
+            {"central.tau21", &FatJetCuts::centralTau21},
+        };
+
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(in, line)) {
+            ++lineNumber;
+            line = trim(line.substr(0, line.find('#')));
+            if (line.empty()) continue;
+            const size_t eq = line.find('=');
+            if (eq == std::string::npos) {
+                throw std::runtime_error(fileName + ":" + std::to_string(lineNumber) + ": expected key = value");
+            }
+            const std::string key = trim(line.substr(0, eq));
+            const std::string value = trim(line.substr(eq + 1));
+            if (key == "hlt_paths") {
+                std::stringstream paths(value);
+                std::string path;
+                while (std::getline(paths, path, ',')) {
+                    path = trim(path);
+                    if (!path.empty()) cuts.hltPaths.push_back(path);
+                }
+                continue;
+            }
+            const auto it = numeric.find(key);
+            if (it == numeric.end()) {
+                throw std::runtime_error(fileName + ":" + std::to_string(lineNumber) + ": unknown cut '" + key + "'");
+            }
+            cuts.*(it->second) = std::stod(value);
+        }
+        return cuts;
+    }
+
+private:
+    static std::string trim(const std::string& s) {
+        const size_t first = s.find_first_not_of(" \t\r");
+        if (first == std::string::npos) return "";
+        return s.substr(first, s.find_last_not_of(" \t\r") - first + 1);
+    }
+
+    static std::string number(double value) {
+        std::ostringstream out;
+        out << value;
+        return out.str();
+    }
+
+    static std::string join(const std::vector<std::string>& terms) {
+        if (terms.empty()) return "FatJet_pt == FatJet_pt";  // all jets
+        std::string expr;
+        for (const std::string& term : terms) {
+            if (!expr.empty()) expr += " && ";
+            expr += "(" + term + ")";
+        }
+        return expr;
+    }
+};
+
+#endif
@@ -1,9 +1,15 @@
 import ROOT
+import glob
+import hashlib
+import os
 import sys
 
 
 HLT_paths = ["HLT_AK8PFJetFwd15==true", "HLT_AK8PFJet230_SoftDropMass40==true"]
 FatJet_variables = [ "pt", "eta" , "phi"  ]
+cuts_file = os.path.join(os.path.dirname(os.path.abspath(__file__)), "fatjet_cuts.cfg")
+# One skim per input file, reused while the file and the selection are unchanged
+skim_cache_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)), ".fatjet_cache", "skims")
 
 cuts = {
     'forward' : {
@@ -15,11 +21,76 @@ cuts = {
     'central' : {
         'pt_min' : 30,
         'eta_max' : 2.4, 
-        'mass_range' : [70, 100],
+        'mass_min' : 70,
+        'mass_max' : 100,
     #    'tau21' : 0.45,  # only if in non-boosted topologies in the gridpack, wp to be check 
     },
 }
 
+# Mask terms per cut, in the order of FatJetCuts::forwardMask/centralMask, so
+# that the skim and fatjet_image(fromNano=true) select the same jets. A cut
+# missing from the file is not applied.
+mask_terms = {
+    'forward' : [
+        ('pt_max', "FatJet_pt <= {:g}"),
+        ('eta_min', "abs(FatJet_eta) >= {:g}"),
+        ('eta_max', "abs(FatJet_eta) <= {:g}"),
+        ('tau21', "FatJet_tau21 < {:g}"),
+    ],
+    'central' : [
+        ('pt_min', "FatJet_pt >= {:g}"),
+        ('eta_max', "abs(FatJet_eta) <= {:g}"),
+        ('mass_min', "FatJet_mass > {:g}"),
+        ('mass_max', "FatJet_mass < {:g}"),
+        ('tau21', "FatJet_tau21 < {:g}"),
+    ],
+}
+
+def load_cuts(fileName):
+    """Reads the key = value cut file shared with fatjet_image.cpp (FatJetCuts.h)."""
+    paths = []
+    loaded = {'forward' : {}, 'central' : {}}
+    with open(fileName) as f:
+        for line in f:
+            line = line.split('#')[0].strip()
+            if not line:
+                continue
+            key, value = [x.strip() for x in line.split('=', 1)]
+            if key == 'hlt_paths':
+                paths = [f"{p.strip()}==true" for p in value.split(',') if p.strip()]
+                continue
+            region, _, cut = key.partition('.')
+            if cut not in dict(mask_terms.get(region, [])):
+                raise ValueError(f"{fileName}: unknown cut '{key}'")
+            loaded[region][cut] = float(value)
+    return paths, loaded
+
+def region_mask(region, region_cuts):
+    """Jet mask of one region from the cuts present, as FatJetCuts.h builds it."""
+    terms = [f"({term.format(region_cuts[cut])})" for cut, term in mask_terms[region] if cut in region_cuts]
+    return " && ".join(terms) if terms else "FatJet_pt == FatJet_pt"
+
+if os.path.exists(cuts_file):
+    HLT_paths, cuts = load_cuts(cuts_file)
+
+def skim_key(fileName, selection):
+    """Cache key of the skim of one input file: path, size, mtime and selection."""
+    st = os.stat(fileName)
+    ident = f"{os.path.realpath(fileName)}|{st.st_size}|{st.st_mtime_ns}|{selection}"
+    return hashlib.sha1(ident.encode()).hexdigest()[:16]
+
+def select_fatjets(rdf, central_cuts, frw_cuts):
+    fatjet_trigger_selection = " && ".join(HLT_paths)
+    if fatjet_trigger_selection:
+        rdf = rdf.Filter(fatjet_trigger_selection, "HLT")
+    rdf = rdf.Define("FatJet_tau21", "FatJet_tau2/FatJet_tau1")
+    rdf = rdf.Define("central_mask", central_cuts)
+    rdf = rdf.Define("frw_mask", frw_cuts)
+    for var in FatJet_variables:
+        rdf = rdf.Define(f"FatJet_central_{var}", f"FatJet_{var}[central_mask]")
+        rdf = rdf.Define(f"FatJet_frw_{var}", f"FatJet_{var}[frw_mask]")
+    return rdf
+
 def fatjet_image(sample):
     sInput = "/eos/user/l/ldellape/VBS/VBS_cards/privateMCproduction/nanov12_samples"
     sOutput = ""
@@ -31,36 +102,54 @@ def fatjet_image(sample):
         input_nano = sInput + "/ssWW*/*.root"
         sOutput= "WW_cleanFatJet.root"
     
-    rdf = ROOT.RDataFrame("Events", input_nano)
-    fatjet_trigger_selection = " && ".join(HLT_paths)
-    
-    frw_cuts = (f"FatJet_pt <= {cuts['forward']['pt_max']} && " +
-                f"(abs(FatJet_eta) >= {cuts['forward']['eta_min']} && abs(FatJet_eta) <= {cuts['forward']['eta_max']})  " 
-            #    f"(FatJet_tau21 < {cuts['forward']['tau21']})" 
-                )
-    central_cuts = (f"FatJet_pt >= {cuts['central']['pt_min']} && " +
-                    f"abs(FatJet_eta) <= {cuts['central']['eta_max']} && " + 
-                    f"(FatJet_mass > {cuts['central']['mass_range'][0]} && FatJet_mass < {cuts['central']['mass_range'][1]})  " 
-                #   f"(FatJet_tau21 < {cuts['forward']['tau21']})"   
-                    )  
+    frw_cuts = region_mask('forward', cuts['forward'])
+    central_cuts = region_mask('central', cuts['central'])
     print("***  central cuts *******")  
     print(central_cuts)
     print("*** forward cuts ******* ")
     print(frw_cuts)
-    rdf = rdf.Define("FatJet_tau21", "FatJet_tau2/FatJet_tau1")
-    
-    
-    rdf = rdf.Define("central_mask", central_cuts)
-    rdf = rdf.Define("frw_mask", frw_cuts)
+
     columns_to_save = []
     for var in FatJet_variables:
         columns_to_save.append(f"FatJet_frw_{var}")
         columns_to_save.append(f"FatJet_central_{var}")
-        rdf = rdf.Define(f"FatJet_central_{var}", f"FatJet_{var}[central_mask]")
-        rdf = rdf.Define(f"FatJet_frw_{var}", f"FatJet_{var}[frw_mask]")
-    
 
-    rdf.Snapshot("Events", sOutput, columns_to_save)
+    # Only new or changed input files are skimmed, all in one RunGraphs call;
+    # the per-file skims are then merged into sOutput.
+    ROOT.EnableImplicitMT()
+    os.makedirs(skim_cache_dir, exist_ok=True)
+    selection = repr((HLT_paths, central_cuts, frw_cuts, columns_to_save))
+    options = ROOT.RDF.RSnapshotOptions()
+    options.fLazy = True
+    skims, pending = [], []
+    for input_file in sorted(glob.glob(input_nano)):
+        skim = os.path.join(skim_cache_dir, skim_key(input_file, selection) + ".root")
+        skims.append(skim)
+        if os.path.exists(skim):
+            continue
+        rdf = select_fatjets(ROOT.RDataFrame("Events", input_file), central_cuts, frw_cuts)
+        tmp = skim + ".tmp.root"
+        pending.append((rdf, tmp, skim, rdf.Snapshot("Events", tmp, columns_to_save, options)))
+    print(f"{sample}: {len(skims) - len(pending)} skims cached, {len(pending)} files to skim")
+    if pending:
+        ROOT.RDF.RunGraphs([p[3] for p in pending])
+        for _, tmp, skim, _ in pending:
+            os.replace(tmp, skim)
+
+    manifest = sOutput + ".inputs"
+    if os.path.exists(sOutput) and os.path.exists(manifest):
+        with open(manifest) as f:
+            if f.read().split() == skims:
+                print(f"{sOutput} is up to date")
+                return
+    merger = ROOT.TFileMerger(False)
+    merger.OutputFile(sOutput, "RECREATE")
+    for skim in skims:
+        merger.AddFile(skim)
+    if not merger.Merge():
+        raise RuntimeError(f"merging the skims into {sOutput} failed")
+    with open(manifest, "w") as f:
+        f.write("\n".join(skims) + "\n")
     
 if __name__ == "__main__":
     data_sample = sys.argv[1]
@@ -0,0 +1,181 @@
+#ifndef ImageShardWriter_h
+#define ImageShardWriter_h
+
+// Streaming writer of per-jet images for ML training.
+//
+// Images are written as float32 NumPy .npy shards of shape
+// (n, nPixels, nPixels), <prefix>_00000.npy, <prefix>_00001.npy, ..., each
+// holding at most imagesPerShard images, plus <prefix>_index.csv with one
+// line per image (shard, row, provenance). Images are appended in batches, so
+// the memory held is one batch per producer whatever the sample size. The
+// shards are uncompressed and 64-byte aligned, so a consumer can mmap them
+// without ROOT:
+//
+//   x = numpy.load("ssWW_00000.npy", mmap_mode="r")   # (n, N, N) float32
+//
+// Any fixed per-row shape can be written the same way, e.g. zero-padded
+// point clouds of shape (maxPoints, features). With half = true the shards
+// are float16 ('<f2'), half the size; numpy reads them the same way.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Rewrites the fixed-size v1.0 header at the start of f, so that the row
+// count can be patched in place once the file is complete.
+inline void writeNpyHeader(std::FILE* f, const char* descr, const std::vector<size_t>& shape) {
+    constexpr size_t kHeaderSize = 128;
+    std::string dims;
+    for (size_t d : shape) dims += std::to_string(d) + ", ";
+    if (shape.size() > 1) dims.resize(dims.size() - 2);
+    else dims.resize(dims.size() - 1);  // (n,)
+    std::string header = std::string("{'descr': '") + descr + "', 'fortran_order': False, 'shape': (" + dims + "), }";
+    header.resize(kHeaderSize - 10 - 1, ' ');
+    header += '\n';
+    const uint16_t length = header.size();
+    std::fseek(f, 0, SEEK_SET);
+    std::fwrite("\x93NUMPY\x01\x00", 1, 8, f);
+    const unsigned char le[2] = {static_cast<unsigned char>(length & 0xff), static_cast<unsigned char>(length >> 8)};
+    std::fwrite(le, 1, 2, f);
+    std::fwrite(header.data(), 1, header.size(), f);
+}
+
+// IEEE binary16 bits of x, rounded to nearest even; overflows to infinity.
+inline uint16_t floatToHalf(float x) {
+    uint32_t f;
+    std::memcpy(&f, &x, sizeof(f));
+    const uint16_t sign = (f >> 16) & 0x8000;
+    f &= 0x7fffffff;
+    if (f >= 0x7f800000) return sign | 0x7c00 | (f > 0x7f800000 ? 0x200 : 0);  // inf, nan
+    if (f >= 0x477ff000) return sign | 0x7c00;                                   // >= 65520
+    if (f < 0x38800000) {                                                        // subnormal
+        float a;
+        std::memcpy(&a, &f, sizeof(a));
+        return sign | static_cast<uint16_t>(std::nearbyint(a * 16777216.f));
+    }
+    f += 0xc8000fff + ((f >> 13) & 1);  // rebias the exponent, round the mantissa
+    return sign | static_cast<uint16_t>(f >> 13);
+}
+
+// Writes n floats to f as float32, or as float16 through scratch.
+inline void writeFloats(std::FILE* f, const float* values, size_t n, bool half, std::vector<uint16_t>& scratch) {
+    if (!half) {
+        std::fwrite(values, sizeof(float), n, f);
+        return;
+    }
+    scratch.resize(n);
+    for (size_t i = 0; i < n; ++i) scratch[i] = floatToHalf(values[i]);
+    std::fwrite(scratch.data(), sizeof(uint16_t), n, f);
+}
+
+struct ImageIndexEntry {
+    int file = 0;          // index of the input file in the sample
+    long long entry = 0;   // tree entry
+    int jet = 0;           // jet index in the entry
+    float pt = 0, eta = 0, phi = 0;
+};
+
+class ImageShardWriter {
+public:
+    ImageShardWriter(const std::string& directory, const std::string& prefix, int nPixels,
+                     size_t imagesPerShard = 65536, bool half = false)
+        : ImageShardWriter(directory, prefix, std::vector<size_t>{size_t(nPixels), size_t(nPixels)},
+                           imagesPerShard, half) {}
+
+    ImageShardWriter(const std::string& directory, const std::string& prefix, const std::vector<size_t>& rowShape,
+                     size_t imagesPerShard = 65536, bool half = false)
+        : base_(directory + "/" + prefix),
+          imageSize_(1),
+          rowShape_(rowShape),
+          imagesPerShard_(imagesPerShard),
+          half_(half) {
+        for (size_t d : rowShape_) imageSize_ *= d;
+        index_ = std::fopen((base_ + "_index.csv").c_str(), "w");
+        if (index_ == nullptr) throw std::runtime_error("cannot create " + base_ + "_index.csv");
+        std::fprintf(index_, "shard,row,file,entry,jet,pt,eta,phi\n");
+    }
+
+    ~ImageShardWriter() { close(); }
+
+    ImageShardWriter(const ImageShardWriter&) = delete;
+    ImageShardWriter& operator=(const ImageShardWriter&) = delete;
+
+    size_t imageSize() const { return imageSize_; }
+    long long imagesWritten() const { return written_; }
+
+    // Appends index.size() images stored back to back in images. Thread safe;
+    // producers fill their own batch and hand it over when full.
+    void write(const std::vector<float>& images, const std::vector<ImageIndexEntry>& index) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        const size_t n = index.size();
+        if (images.size() < n * imageSize_) throw std::invalid_argument("ImageShardWriter: batch too short");
+        size_t done = 0;
+        while (done < n) {
+            if (shard_ == nullptr) openShard();
+            const size_t room = imagesPerShard_ - rowsInShard_;
+            const size_t chunk = std::min(room, n - done);
+            writeFloats(shard_, images.data() + done * imageSize_, chunk * imageSize_, half_, scratch_);
+            for (size_t i = done; i < done + chunk; ++i) {
+                const ImageIndexEntry& e = index[i];
+                std::fprintf(index_, "%d,%zu,%d,%lld,%d,%g,%g,%g\n", shardNumber_, rowsInShard_++, e.file, e.entry,
+                             e.jet, e.pt, e.eta, e.phi);
+            }
+            done += chunk;
+            written_ += chunk;
+            if (rowsInShard_ == imagesPerShard_) closeShard();
+        }
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        closeShard();
+        if (index_ != nullptr) std::fclose(index_);
+        index_ = nullptr;
+    }
+
+private:
+    void writeHeader(size_t rows) {
+        std::vector<size_t> shape{rows};
+        shape.insert(shape.end(), rowShape_.begin(), rowShape_.end());
+        writeNpyHeader(shard_, half_ ? "<f2" : "<f4", shape);
+    }
+
+    void openShard() {
+        char name[32];
+        std::snprintf(name, sizeof(name), "_%05d.npy", ++shardNumber_);
+        shard_ = std::fopen((base_ + name).c_str(), "wb");
+        if (shard_ == nullptr) throw std::runtime_error("cannot create " + base_ + name);
+        rowsInShard_ = 0;
+        writeHeader(0);
+    }
+
+    void closeShard() {
+        if (shard_ == nullptr) return;
+        writeHeader(rowsInShard_);
+        std::fclose(shard_);
+        shard_ = nullptr;
+        std::fflush(index_);
+    }
+
+    std::string base_;
+    size_t imageSize_;
+    std::vector<size_t> rowShape_;
+    size_t imagesPerShard_;
+    bool half_;
+
+    std::mutex mutex_;
+    std::vector<uint16_t> scratch_;
+    std::FILE* shard_ = nullptr;
+    std::FILE* index_ = nullptr;
+    int shardNumber_ = -1;
+    size_t rowsInShard_ = 0;
+    long long written_ = 0;
+};
+
+#endif
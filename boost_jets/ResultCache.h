@@ -0,0 +1,113 @@
+#ifndef ResultCache_h
+#define ResultCache_h
+
+// Per-input-file result cache of the image tools (fatjet_image.cpp,
+// image_builder.cpp).
+//
+// A result is stored as <directory>/<key>.bin, where the key hashes the
+// absolute path, size and modification time of the input file together with
+// a configuration string (cuts, binning, tool version). Adding files to a
+// sample therefore only processes the new ones; changing a file or the
+// configuration invalidates just what depends on it. Files that cannot be
+// stat'ed (e.g. root:// URLs) are never cached.
+//
+// Entries are written to a temporary name and renamed, so an interrupted run
+// leaves no partial entry behind and can simply be restarted.
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+class ResultCache {
+public:
+    // An empty directory disables the cache, and so does one that cannot be
+    // created (with a warning): the tools then just process every file.
+    ResultCache(const std::string& directory, const std::string& configuration)
+        : directory_(directory), configuration_(hash(configuration)) {
+        if (directory_.empty()) return;
+        std::error_code error;
+        std::filesystem::create_directories(directory_, error);
+        if (error) {
+            std::cerr << "cannot create cache directory " << directory_ << ": " << error.message()
+                      << ", running without the cache" << std::endl;
+            directory_.clear();
+        }
+    }
+
+    bool enabled() const { return !directory_.empty(); }
+
+    // Cache file of an input, "" when the input is not cacheable.
+    std::string entry(const std::string& input, const std::string& extension = "bin") const {
+        struct stat info;
+        if (!enabled() || ::stat(input.c_str(), &info) != 0) return "";
+        char* real = ::realpath(input.c_str(), nullptr);
+        std::string id = real != nullptr ? real : input;
+        std::free(real);
+        id += "|" + std::to_string(info.st_size) + "|" + std::to_string(info.st_mtim.tv_sec) + "." +
+              std::to_string(info.st_mtim.tv_nsec) + "|" + configuration_;
+        return directory_ + "/" + hash(id) + "." + extension;
+    }
+
+    bool load(const std::string& input, std::vector<float>& data, long long* count = nullptr) const {
+        const std::string name = entry(input);
+        if (name.empty()) return false;
+        std::FILE* f = std::fopen(name.c_str(), "rb");
+        if (f == nullptr) return false;
+        Header header;
+        bool ok = std::fread(&header, sizeof(header), 1, f) == 1 && header.magic == kMagic;
+        if (ok) {
+            data.resize(header.size);
+            ok = std::fread(data.data(), sizeof(float), data.size(), f) == data.size();
+            if (count != nullptr) *count = header.count;
+        }
+        std::fclose(f);
+        return ok;
+    }
+
+    void store(const std::string& input, const std::vector<float>& data, long long count = 0) const {
+        const std::string name = entry(input);
+        if (name.empty()) return;
+        const std::string tmp = name + ".tmp" + std::to_string(::getpid());
+        std::FILE* f = std::fopen(tmp.c_str(), "wb");
+        if (f == nullptr) return;
+        const Header header{kMagic, static_cast<uint64_t>(data.size()), count};
+        const bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1 &&
+                        std::fwrite(data.data(), sizeof(float), data.size(), f) == data.size();
+        if (std::fclose(f) == 0 && ok) std::rename(tmp.c_str(), name.c_str());
+        else std::remove(tmp.c_str());
+    }
+
+    // 64-bit FNV-1a, as hex.
+    static std::string hash(const std::string& text) {
+        uint64_t h = 14695981039346656037ull;
+        for (unsigned char c : text) {
+            h ^= c;
+            h *= 1099511628211ull;
+        }
+        char out[17];
+        std::snprintf(out, sizeof(out), "%016llx", static_cast<unsigned long long>(h));
+        return out;
+    }
+
+private:
+    static constexpr uint32_t kMagic = 0x31434a46;  // "FJC1"
+
+    struct Header {
+        uint32_t magic;
+        uint64_t size;
+        long long count;
+    };
+
+    std::string directory_;
+    std::string configuration_;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef SparseShardWriter_h
+#define SparseShardWriter_h
+
+// Streaming writer of ragged per-jet records: COO jet images and unpadded
+// point clouds.
+//
+// Each shard <prefix>_NNNNN holds at most rowsPerShard jets as
+//   <prefix>_NNNNN_values.npy   float32 (points, width)  point features, or
+//                                                         pixel values (width 1);
+//                                                         float16 with half
+//   <prefix>_NNNNN_index.npy    int32   (points,)         flat pixel, COO only
+//   <prefix>_NNNNN_offsets.npy  int64   (rows + 1,)       first point of each jet
+// plus <prefix>_index.csv as for ImageShardWriter. Jet r owns the points
+// offsets[r] to offsets[r + 1]. A COO shard densifies on load with
+//
+//   off = numpy.load("ssWW_00000_offsets.npy")
+//   idx = numpy.load("ssWW_00000_index.npy")
+//   val = numpy.load("ssWW_00000_values.npy")[:, 0]
+//   x = numpy.zeros((len(off) - 1, N * N), "f4")
+//   x[numpy.repeat(numpy.arange(len(off) - 1), numpy.diff(off)), idx] = val
+//   x = x.reshape(-1, N, N)
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ImageShardWriter.h"
+
+class SparseShardWriter {
+public:
+    // width values per point; withIndex adds the int32 pixel index column.
+    SparseShardWriter(const std::string& directory, const std::string& prefix, int width, bool withIndex,
+                      size_t rowsPerShard = 65536, bool half = false)
+        : base_(directory + "/" + prefix),
+          width_(width),
+          withIndex_(withIndex),
+          rowsPerShard_(rowsPerShard),
+          half_(half) {
+        index_ = std::fopen((base_ + "_index.csv").c_str(), "w");
+        if (index_ == nullptr) throw std::runtime_error("cannot create " + base_ + "_index.csv");
+        std::fprintf(index_, "shard,row,file,entry,jet,pt,eta,phi\n");
+    }
+
+    ~SparseShardWriter() { close(); }
+
+    SparseShardWriter(const SparseShardWriter&) = delete;
+    SparseShardWriter& operator=(const SparseShardWriter&) = delete;
+
+    int width() const { return width_; }
+    long long rowsWritten() const { return written_; }
+    long long pointsWritten() const { return pointsWritten_; }
+
+    // Appends entries.size() jets; jet i has counts[i] points, stored back to
+    // back in values (width floats each) and, for COO, pixels. Thread safe.
+    void write(const std::vector<float>& values, const std::vector<int>& pixels, const std::vector<int>& counts,
+               const std::vector<ImageIndexEntry>& entries) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        size_t point = 0;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (values_ == nullptr) openShard();
+            const size_t n = counts[i];
+            if (values.size() < (point + n) * width_ || (withIndex_ && pixels.size() < point + n)) {
+                throw std::invalid_argument("SparseShardWriter: batch too short");
+            }
+            writeFloats(values_, values.data() + point * width_, n * width_, half_, scratch_);
+            if (withIndex_) std::fwrite(pixels.data() + point, sizeof(int32_t), n, pixels_);
+            pointsInShard_ += n;
+            const int64_t end = pointsInShard_;
+            std::fwrite(&end, sizeof(end), 1, offsets_);
+            const ImageIndexEntry& e = entries[i];
+            std::fprintf(index_, "%d,%zu,%d,%lld,%d,%g,%g,%g\n", shardNumber_, rowsInShard_++, e.file, e.entry, e.jet,
+                         e.pt, e.eta, e.phi);
+            point += n;
+            pointsWritten_ += n;
+            ++written_;
+            if (rowsInShard_ == rowsPerShard_) closeShard();
+        }
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        closeShard();
+        if (index_ != nullptr) std::fclose(index_);
+        index_ = nullptr;
+    }
+
+private:
+    std::FILE* openArray(const std::string& suffix) {
+        const std::string name = shardBase_ + suffix;
+        std::FILE* f = std::fopen(name.c_str(), "wb");
+        if (f == nullptr) throw std::runtime_error("cannot create " + name);
+        return f;
+    }
+
+    void writeHeaders() {
+        writeNpyHeader(values_, half_ ? "<f2" : "<f4", {pointsInShard_, size_t(width_)});
+        if (withIndex_) writeNpyHeader(pixels_, "<i4", {pointsInShard_});
+        writeNpyHeader(offsets_, "<i8", {rowsInShard_ + 1});
+    }
+
+    void openShard() {
+        char number[16];
+        std::snprintf(number, sizeof(number), "_%05d", ++shardNumber_);
+        shardBase_ = base_ + number;
+        values_ = openArray("_values.npy");
+        if (withIndex_) pixels_ = openArray("_index.npy");
+        offsets_ = openArray("_offsets.npy");
+        rowsInShard_ = 0;
+        pointsInShard_ = 0;
+        writeHeaders();
+        const int64_t zero = 0;
+        std::fwrite(&zero, sizeof(zero), 1, offsets_);
+    }
+
+    void closeShard() {
+        if (values_ == nullptr) return;
+        writeHeaders();
+        std::fclose(values_);
+        if (pixels_ != nullptr) std::fclose(pixels_);
+        std::fclose(offsets_);
+        values_ = pixels_ = offsets_ = nullptr;
+        std::fflush(index_);
+    }
+
+    std::string base_;
+    std::string shardBase_;
+    int width_;
+    bool withIndex_;
+    size_t rowsPerShard_;
+    bool half_;
+
+    std::mutex mutex_;
+    std::vector<uint16_t> scratch_;
+    std::FILE* values_ = nullptr;
+    std::FILE* pixels_ = nullptr;
+    std::FILE* offsets_ = nullptr;
+    std::FILE* index_ = nullptr;
+    int shardNumber_ = -1;
+    size_t rowsInShard_ = 0;
+    size_t pointsInShard_ = 0;
+    long long written_ = 0;
+    long long pointsWritten_ = 0;
+};
+
+#endif
@@ -0,0 +1,768 @@
+// Standalone benchmarks of the FatJetAnalyzer hot loops and the image tools,
+// driven by the seeded synthetic jet generator. No cmsRun, CMSSW release or
+// input file is needed.
+//
+//   g++ -O2 -std=c++17 -I.. -I../jetConstituents/plugins -o fatjet_bench fatjet_bench.cpp $(root-config --cflags --libs) -ltbb
+//   ./fatjet_bench [--filter substring] [--min-time seconds] [--json results.json]
+//
+// Add -DFATJET_BENCH_NO_ROOT (and drop root-config) to build only the
+// ROOT-free benchmarks. The JSON follows the Google Benchmark layout, so the
+// usual compare scripts work on it.
+
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "SyntheticJets.h"
+#include "EtaPhiGrid.h"
+#include "JetConstituentSoA.h"
+#include "JetImage.h"
+#include "JetPointCloud.h"
+#include "JetSubstructure.h"
+#include "PrecisionPolicy.h"
+
+#ifndef FATJET_BENCH_NO_ROOT
+#include "TH1F.h"
+#include "TH2F.h"
+#include "TMemFile.h"
+#include "TTree.h"
+#include "FatJetTreeColumns.h"
+#include "BranchBufferManager.h"
+#include "AsyncTreeWriter.h"
+#include "HistogramRegistry.h"
+#endif
+
+// ---------------------------------------------------------------------------
+// Allocation counting
+
+static std::atomic<long long> gAllocations{0};
+
+void* operator new(std::size_t size) {
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+    using namespace fatjet::bench;
+
+    // -----------------------------------------------------------------------
+    // Harness
+
+    struct Result {
+        std::string name;
+        long long iterations = 0;
+        double realSeconds = 0;
+        double cpuSeconds = 0;
+        long long items = 0;
+        long long allocations = 0;
+        std::string itemLabel;
+    };
+
+    struct Benchmark {
+        std::string name;
+        std::string itemLabel;             // what one processed item is (jet, image, ...)
+        std::function<long long()> body;   // runs one iteration, returns items processed
+    };
+
+    double cpuNow() {
+        timespec ts;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        return ts.tv_sec + 1e-9 * ts.tv_nsec;
+    }
+
+    Result run(const Benchmark& bm, double minTime) {
+        bm.body();  // warm-up: buffers reach their steady-state capacity
+        Result r;
+        r.name = bm.name;
+        r.itemLabel = bm.itemLabel;
+        const long long allocStart = gAllocations.load();
+        const auto wallStart = std::chrono::steady_clock::now();
+        const double cpuStart = cpuNow();
+        do {
+            r.items += bm.body();
+            ++r.iterations;
+            r.realSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+        } while (r.realSeconds < minTime);
+        r.cpuSeconds = cpuNow() - cpuStart;
+        r.allocations = gAllocations.load() - allocStart;
+        return r;
+    }
+
+    void writeJson(const std::vector<Result>& results, const std::string& fileName) {
+        std::ofstream out(fileName);
+        out << "{\n  \"context\": {\"executable\": \"fatjet_bench\", \"library_build_type\": \"release\"},\n"
+            << "  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& r = results[i];
+            const double items = std::max<long long>(r.items, 1);
+            out << "    {\"name\": \"" << r.name << "\", \"run_type\": \"iteration\", \"iterations\": " << r.iterations
+                << ", \"real_time\": " << 1e9 * r.realSeconds / items << ", \"cpu_time\": " << 1e9 * r.cpuSeconds / items
+                << ", \"time_unit\": \"ns\", \"items_per_second\": " << items / r.realSeconds
+                << ", \"allocations_per_item\": " << r.allocations / items << ", \"item\": \"" << r.itemLabel << "\"}"
+                << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+    }
+
+    // -----------------------------------------------------------------------
+    // Inputs shared by the benchmarks
+
+    const std::vector<SyntheticEvent>& sample() {
+        static const std::vector<SyntheticEvent> events = JetGenerator(12345).events(500);
+        return events;
+    }
+
+    // Stand-in for reco::PFCandidate reached through an edm::Ptr: a
+    // polymorphic object behind a pointer, and a getPFConstituents() that
+    // materializes a fresh vector on every call.
+    struct CandidateBase {
+        virtual ~CandidateBase() = default;
+        virtual double pt() const = 0;
+        virtual double eta() const = 0;
+        virtual double phi() const = 0;
+    };
+    struct Candidate final : CandidateBase {
+        explicit Candidate(const SyntheticConstituent& c) : c_(c) {}
+        double pt() const override { return c_.pt; }
+        double eta() const override { return c_.eta; }
+        double phi() const override { return c_.phi; }
+        SyntheticConstituent c_;
+    };
+    struct CandidateJet {
+        std::vector<std::unique_ptr<CandidateBase>> daughters;
+        std::vector<const CandidateBase*> getPFConstituents() const {
+            std::vector<const CandidateBase*> out;
+            for (const auto& d : daughters) out.push_back(d.get());
+            return out;
+        }
+        size_t numberOfDaughters() const { return daughters.size(); }
+        const CandidateBase* daughter(size_t i) const { return daughters[i].get(); }
+    };
+
+    const std::vector<std::vector<CandidateJet>>& candidateSample() {
+        static const std::vector<std::vector<CandidateJet>> events = [] {
+            std::vector<std::vector<CandidateJet>> out;
+            for (const auto& event : sample()) {
+                out.emplace_back();
+                for (const auto& jet : event.jets) {
+                    out.back().emplace_back();
+                    for (const auto& c : jet.constituents) out.back().back().daughters.push_back(std::make_unique<Candidate>(c));
+                }
+            }
+            return out;
+        }();
+        return events;
+    }
+
+    // Flattened constituents of the whole sample, for the binning/image loops.
+    const JetConstituentSoA& soaSample() {
+        static const JetConstituentSoA soa = [] {
+            JetConstituentSoA out;
+            for (const auto& event : sample())
+                for (const auto& jet : event.jets) {
+                    for (const auto& c : jet.constituents) out.push_back(c.pt, c.eta, c.phi, c.mass);
+                    out.closeJet();
+                }
+            return out;
+        }();
+        return soa;
+    }
+
+    float gSink = 0;  // keeps results alive
+
+    // -----------------------------------------------------------------------
+    // Constituent extraction (FatJetAnalyzer::analyze)
+
+    long long extractionLegacy() {
+        // Three getPFConstituents() calls per jet and per-event vectors
+        // without reserve, as in the original analyzer.
+        static std::vector<float> pt, eta, phi;
+        static std::vector<int> idx;
+        long long jets = 0;
+        for (const auto& event : candidateSample()) {
+            pt.clear(); eta.clear(); phi.clear(); idx.clear();
+            int index = 0;
+            for (const auto& jet : event) {
+                for (const auto* c : jet.getPFConstituents()) {
+                    pt.push_back(c->pt()); eta.push_back(c->eta()); phi.push_back(c->phi()); idx.push_back(index);
+                }
+                gSink += jet.getPFConstituents().size();
+                for (const auto* c : jet.getPFConstituents()) gSink += c->pt() * 1e-9f;
+                ++index;
+                ++jets;
+            }
+        }
+        return jets;
+    }
+
+    long long extractionSoA() {
+        static JetConstituentSoA soa;
+        long long jets = 0;
+        for (const auto& event : candidateSample()) {
+            soa.clear();
+            for (const auto& jet : event) {
+                const size_t n = jet.numberOfDaughters();
+                for (size_t i = 0; i < n; ++i) {
+                    const CandidateBase* c = jet.daughter(i);
+                    soa.push_back(c->pt(), c->eta(), c->phi());
+                }
+                soa.closeJet();
+                const size_t j = soa.nJets() - 1;
+                gSink += soa.count(j);
+                for (int i = soa.begin(j); i < soa.end(j); ++i) gSink += soa.pt[i] * 1e-9f;
+                ++jets;
+            }
+        }
+        return jets;
+    }
+
+    // -----------------------------------------------------------------------
+    // eta-phi binning (constituents_image.cpp / PT_Sum_FatJet)
+
+    long long binningScalar() {
+        const JetConstituentSoA& soa = soaSample();
+        static std::vector<float> image;
+        const int Nbins = 100;
+        image.assign(Nbins * Nbins, 0.f);
+        for (size_t i = 0; i < soa.size(); ++i) {
+            float eta_bin = 2.4 / Nbins;
+            float phi_bin = 6.28 / Nbins;
+            int eta_bin_idx = int((std::abs(soa.eta[i]) / eta_bin));
+            int phi_bin_idx = int((soa.phi[i] + 3.14) / phi_bin);
+            if (eta_bin_idx >= 0 && eta_bin_idx < Nbins && phi_bin_idx >= 0 && phi_bin_idx < Nbins) {
+                image[eta_bin_idx * Nbins + phi_bin_idx] += soa.pt[i];
+            }
+        }
+        gSink += image[0];
+        return soa.size();
+    }
+
+    template <int NBins>
+    long long binningGrid() {
+        const JetConstituentSoA& soa = soaSample();
+        static const EtaPhiGrid<NBins> grid(0.f, 2.4f, true, 100);
+        static std::vector<float> image;
+        image.assign(grid.size(), 0.f);
+        grid.fill(soa.eta.data(), soa.phi.data(), soa.pt.data(), soa.size(), image.data());
+        gSink += image[0];
+        return soa.size();
+    }
+
+    // -----------------------------------------------------------------------
+    // Per-jet images (FatJetAnalyzer saveImages)
+
+    long long imageBuild(bool rotate, bool sparse = false) {
+        const JetConstituentSoA& soa = soaSample();
+        fatjet::JetImageConfig config;
+        config.rotate = rotate;
+        config.flip = rotate;
+        static fatjet::JetImageBuilder builder;
+        builder = fatjet::JetImageBuilder(config);
+        static std::vector<float> image;
+        static std::vector<int> pixels;
+        image.resize(builder.size());
+        size_t jet = 0;
+        for (const auto& event : sample()) {
+            for (const auto& j : event.jets) {
+                const int first = soa.begin(jet);
+                if (sparse) {
+                    builder.buildSparse(soa.pt.data() + first, soa.eta.data() + first, soa.phi.data() + first,
+                                        soa.count(jet), j.eta, j.phi, pixels, image);
+                    gSink += pixels.size();
+                } else {
+                    builder.build(soa.pt.data() + first, soa.eta.data() + first, soa.phi.data() + first,
+                                  soa.count(jet), j.eta, j.phi, image.data());
+                    gSink += image[0];
+                }
+                ++jet;
+            }
+        }
+        return jet;
+    }
+
+    // -----------------------------------------------------------------------
+    // Point clouds (FatJetAnalyzer savePointCloud, image_builder --point-clouds)
+
+    long long pointCloud(int maxPoints) {
+        struct Jet {
+            std::vector<float> pt, deta, dphi, energy, puppi;
+            std::vector<int> charge, pdgId;
+        };
+        static const std::vector<Jet> jets = [] {
+            std::vector<Jet> out;
+            for (const auto& event : sample()) {
+                for (const auto& j : event.jets) {
+                    Jet jet;
+                    for (const auto& c : j.constituents) {
+                        jet.pt.push_back(c.pt);
+                        jet.deta.push_back(c.eta - j.eta);
+                        jet.dphi.push_back(c.phi - j.phi);
+                        jet.energy.push_back(std::sqrt(c.mass * c.mass + std::pow(c.pt * std::cosh(c.eta), 2.f)));
+                        jet.puppi.push_back(c.puppiWeight);
+                        jet.charge.push_back(c.charge);
+                        jet.pdgId.push_back(c.pdgId);
+                    }
+                    out.push_back(std::move(jet));
+                }
+            }
+            return out;
+        }();
+        static fatjet::PointCloudBuilder builder;
+        builder = fatjet::PointCloudBuilder(maxPoints);
+        static std::vector<float> rows;
+        for (const Jet& j : jets) {
+            const int kept = builder.build(j.pt.data(), j.deta.data(), j.dphi.data(), j.energy.data(),
+                                           j.charge.data(), j.pdgId.data(), j.puppi.data(), j.pt.size());
+            const int padTo = std::max(maxPoints, kept);
+            rows.resize(size_t(padTo) * fatjet::kNPointFeatures);
+            builder.fillRows(rows.data(), padTo);
+            gSink += rows[0];
+        }
+        return jets.size();
+    }
+
+    // -----------------------------------------------------------------------
+    // Reduced-precision storage (FatJetAnalyzer defaultPrecision /
+    // branchPrecision): the in-place rounding before a Fill
+
+    long long precisionRounding(const char* spec) {
+        const JetConstituentSoA& soa = soaSample();
+        fatjet::Precision precision;
+        fatjet::parsePrecision(spec, precision);
+        static std::vector<float> pt, eta, phi;
+        pt.assign(soa.pt.begin(), soa.pt.end());
+        eta.assign(soa.eta.begin(), soa.eta.end());
+        phi.assign(soa.phi.begin(), soa.phi.end());
+        precision.apply(pt);
+        precision.apply(eta);
+        precision.apply(phi);
+        gSink += pt[0] + eta[0] + phi[0];
+        return pt.size();
+    }
+
+    // -----------------------------------------------------------------------
+    // Substructure (FatJetAnalyzer computeSubstructure)
+
+    long long substructure(int ecfMaxConstituents) {
+        const JetConstituentSoA& soa = soaSample();
+        fatjet::SubstructureConfig config;
+        config.ecfMaxConstituents = ecfMaxConstituents;
+        static fatjet::SubstructureEngine engine;
+        engine = fatjet::SubstructureEngine(config);
+        for (size_t jet = 0; jet < soa.nJets(); ++jet) {
+            const int first = soa.begin(jet);
+            const fatjet::SubstructureResult r = engine.compute(soa.pt.data() + first, soa.eta.data() + first,
+                                                                soa.phi.data() + first, soa.mass.data() + first,
+                                                                soa.count(jet));
+            gSink += r.tau2 + r.msoftdrop + r.n2;
+        }
+        return soa.nJets();
+    }
+
+#ifndef FATJET_BENCH_NO_ROOT
+    // -----------------------------------------------------------------------
+    // Histogram filling (the eight FatJetAnalyzer histograms)
+
+    long long histogramFill() {
+        static TH1F hPt("bPt", "", 100, 150, 1150), hEta("bEta", "", 100, -5, 5), hPhi("bPhi", "", 100, -3.1416, 3.1416),
+            hMass("bMass", "", 100, 0, 500), hN("bN", "", 100, 0, 200);
+        static TH2F hEtaPhi("bEtaPhi", "", 100, -5, 5, 100, -3.1416, 3.1416), hPtEta("bPtEta", "", 100, 150, 1150, 100, -5, 5),
+            hCPtEta("bCPtEta", "", 100, 0, 200, 100, -5, 5);
+        const JetConstituentSoA& soa = soaSample();
+        size_t jet = 0;
+        for (const auto& event : sample()) {
+            for (const auto& j : event.jets) {
+                hPt.Fill(j.pt); hEta.Fill(j.eta); hPhi.Fill(j.phi); hMass.Fill(j.mass);
+                hN.Fill(soa.count(jet)); hEtaPhi.Fill(j.eta, j.phi); hPtEta.Fill(j.pt, j.eta);
+                for (int i = soa.begin(jet); i < soa.end(jet); ++i) hCPtEta.Fill(soa.pt[i], soa.eta[i]);
+                ++jet;
+            }
+        }
+        return jet;
+    }
+
+    // The same eight through the config-declared registry, and with extra
+    // monitoring histograms on top: per-event buffers and FillN.
+    long long registryFill(int nExtra) {
+        using fatjet::HistogramSpec;
+        std::vector<HistogramSpec> specs = {
+            {"rPt", "", "fj_pt", "", 100, 150, 1150},
+            {"rEta", "", "fj_eta", "", 100, -5, 5},
+            {"rPhi", "", "fj_phi", "", 100, -3.1416, 3.1416},
+            {"rMass", "", "fj_mass", "", 100, 0, 500},
+            {"rN", "", "fj_nConstituents", "", 100, 0, 200},
+            {"rEtaPhi", "", "fj_eta", "fj_phi", 100, -5, 5, 100, -3.1416, 3.1416},
+            {"rPtEta", "", "fj_pt", "fj_eta", 100, 150, 1150, 100, -5, 5},
+            {"rCPtEta", "", "pf_pt", "pf_eta", 100, 0, 200, 100, -5, 5},
+        };
+        const char* extra[] = {"fj_tau21", "fj_msoftdrop", "pf_deta", "pf_dphi", "pf_ptFraction", "fj_n2"};
+        for (int i = 0; i < nExtra; ++i) {
+            specs.push_back({"rExtra" + std::to_string(i), "", extra[i % 6], "", 50 + i, -1, 1});
+        }
+        static std::vector<std::unique_ptr<TH1>> booked;
+        booked.clear();
+        fatjet::HistogramRegistry registry(specs, [](const HistogramSpec& spec) -> TH1* {
+            if (spec.y.empty()) {
+                booked.emplace_back(new TH1F(spec.name.c_str(), "", spec.nBinsX, spec.xMin, spec.xMax));
+            } else {
+                booked.emplace_back(new TH2F(spec.name.c_str(), "", spec.nBinsX, spec.xMin, spec.xMax, spec.nBinsY,
+                                             spec.yMin, spec.yMax));
+            }
+            return booked.back().get();
+        });
+        const JetConstituentSoA& soa = soaSample();
+        size_t jet = 0;
+        for (const auto& event : sample()) {
+            for (const auto& j : event.jets) {
+                fatjet::JetRecord record;
+                record.pt = j.pt;
+                record.eta = j.eta;
+                record.phi = j.phi;
+                record.mass = j.mass;
+                record.nConstituents = soa.count(jet);
+                registry.fillJet(record);
+                registry.fillConstituents(soa, soa.begin(jet), soa.end(jet), record);
+                ++jet;
+            }
+            registry.flush();
+        }
+        return jet;
+    }
+
+    // -----------------------------------------------------------------------
+    // Tree writing for each output format
+
+    // The synthetic sample through EventTreeBranches, one entry per event.
+    void writeSample(TTree& tree, fatjet::OutputFormat format) {
+        fatjet::EventTreeBranches branches;
+        branches.book(&tree, format);
+        static fatjet::EventColumns columns;
+        for (const auto& event : sample()) {
+            columns.clear();
+            int index = 0;
+            for (const auto& j : event.jets) {
+                for (const auto& c : j.constituents) columns.constituents.push_back(c.pt, c.eta, c.phi);
+                columns.constituents.closeJet();
+                const int n = j.constituents.size();
+                columns.fatjet_pt.push_back(j.pt);
+                columns.fatjet_eta.push_back(j.eta);
+                columns.fatjet_phi.push_back(j.phi);
+                columns.fatjet_mass.push_back(j.mass);
+                if (format == fatjet::OutputFormat::kColumnar) {
+                    columns.fatjet_nPF.push_back(n);
+                } else {
+                    columns.fatjet_Idx.push_back(index);
+                    columns.pf_IdxFatJet.insert(columns.pf_IdxFatJet.end(), n, index);
+                }
+                ++index;
+            }
+            branches.fill(columns);
+        }
+    }
+
+    long long treeWrite(fatjet::OutputFormat format) {
+        TMemFile file("bench.root", "RECREATE");
+        TTree tree("FatJetAnalyzer_AOD", "");
+        writeSample(tree, format);
+        tree.Write();
+        gSink += file.GetSize();
+        return sample().size();
+    }
+
+    // The tree of treeWrite, written once per format and read back entry by
+    // entry as the offline readers do: every branch, baskets decompressed.
+    // The vector layout goes through the std::vector streamer; the columnar
+    // arrays are read straight into buffers sized from the counter leaves.
+    long long treeRead(fatjet::OutputFormat format) {
+        static std::unique_ptr<TMemFile> written[2];
+        std::unique_ptr<TMemFile>& file = written[format == fatjet::OutputFormat::kColumnar];
+        if (file == nullptr) {
+            file = std::make_unique<TMemFile>("bench_read.root", "RECREATE");
+            TTree* tree = new TTree("FatJetAnalyzer_AOD", "");
+            tree->SetDirectory(file.get());
+            writeSample(*tree, format);
+            tree->Write();
+            delete tree;  // so that Get() reads the tree back from its key
+        }
+        std::unique_ptr<TTree> tree(file->Get<TTree>("FatJetAnalyzer_AOD"));
+        const long long entries = tree->GetEntries();
+        double sum = 0;
+        if (format == fatjet::OutputFormat::kColumnar) {
+            int nFatJet = 0, nPF = 0;
+            std::vector<float> jets[4], pf[3];
+            std::vector<int> jetNPF, jetOffset;
+            const int maxJets = tree->GetLeaf("nFatJet")->GetMaximum();
+            const int maxPF = tree->GetLeaf("nPF")->GetMaximum();
+            tree->SetBranchAddress("nFatJet", &nFatJet);
+            tree->SetBranchAddress("nPF", &nPF);
+            const char* jetNames[] = {"fatjet_pt", "fatjet_eta", "fatjet_phi", "fatjet_mass"};
+            const char* pfNames[] = {"pf_pt", "pf_eta", "pf_phi"};
+            for (int k = 0; k < 4; ++k) {
+                jets[k].resize(maxJets);
+                tree->SetBranchAddress(jetNames[k], jets[k].data());
+            }
+            for (int k = 0; k < 3; ++k) {
+                pf[k].resize(maxPF);
+                tree->SetBranchAddress(pfNames[k], pf[k].data());
+            }
+            jetNPF.resize(maxJets);
+            jetOffset.resize(maxJets);
+            tree->SetBranchAddress("fatjet_nPF", jetNPF.data());
+            tree->SetBranchAddress("fatjet_pfOffset", jetOffset.data());
+            for (long long entry = 0; entry < entries; ++entry) {
+                tree->GetEntry(entry);
+                for (int i = 0; i < nPF; ++i) sum += pf[0][i];
+                if (nFatJet > 0) sum += jets[0][0] + jetNPF[nFatJet - 1] + jetOffset[nFatJet - 1];
+            }
+        } else {
+            std::vector<float>* jets[4] = {};
+            std::vector<float>* pf[3] = {};
+            std::vector<int>* jetIdx = nullptr;
+            std::vector<int>* pfJet = nullptr;
+            tree->SetBranchAddress("fatjet_pt", &jets[0]);
+            tree->SetBranchAddress("fatjet_eta", &jets[1]);
+            tree->SetBranchAddress("fatjet_phi", &jets[2]);
+            tree->SetBranchAddress("fatjet_mass", &jets[3]);
+            tree->SetBranchAddress("fatjet_Idx", &jetIdx);
+            tree->SetBranchAddress("pf_pt", &pf[0]);
+            tree->SetBranchAddress("pf_eta", &pf[1]);
+            tree->SetBranchAddress("pf_phi", &pf[2]);
+            tree->SetBranchAddress("pf_IdxFatJet", &pfJet);
+            for (long long entry = 0; entry < entries; ++entry) {
+                tree->GetEntry(entry);
+                for (float pt : *pf[0]) sum += pt;
+                if (!jets[0]->empty()) sum += jets[0]->front() + jetIdx->back() + pfJet->back();
+            }
+            tree->ResetBranchAddresses();
+            for (auto* v : jets) delete v;
+            for (auto* v : pf) delete v;
+            delete jetIdx;
+            delete pfJet;
+        }
+        gSink += sum;
+        return entries;
+    }
+
+    // -----------------------------------------------------------------------
+    // Branch buffers on high-pileup events (BranchBufferManager)
+
+    const std::vector<SyntheticEvent>& highPileupSample() {
+        static const std::vector<SyntheticEvent> events = [] {
+            GeneratorConfig config;
+            config.minConstituents = 100;
+            config.maxConstituents = 600;
+            config.maxJets = 6;
+            return JetGenerator(4242, config).events(1000);
+        }();
+        return events;
+    }
+
+    // The event columns and FatJetTree rows of one stream, filled as in
+    // analyze(). Cold starts from empty buffers, like a new stream; warm
+    // keeps them across iterations. Unmanaged buffers grow on push_back.
+    long long bufferFill(bool managed, bool cold) {
+        static fatjet::EventColumns warmColumns;
+        static std::vector<fatjet::JetFeatureRow> warmRows;
+        static fatjet::BranchBufferManager warmManager;
+        fatjet::EventColumns coldColumns;
+        std::vector<fatjet::JetFeatureRow> coldRows;
+        fatjet::BranchBufferManager coldManager;
+        fatjet::EventColumns& columns = cold ? coldColumns : warmColumns;
+        std::vector<fatjet::JetFeatureRow>& rows = cold ? coldRows : warmRows;
+        fatjet::BranchBufferManager& manager = cold ? coldManager : warmManager;
+
+        for (const auto& event : highPileupSample()) {
+            columns.clear();
+            if (managed) manager.prepare(columns, event.jets.size(), event.nConstituents(), nullptr);
+            size_t nRows = 0;
+            for (const auto& j : event.jets) {
+                if (nRows == rows.size()) rows.emplace_back();
+                fatjet::JetFeatureRow& row = rows[nRows];
+                row.clear();
+                if (managed) manager.prepare(row, nRows, j.constituents.size(), nullptr);
+                for (const auto& c : j.constituents) {
+                    columns.constituents.push_back(c.pt, c.eta, c.phi);
+                    row.forEachColumn([&c](auto& column, bool) {
+                        column.push_back(static_cast<typename std::decay_t<decltype(column)>::value_type>(c.pt));
+                    });
+                }
+                columns.constituents.closeJet();
+                columns.fatjet_pt.push_back(j.pt);
+                columns.fatjet_eta.push_back(j.eta);
+                columns.fatjet_phi.push_back(j.phi);
+                columns.fatjet_mass.push_back(j.mass);
+                columns.fatjet_Idx.push_back(nRows);
+                columns.pf_IdxFatJet.insert(columns.pf_IdxFatJet.end(), j.constituents.size(), nRows);
+                ++nRows;
+            }
+            if (managed) manager.finish(columns, rows, nRows, nullptr);
+            gSink += columns.constituents.pt.back();
+        }
+        return highPileupSample().size();
+    }
+
+    // -----------------------------------------------------------------------
+    // Event loop with the tree output (FatJetAnalyzer asyncTreeWriter)
+
+    // One analyze() per event: event and feature columns, substructure, then
+    // either the Fill calls or the hand-off to the writer tasks. ns/event is
+    // the latency seen by the event loop; the writer is kept across
+    // iterations, so in steady state a writer slower than the loop throttles
+    // it through the queue depth.
+    long long eventLoop(bool async) {
+        struct Output {
+            TMemFile file;
+            TTree eventTree{"FatJetAnalyzer_AOD", ""};
+            TTree featureTree{"FatJetTree", ""};
+            fatjet::EventTreeBranches eventBranches;
+            fatjet::JetFeatureBranches featureBranches;
+            std::unique_ptr<fatjet::AsyncTreeWriter> writer;
+
+            explicit Output(bool async) : file(async ? "bench_async.root" : "bench_sync.root", "RECREATE") {
+                eventBranches.book(&eventTree, fatjet::OutputFormat::kVector);
+                featureBranches.book(&featureTree);
+                if (!async) return;
+                writer = std::make_unique<fatjet::AsyncTreeWriter>(8, [this](fatjet::TreeFillBatch& batch) {
+                    return fill(batch.columns, batch.featureRows, batch.nFeatureRows);
+                });
+            }
+            long long fill(fatjet::EventColumns& columns, std::vector<fatjet::JetFeatureRow>& rows, size_t nRows) {
+                long long bytes = eventBranches.fill(columns);
+                for (size_t i = 0; i < nRows; ++i) bytes += featureBranches.fill(rows[i]);
+                return bytes;
+            }
+        };
+        // Built on first use, so the writer tasks only run for its benchmark.
+        Output& output = async ? [] () -> Output& { static Output o(true); return o; }()
+                               : [] () -> Output& { static Output o(false); return o; }();
+
+        static fatjet::EventColumns columns;
+        static std::vector<fatjet::JetFeatureRow> rows;
+        static fatjet::SubstructureEngine engine;
+        for (const auto& event : sample()) {
+            columns.clear();
+            size_t nRows = 0;
+            for (const auto& j : event.jets) {
+                if (nRows == rows.size()) rows.emplace_back();
+                fatjet::JetFeatureRow& row = rows[nRows];
+                row.clear();
+                for (const auto& c : j.constituents) {
+                    columns.constituents.push_back(c.pt, c.eta, c.phi, c.mass);
+                    row.forEachColumn([&c](auto& column, bool) {
+                        column.push_back(static_cast<typename std::decay_t<decltype(column)>::value_type>(c.pt));
+                    });
+                }
+                columns.constituents.closeJet();
+                const size_t jet = columns.constituents.nJets() - 1;
+                const int first = columns.constituents.begin(jet);
+                const fatjet::SubstructureResult r = engine.compute(
+                    columns.constituents.pt.data() + first, columns.constituents.eta.data() + first,
+                    columns.constituents.phi.data() + first, columns.constituents.mass.data() + first,
+                    columns.constituents.count(jet));
+                row.fj_tau1 = r.tau1;
+                row.fj_tau2 = r.tau2;
+                columns.fatjet_pt.push_back(j.pt);
+                columns.fatjet_eta.push_back(j.eta);
+                columns.fatjet_phi.push_back(j.phi);
+                columns.fatjet_mass.push_back(j.mass);
+                columns.fatjet_Idx.push_back(nRows);
+                columns.pf_IdxFatJet.insert(columns.pf_IdxFatJet.end(), j.constituents.size(), nRows);
+                ++nRows;
+            }
+            if (output.writer) {
+                fatjet::TreeFillBatch* batch = output.writer->acquire();
+                batch->columns.swap(columns);
+                batch->featureRows.swap(rows);
+                batch->nFeatureRows = nRows;
+                output.writer->submit(batch);
+            } else {
+                gSink += output.fill(columns, rows, nRows);
+            }
+        }
+        return sample().size();
+    }
+#endif
+
+    std::vector<Benchmark> benchmarks() {
+        return {
+            {"BM_ConstituentExtraction/legacy_three_pass", "jet", extractionLegacy},
+            {"BM_ConstituentExtraction/soa_single_pass", "jet", extractionSoA},
+            {"BM_EtaPhiBinning/scalar_division", "constituent", binningScalar},
+            {"BM_EtaPhiBinning/grid_100", "constituent", binningGrid<100>},
+            {"BM_EtaPhiBinning/grid_runtime_bins", "constituent", binningGrid<0>},
+            {"BM_JetImage/centred", "image", [] { return imageBuild(false); }},
+            {"BM_JetImage/rotated_flipped", "image", [] { return imageBuild(true); }},
+            {"BM_JetImage/rotated_flipped_sparse_coo", "image", [] { return imageBuild(true, true); }},
+            {"BM_PointCloud/ragged", "jet", [] { return pointCloud(0); }},
+            {"BM_PointCloud/padded_100", "jet", [] { return pointCloud(100); }},
+            {"BM_Precision/truncate_10", "constituent", [] { return precisionRounding("truncate:10"); }},
+            {"BM_Precision/quantize_12", "constituent", [] { return precisionRounding("quantize:-8:8:12"); }},
+            {"BM_Precision/float16_range_12", "constituent",
+             [] { return precisionRounding("float16:-8:8:12"); }},
+            {"BM_Substructure/tau_softdrop", "jet", [] { return substructure(0); }},
+            {"BM_Substructure/tau_softdrop_ecf_100", "jet", [] { return substructure(100); }},
+#ifndef FATJET_BENCH_NO_ROOT
+            {"BM_HistogramFill/eight_histograms", "jet", histogramFill},
+            {"BM_HistogramFill/registry_eight", "jet", [] { return registryFill(0); }},
+            {"BM_HistogramFill/registry_32", "jet", [] { return registryFill(24); }},
+            {"BM_TreeWrite/vector", "event", [] { return treeWrite(fatjet::OutputFormat::kVector); }},
+            {"BM_TreeWrite/columnar", "event", [] { return treeWrite(fatjet::OutputFormat::kColumnar); }},
+            {"BM_TreeRead/vector", "event", [] { return treeRead(fatjet::OutputFormat::kVector); }},
+            {"BM_TreeRead/columnar", "event", [] { return treeRead(fatjet::OutputFormat::kColumnar); }},
+            {"BM_BranchBuffers/high_pileup_cold_push_back", "event", [] { return bufferFill(false, true); }},
+            {"BM_BranchBuffers/high_pileup_cold_managed", "event", [] { return bufferFill(true, true); }},
+            {"BM_BranchBuffers/high_pileup_warm_push_back", "event", [] { return bufferFill(false, false); }},
+            {"BM_BranchBuffers/high_pileup_warm_managed", "event", [] { return bufferFill(true, false); }},
+            {"BM_EventLoop/sync_fill", "event", [] { return eventLoop(false); }},
+            {"BM_EventLoop/async_writer", "event", [] { return eventLoop(true); }},
+#endif
+        };
+    }
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::string filter, json;
+    double minTime = 0.5;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) filter = argv[++i];
+        else if (arg == "--min-time" && i + 1 < argc) minTime = std::atof(argv[++i]);
+        else if (arg == "--json" && i + 1 < argc) json = argv[++i];
+        else {
+            std::cerr << "usage: " << argv[0] << " [--filter substring] [--min-time seconds] [--json file]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<Result> results;
+    std::printf("%-48s %12s %12s %14s %12s\n", "benchmark", "ns/item", "cpu ns/item", "items/s", "allocs/item");
+    for (const Benchmark& bm : benchmarks()) {
+        if (!filter.empty() && bm.name.find(filter) == std::string::npos) continue;
+        const Result r = run(bm, minTime);
+        const double items = std::max<long long>(r.items, 1);
+        std::printf("%-48s %12.1f %12.1f %14.0f %12.3f  (per %s)\n", r.name.c_str(), 1e9 * r.realSeconds / items,
+                    1e9 * r.cpuSeconds / items, items / r.realSeconds, r.allocations / items, r.itemLabel.c_str());
+        results.push_back(r);
+    }
+    if (!json.empty()) writeJson(results, json);
+    return gSink == 12345.f ? 1 : 0;
+}
@@ -1,102 +1,130 @@
 #include "TSystem.h"
+#include <algorithm>
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <TH2F.h>
 #include <TCanvas.h>
 #include <TTree.h>
 #include <TFile.h>
 #include <TMath.h>
-#include <TTreeReader.h>
-#include <TTreeReaderArray.h>
 
-void constituents_image() {
-    TFile *file = TFile::Open("./jetConstituents/output_prova.root");
+#include "EtaPhiGrid.h"
 
-    TTree *tree = (TTree*)file->Get("JetAnalysisTree");
-    TTreeReader reader(tree);
-    
-    TTreeReaderArray<float> pf_pt(reader, "pf_pt");
-    TTreeReaderArray<float> pf_eta(reader, "pf_eta");
-    TTreeReaderArray<float> pf_phi(reader, "pf_phi");
-    TTreeReaderArray<int> pf_fatjetIdx(reader, "pf_fatjetIdx");
-
-    int fatjet_count;
+// Quick look at a single FatJetAnalyzer tree file (<output>_trees.root).
+// For full production sets use the compiled, multi-threaded
+// image_builder.cpp.
+//
+//   root -l -b -q 'constituents_image.cpp("out_trees.root")'
+//   root -l -b -q 'constituents_image.cpp("out_trees.root", "fatJetMiniAODAnalyzer/FatJetAnalyzer_AOD")'
+void constituents_image(const char* fileName = "./jetConstituents/output_prova_trees.root",
+                        const char* treeName = "fatJetAnalyzer/FatJetAnalyzer_AOD") {
+    std::unique_ptr<TFile> file(TFile::Open(fileName));
+    if (!file || file->IsZombie()) {
+        std::cerr << "constituents_image: cannot open " << fileName << std::endl;
+        return;
+    }
 
-    int Nbins = 100;
-    std::vector<float> pf_pt_sum(Nbins * Nbins, 0);  
-    TH1F *h_N_constituents= new TH1F("h_N_constituents", "h_N_constituents", 100,0,100);
-    TH2F* h_pf_scatter_eta_phi_multiplicity = new TH2F(
-        "h_pf_scatter_eta_phi_multiplicity", 
-        "PF Particles - eta vs phi multiplicity",
-        Nbins, 0., 2.4,  
-        Nbins, -3.14, 3.14 
-    );
+    TTree *tree = file->Get<TTree>(treeName);
+    if (tree == nullptr) {
+        std::cerr << "constituents_image: no tree " << treeName << " in " << fileName << std::endl;
+        return;
+    }
 
-    Long64_t nEntries = reader.GetEntries();
-    std::cout<<nEntries<<std::endl;
-    int pf_entries=0;
-    for (Long64_t entry = 0; entry < 50; ++entry) {
-        reader.SetEntry(entry);
-        if(pf_pt.GetSize()!=0) h_N_constituents->Fill(pf_pt.GetSize());
-        for (size_t i = 0; i < pf_pt.GetSize(); ++i) {
-            float pt = pf_pt[i];
-            float eta = pf_eta[i];
-            float phi = pf_phi[i];
+    // Only pf_pt/eta/phi are read. A columnar output is read in bulk into
+    // arrays sized from the nPF counter, a vector output into the vectors.
+    std::vector<float> pf_pt, pf_eta, pf_phi;
+    std::vector<float> *pf_pt_address = &pf_pt, *pf_eta_address = &pf_eta, *pf_phi_address = &pf_phi;
+    int nPF = 0;
+    const bool columnar = tree->GetBranch("nPF") != nullptr;
+    tree->SetBranchStatus("*", false);
+    for (const char* name : {"pf_pt", "pf_eta", "pf_phi"}) tree->SetBranchStatus(name, true);
+    if (columnar) {
+        tree->SetBranchStatus("nPF", true);
+        const int maxPF = std::max<Long64_t>(tree->GetMaximum("nPF"), 1);
+        pf_pt.resize(maxPF);
+        pf_eta.resize(maxPF);
+        pf_phi.resize(maxPF);
+        tree->SetBranchAddress("nPF", &nPF);
+        tree->SetBranchAddress("pf_pt", pf_pt.data());
+        tree->SetBranchAddress("pf_eta", pf_eta.data());
+        tree->SetBranchAddress("pf_phi", pf_phi.data());
+    } else {
+        tree->SetBranchAddress("pf_pt", &pf_pt_address);
+        tree->SetBranchAddress("pf_eta", &pf_eta_address);
+        tree->SetBranchAddress("pf_phi", &pf_phi_address);
+    }
 
-            float eta_bin = 2.4 / Nbins;
-            float phi_bin = 6.28 / Nbins;
-            int eta_bin_idx = int((abs(eta)/ eta_bin));
-            int phi_bin_idx = int((phi + 3.14) / phi_bin);
+    constexpr int Nbins = 100;
+    const EtaPhiGrid<Nbins> grid(0.f, 2.4f);
+    std::vector<float> pf_pt_sum(grid.size(), 0.f);
+    std::vector<float> pf_multiplicity(grid.size(), 0.f);
+    TH1F h_N_constituents("h_N_constituents", "h_N_constituents", 100,0,100);
+    h_N_constituents.SetDirectory(nullptr);
 
-            if (eta_bin_idx >= 0 && eta_bin_idx < Nbins && phi_bin_idx >= 0 && phi_bin_idx < Nbins) {
-                int bin_index = eta_bin_idx * Nbins + phi_bin_idx;
-                pf_pt_sum[bin_index] += pt;  
-                h_pf_scatter_eta_phi_multiplicity->Fill(eta_bin_idx, phi_bin_idx );
-                pf_entries++;
-            }
-        }
+    Long64_t nEntries = tree->GetEntries();
+    std::cout<<nEntries<<std::endl;
+    for (Long64_t entry = 0; entry < nEntries; ++entry) {
+        tree->GetEntry(entry);
+        const size_t n = columnar ? nPF : pf_pt.size();
+        if(n!=0) h_N_constituents.Fill(n);
+        grid.fill(pf_eta.data(), pf_phi.data(), pf_pt.data(), n, pf_pt_sum.data(), pf_multiplicity.data());
     }
-    TH2F* h_pf_scatter_eta_phi_pt = new TH2F(
+    tree->ResetBranchAddresses();
+
+    // Same axes as the grid: |eta| on x, phi on y.
+    TH2F h_pf_scatter_eta_phi_pt(
         "h_pf_scatter_eta_phi_pt", 
         "Constituents - eta vs phi with pt sum",
-        Nbins, 0., 4.5,  
-        Nbins, -3.14, 3.14 
+        Nbins, grid.etaMin(), grid.etaMax(),
+        Nbins, grid.phiMin(), grid.phiMax()
+    );
+    TH2F h_pf_scatter_eta_phi_multiplicity(
+        "h_pf_scatter_eta_phi_multiplicity", 
+        "PF Particles - eta vs phi multiplicity",
+        Nbins, grid.etaMin(), grid.etaMax(),
+        Nbins, grid.phiMin(), grid.phiMax()
     );
+    h_pf_scatter_eta_phi_pt.SetDirectory(nullptr);
+    h_pf_scatter_eta_phi_multiplicity.SetDirectory(nullptr);
 
-    for (int phi_bin = 0; phi_bin < Nbins; phi_bin++) {
-        for (int eta_bin = 0; eta_bin < Nbins; eta_bin++) {
+    double pf_entries = 0;
+    for (int eta_bin = 0; eta_bin < Nbins; eta_bin++) {
+        for (int phi_bin = 0; phi_bin < Nbins; phi_bin++) {
             int bin_index = eta_bin * Nbins + phi_bin;
-            h_pf_scatter_eta_phi_pt->SetBinContent(phi_bin + 1, eta_bin + 1, pf_pt_sum[bin_index]);
+            h_pf_scatter_eta_phi_pt.SetBinContent(eta_bin + 1, phi_bin + 1, pf_pt_sum[bin_index]);
+            h_pf_scatter_eta_phi_multiplicity.SetBinContent(eta_bin + 1, phi_bin + 1, pf_multiplicity[bin_index]);
+            pf_entries += pf_multiplicity[bin_index];
         }
     }
-    TCanvas* c = new TCanvas();
-    c->cd();
+    TCanvas c;
+    c.cd();
     //Double_t levels[] = {30, 80, 120,150,200,250,300,400,500,800,1300,1800,2000, 2500,3500,4500,7000};  // Adjust levels as needed
-    //h_pf_scatter_eta_phi_pt->SetContour(16, levels); // Set the number of contours to 5 and set the levels
-    h_pf_scatter_eta_phi_pt->Draw("COLZ4");
-    h_pf_scatter_eta_phi_pt->GetXaxis()->SetTitle("#eta");
-    h_pf_scatter_eta_phi_pt->GetYaxis()->SetTitle("#phi");
-    h_pf_scatter_eta_phi_pt->GetZaxis()->SetTitle("p_{T}");
-    h_pf_scatter_eta_phi_pt->GetZaxis()->SetTitleOffset(0.4);
-    h_pf_scatter_eta_phi_pt->SetStats(0);
-    c->SetLogz();
+    //h_pf_scatter_eta_phi_pt.SetContour(16, levels); // Set the number of contours to 5 and set the levels
+    h_pf_scatter_eta_phi_pt.Draw("COLZ4");
+    h_pf_scatter_eta_phi_pt.GetXaxis()->SetTitle("#eta");
+    h_pf_scatter_eta_phi_pt.GetYaxis()->SetTitle("#phi");
+    h_pf_scatter_eta_phi_pt.GetZaxis()->SetTitle("p_{T}");
+    h_pf_scatter_eta_phi_pt.GetZaxis()->SetTitleOffset(0.4);
+    h_pf_scatter_eta_phi_pt.SetStats(0);
+    c.SetLogz();
 
-    c->SaveAs("./images_constituents/pf_image_eta_phi_pt.pdf");
+    c.SaveAs("./images_constituents/pf_image_eta_phi_pt.pdf");
 
-    TCanvas *c2 = new TCanvas();
-    c2->cd();
-    h_N_constituents->Draw();
-    c2->SaveAs("./images_constituents/fatjet_multiplicity.pdf");
+    TCanvas c2;
+    c2.cd();
+    h_N_constituents.Draw();
+    c2.SaveAs("./images_constituents/fatjet_multiplicity.pdf");
 
-    TCanvas *c3 = new TCanvas();
-    c3->cd();
-    h_pf_scatter_eta_phi_multiplicity->Draw();
-    c3->SaveAs("./images_constituents/pf_image_eta_phi_multiplicity.pdf");
+    TCanvas c3;
+    c3.cd();
+    h_pf_scatter_eta_phi_multiplicity.Draw();
+    c3.SaveAs("./images_constituents/pf_image_eta_phi_multiplicity.pdf");
 
-    TFile *f= new TFile ("out.root", "recreate");
-    f->cd();
-    h_pf_scatter_eta_phi_pt->Write();
-    f->Close();
+    TFile f("out.root", "recreate");
+    f.cd();
+    h_pf_scatter_eta_phi_pt.Write();
+    f.Close();
     file->Close();
     std::cout<<"pf_entries"<<pf_entries<<std::endl;
     gROOT->ProcessLine(".q");
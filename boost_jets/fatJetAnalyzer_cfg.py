@@ -1,4 +1,21 @@
 import FWCore.ParameterSet.Config as cms
+from FWCore.ParameterSet.VarParsing import VarParsing
+
+# Command-line overrides, e.g. one shard of fatjet_launch.py:
+#   cmsRun fatJetAnalyzer_cfg.py inputFiles=file:a.root,file:b.root skipEvents=2000 maxEvents=1000 \
+#          outputFile=shard_003.root threads=4
+options = VarParsing()
+options.register("inputFiles", [], VarParsing.multiplicity.list, VarParsing.varType.string,
+                 "input files; default: the file below")
+options.register("maxEvents", 1000, VarParsing.multiplicity.singleton, VarParsing.varType.int,
+                 "events to process, -1 for all")
+options.register("skipEvents", 0, VarParsing.multiplicity.singleton, VarParsing.varType.int,
+                 "events to skip at the start of the first input file")
+options.register("outputFile", "FatJetAnalyzer_WLZL.root", VarParsing.multiplicity.singleton,
+                 VarParsing.varType.string, "TFileService output; the trees go to <name>_trees.root")
+options.register("threads", 8, VarParsing.multiplicity.singleton, VarParsing.varType.int,
+                 "framework threads (and streams)")
+options.parseArguments()
 
 process = cms.Process("FATJETANALYSIS")
 
@@ -6,30 +23,117 @@ process = cms.Process("FATJETANALYSIS")
 process.load("FWCore.MessageService.MessageLogger_cfi")
 process.MessageLogger.cerr.FwkReport.reportEvery = 100
 
+# Data tier of the input. MiniAOD (slimmedJetsAK8 + packedPFCandidates) is
+# read by FatJetMiniAODAnalyzer: PUPPI weights and IP/track information come
+# from the packed candidates, so no AOD product is needed.
+miniAOD = False
+
 # Input files
 process.source = cms.Source("PoolSource",
-    fileNames = cms.untracked.vstring(
+    fileNames = cms.untracked.vstring(options.inputFiles or [
         'file:/eos/user/w/wbuitrag/Gridpacks/Local_Production/Boosted/VBSWLZLToJets_5f_LO_FXFX_200pT_Run3Summer23wmLHEGS/root/AOD/VBSWLZLToJets_5f_LO_FXFX_200pT.root'
-    )
+    ]),
+    skipEvents = cms.untracked.uint32(options.skipEvents)
+)
+
+# FatJetAnalyzer is an edm::global module: every stream keeps its own
+# histograms and tree buffers, so event throughput scales with the threads
+process.options = cms.untracked.PSet(
+    numberOfThreads = cms.untracked.uint32(options.threads),
+    numberOfStreams = cms.untracked.uint32(0)  # 0 = one stream per thread
 )
 
 # Number of events to process
 process.maxEvents = cms.untracked.PSet(
-    input = cms.untracked.int32(1000)
+    input = cms.untracked.int32(options.maxEvents)
+)
+
+# Jet pT threshold of the pre-filter, the analyzer and the pT histograms
+minPt = 150.0
+
+# Event pre-selection: a leading jet above minFatJetPt. Events failing it
+# never reach the analyzer, so their PF candidates, vertices and ValueMaps
+# are not read; they had no jet to store either, so the histograms and trees
+# are those of running without the filter. Setting hltPaths also requires
+# the trigger, which changes what is stored: hFatJet* and the trees then
+# only hold triggered events. The HLT selection of FatJet_Sel.py
+# (fatjet_cuts.cfg) is
+#   hltPaths = cms.vstring("HLT_AK8PFJetFwd15", "HLT_AK8PFJet230_SoftDropMass40"), requireAllHLTPaths = True
+process.fatJetPreFilter = cms.EDFilter('FatJetPreFilter',
+    fatjets = cms.InputTag("slimmedJetsAK8" if miniAOD else "ak8PFJetsPuppi"),
+    minLeadingJetPt = cms.double(minPt),
+    maxLeadingJetAbsEta = cms.double(99.0),  # the analyzer has no eta cut
+    triggerResults = cms.InputTag("TriggerResults", "", "HLT"),
+    hltPaths = cms.vstring(),  # empty: no trigger requirement
+    requireAllHLTPaths = cms.bool(True)
+)
+
+# Histograms filled when saveHistograms is set: x (and y for a TH2F) name a
+# jet observable (fj_*) or a constituent observable (pf_*, one entry per
+# constituent); see FatJetAnalyzer::fillDescriptions for the list. Add a
+# PSet here to book another one, e.g. the soft-drop mass:
+#   histogram("hFatJetMSoftDrop", "FatJet m_{SD};m_{SD} [GeV];FatJets", "fj_msoftdrop", 0., 300.)
+
+def histogram(name, title, x, xMin, xMax, y="", yMin=0., yMax=1., nBinsX=100, nBinsY=100):
+    return cms.PSet(name = cms.string(name), title = cms.string(title),
+                    x = cms.string(x), nBinsX = cms.int32(nBinsX), xMin = cms.double(xMin), xMax = cms.double(xMax),
+                    y = cms.string(y), nBinsY = cms.int32(nBinsY), yMin = cms.double(yMin), yMax = cms.double(yMax))
+
+fatJetHistograms = cms.VPSet(
+    histogram("hFatJetPt", "FatJet p_{T} (p_{T} > minPt);p_{T} [GeV];FatJets", "fj_pt", minPt, minPt + 1000),
+    histogram("hFatJetEta", "FatJet #eta;#eta;FatJets", "fj_eta", -5., 5.),
+    histogram("hFatJetPhi", "FatJet #phi;#phi;FatJets", "fj_phi", -3.1416, 3.1416),
+    histogram("hFatJetMass", "FatJet mass;Mass [GeV];FatJets", "fj_mass", 0., 500.),
+    histogram("hFatJetNConstituents", "FatJet constituents;N_{constituents};FatJets", "fj_nConstituents", 0., 200.),
+    histogram("hFatJetEtaVsPhi", "FatJet #eta vs #phi;#eta;#phi", "fj_eta", -5., 5., "fj_phi", -3.1416, 3.1416),
+    histogram("hFatJetPtVsEta", "FatJet p_{T} vs #eta;p_{T} [GeV];#eta", "fj_pt", minPt, minPt + 1000,
+              "fj_eta", -5., 5.),
+    histogram("hFatJetConstituentPtVsEta", "FatJet constituent p_{T} vs #eta;p_{T} [GeV];#eta", "pf_pt", 0., 200.,
+              "pf_eta", -5., 5.),
 )
 
 # FatJet analyzer configuration
-process.fatJetAnalyzer = cms.EDAnalyzer('FatJetAnalyzer',
+process.fatJetAnalyzer = cms.EDAnalyzer('FatJetMiniAODAnalyzer' if miniAOD else 'FatJetAnalyzer',
+    fatjets = cms.InputTag("slimmedJetsAK8" if miniAOD else "ak8PFJetsPuppi"),
     saveHistograms = cms.bool(True),
+    histograms = fatJetHistograms,
     saveTree = cms.bool(True),
-    minFatJetPt = cms.double(150.0),
-    signalLabel = cms.int32(2)  # 1 = WL, 2 = WT
+    outputFormat = cms.string("vector"),  # "columnar": flat C-array branches + per-jet offsets
+    minFatJetPt = cms.double(minPt),
+    signalLabel = cms.int32(2),  # 1 = WL, 2 = WT
+    # Per-jet tagging-feature tree (FatJetTree). Products that are not in the
+    # input leave their features at the defaults (-1 / weight 1).
+    saveFeatureTree = cms.bool(True),
+    profile = cms.bool(False),  # per-phase timing + memory summary at endJob (profile/ directory)
+    asyncTreeWriter = cms.bool(False),  # TTree::Fill in TBB tasks, the streams only queue their buffers
+    compressionAlgorithm = cms.string(""),  # "LZ4", "ZSTD", ...; empty: the TFileService file's
+    # Stored precision of the float branches ("truncate:N", "quantize:min:max:N",
+    # "float16:[min:max:]N"); check the loss with precision_check first.
+    defaultPrecision = cms.string("full"),
+    branchPrecision = cms.PSet(),  # e.g. pfc_dxy_error = cms.string("truncate:8")
+    saveImages = cms.bool(False),  # fj_image[imagePixels^2] per jet, centred/rotated/flipped
+    imagePixels = cms.int32(33),
+    imageHalfWidth = cms.double(0.8),
+    imageFormat = cms.string("dense"),  # "sparse": fj_image_index/fj_image_value, lit pixels only
+    savePointCloud = cms.bool(False),  # pT-ordered pc_* features per jet
+    pointCloudMaxPoints = cms.int32(0),  # > 0: hardest N points as zero-padded pc_*[N] arrays
+    # tau1..3 and soft-drop mass are read from the softDropMassMap / tau*Map
+    # tags (on MiniAOD from the jet userFloats). True computes them from the
+    # constituents instead, about 0.3 ms per jet; ecfMaxConstituents = 100
+    # adds N2 and D2 for about 0.2 ms more.
+    computeSubstructure = cms.bool(False),
+    vertices = cms.InputTag("offlineSlimmedPrimaryVertices" if miniAOD else "offlinePrimaryVertices")
 )
+if not miniAOD:
+    # Scales the ak8PFJetsPuppi constituents; the job stops if the input has
+    # no "puppi" ValueMap. Set it to "" for unweighted constituents.
+    process.fatJetAnalyzer.puppiWeightMap = cms.InputTag("puppi")
+    process.fatJetAnalyzer.puppiWeightNoLepMap = cms.InputTag("puppiNoLep")
 
 # Output file service
 process.TFileService = cms.Service("TFileService",
-    fileName = cms.string("FatJetAnalyzer_WLZL.root")
+    fileName = cms.string(options.outputFile)
 )
 
 # Path definition
-process.p = cms.Path(process.fatJetAnalyzer)
\ No newline at end of file
+process.p = cms.Path(process.fatJetPreFilter + process.fatJetAnalyzer)
\ No newline at end of file
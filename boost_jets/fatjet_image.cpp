@@ -1,151 +1,272 @@
 #include "TSystem.h"
+#include <glob.h>
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <TH2F.h>
 #include <TCanvas.h>
 #include <ROOT/RDF/RInterface.hxx>
+#include <ROOT/RDF/RActionImpl.hxx>
+#include <ROOT/RDFHelpers.hxx>
 #include <ROOT/RDataFrame.hxx>
+#include <ROOT/RVec.hxx>
+
+#include "EtaPhiGrid.h"
+#include "FatJetCuts.h"
+#include "ResultCache.h"
 
 
 // root files after FatJet_Sel.py module //
 const TString rdf_ssWW = "WW_cleanFatJet.root";
 const TString rdf_ZZ = "ZZ_cleanFatJet.root";
 
+// NanoAOD inputs, read directly when the skim is bypassed
+const TString nano_dir = "/eos/user/l/ldellape/VBS/VBS_cards/privateMCproduction/nanov12_samples";
+const TString nano_ssWW = nano_dir + "/ssWW*/*.root";
+const TString nano_ZZ = nano_dir + "/ZZ*/*.root";
+
+
+// |eta| window of each region; the decision is taken at compile time.
+enum class Region { kCentral, kForward };
+
+template <Region R>
+struct RegionTraits;
+
+template <>
+struct RegionTraits<Region::kCentral> {
+    static constexpr float etaMin = 0.f;
+    static constexpr float etaMax = 2.4f;
+    static constexpr const char* name = "central";
+};
+
+template <>
+struct RegionTraits<Region::kForward> {
+    static constexpr float etaMin = 2.4f;
+    static constexpr float etaMax = 4.5f;
+    static constexpr const char* name = "frw";
+};
 
 
-// function to build the scatter plot, computes the sum of pt for each eta-phi bin for all the events
-std::vector<float> PT_Sum_FatJet(ROOT::RDataFrame& df, int Nbins, TString phi_column, TString eta_column, TString pt_column) {
-    std::vector<float> FatJet_pt_sum(Nbins * Nbins, 0);  // 2D histogram stored as a 1D vector
-    
-    df.Foreach([&FatJet_pt_sum, Nbins, eta_column](const ROOT::RVec<float>& phi_fatjets, 
-                                       const ROOT::RVec<float>& eta_fatjets, 
-                                       const ROOT::RVec<float>& pt_fatjets) {
-      if (pt_fatjets.size() > 0) {
-        float eta_bin;
-        float phi_bin;
-        if(eta_column.Contains("central")){
-             eta_bin = 2.4/ Nbins; // Eta range is -2.4 to 2.4
-             phi_bin = 6.28/Nbins;
+// Booked RDataFrame action computing the sum of pt for each |eta|-phi bin for
+// all the events. Every processing slot fills its own buffer, the buffers are
+// summed in Finalize, so no locking is needed in Exec.
+template <Region R, int NBins>
+class PtSumHelper : public ROOT::Detail::RDF::RActionImpl<PtSumHelper<R, NBins>> {
+public:
+    using Result_t = std::vector<float>;  // 2D histogram stored as a 1D vector
+    using Traits = RegionTraits<R>;
+
+    explicit PtSumHelper(unsigned int nSlots)
+        : grid_(Traits::etaMin, Traits::etaMax),
+          result_(std::make_shared<Result_t>(grid_.size(), 0.f)),
+          perSlot_(nSlots, Result_t(grid_.size(), 0.f)) {}
+    PtSumHelper(PtSumHelper&&) = default;
+    PtSumHelper(const PtSumHelper&) = delete;
+
+    std::shared_ptr<Result_t> GetResultPtr() const { return result_; }
+    void Initialize() {}
+    void InitTask(TTreeReader*, unsigned int) {}
+
+    void Exec(unsigned int slot, const ROOT::RVec<float>& phi_fatjets,
+              const ROOT::RVec<float>& eta_fatjets, const ROOT::RVec<float>& pt_fatjets) {
+        grid_.fill(eta_fatjets.data(), phi_fatjets.data(), pt_fatjets.data(), pt_fatjets.size(),
+                   perSlot_[slot].data());
+    }
+
+    void Finalize() {
+        Result_t& total = *result_;
+        for (const Result_t& sum : perSlot_) {
+            for (size_t i = 0; i < total.size(); ++i) total[i] += sum[i];
         }
-        else{ 
-             eta_bin = (4.5 - 2.4 ) / Nbins;
-             phi_bin = 6.28/Nbins;
+    }
+
+    std::string GetActionName() const { return std::string("PtSum_") + Traits::name; }
+
+private:
+    EtaPhiGrid<NBins> grid_;
+    std::shared_ptr<Result_t> result_;
+    std::vector<Result_t> perSlot_;
+};
+
+// Books (lazily) the pT-sum image of one region on a dataset.
+template <Region R, int NBins>
+ROOT::RDF::RResultPtr<std::vector<float>> PT_Sum_FatJet(ROOT::RDF::RNode df, unsigned int nSlots) {
+    const std::string prefix = std::string("FatJet_") + RegionTraits<R>::name;
+    using RVecF = ROOT::RVec<float>;
+    return df.Book<RVecF, RVecF, RVecF>(PtSumHelper<R, NBins>(nSlots),
+                                        {prefix + "_phi", prefix + "_eta", prefix + "_pt"});
+}
+
+
+// Applies the FatJet_Sel.py selection lazily on a NanoAOD dataframe and defines
+// the same FatJet_{central,frw}_{pt,eta,phi} columns the skim would contain.
+// Nothing is materialized; the cuts run inside the image event loop.
+ROOT::RDF::RNode select_fatjets(ROOT::RDF::RNode df, const FatJetCuts& cuts) {
+    df = df.Filter(cuts.triggerSelection(), "HLT");
+    if (cuts.needsTau21()) df = df.Define("FatJet_tau21", "FatJet_tau2/FatJet_tau1");
+    df = df.Define("central_mask", cuts.centralMask())
+           .Define("frw_mask", cuts.forwardMask());
+    for (const char* var : {"pt", "eta", "phi"}) {
+        const std::string v = var;
+        df = df.Define("FatJet_central_" + v, "FatJet_" + v + "[central_mask]")
+               .Define("FatJet_frw_" + v, "FatJet_" + v + "[frw_mask]");
+    }
+    return df;
+}
+
+template <Region R>
+std::unique_ptr<TH2F> make_image(const TString& name, const std::vector<float>& ptSum, int Nbins) {
+    auto h = std::make_unique<TH2F>(name, name,
+                                                 Nbins, RegionTraits<R>::etaMin, RegionTraits<R>::etaMax,
+                                    Nbins, EtaPhiGrid<0>::phiMin(), EtaPhiGrid<0>::phiMax());
+    h->SetDirectory(nullptr);
+    for (int phibin = 0; phibin < Nbins; phibin++) {
+        for (int etabin = 0; etabin < Nbins; etabin++) {
+            h->SetBinContent(etabin + 1, phibin + 1, ptSum[etabin * Nbins + phibin]);
         }
-        for (size_t k = 0; k < pt_fatjets.size(); k++) {
-            float phi = phi_fatjets[k];
-            float eta = (eta_fatjets[k]);
-            float pt = pt_fatjets[k];
-            int eta_bin_idx;
-            if(eta_column.Contains("central"))  eta_bin_idx = int(TMath::Abs(eta)/ eta_bin); 
-            else   eta_bin_idx = int((TMath::Abs(eta) -2.4)/ eta_bin);
-            int phi_bin_idx =int((phi + 3.14) / phi_bin); 
-            if(eta_column.Contains("frw")) {std::cout<<eta_bin_idx<<std::endl;}
-
-            if (eta_bin_idx >= 0 && eta_bin_idx < Nbins && phi_bin_idx >= 0 && phi_bin_idx < Nbins) {
-                int bin_index = eta_bin_idx * Nbins + phi_bin_idx;
-                FatJet_pt_sum[bin_index] += pt;
+    }
+    return h;
+}
+
+void draw_image(const std::unique_ptr<TH2F>& h, const TString& pdf) {
+    TCanvas c;
+    c.cd();
+    h->Draw("COLZ");
+    h->GetXaxis()->SetTitle("#eta");
+    h->GetYaxis()->SetTitle("#phi");
+    h->GetZaxis()->SetTitle("p^{sum}_{T}");
+    h->SetStats(0);
+    c.SaveAs(pdf);
+}
+
+
+std::vector<std::string> expand_glob(const TString& pattern) {
+    std::vector<std::string> files;
+    glob_t result;
+    if (glob(pattern.Data(), 0, nullptr, &result) == 0) {
+        for (size_t i = 0; i < result.gl_pathc; ++i) files.emplace_back(result.gl_pathv[i]);
+    }
+    globfree(&result);
+    return files;
+}
+
+// Central and forward pT-sum images of one NanoAOD sample, kept per input
+// file in the result cache. Cached files are not opened; every other file
+// gets its own dataframe, so that its result can be stored on its own, and
+// all of them run together in one RunGraphs call.
+template <int NBins>
+struct SampleImages {
+    std::vector<float> central = std::vector<float>(NBins * NBins, 0.f);
+    std::vector<float> forward = std::vector<float>(NBins * NBins, 0.f);
+    size_t nCached = 0;
+
+    struct PendingFile {
+        std::string file;
+        std::unique_ptr<ROOT::RDataFrame> df;
+        ROOT::RDF::RResultPtr<std::vector<float>> central, forward;
+    };
+    std::vector<PendingFile> pending;
+
+    void book(const TString& pattern, const FatJetCuts& cuts, const ResultCache& cache) {
+        for (const std::string& file : expand_glob(pattern)) {
+            std::vector<float> both;
+            if (cache.load(file, both) && both.size() == 2 * central.size()) {
+                add(both.data());
+                ++nCached;
+                continue;
             }
+            PendingFile p;
+            p.file = file;
+            p.df = std::make_unique<ROOT::RDataFrame>("Events", file);
+            ROOT::RDF::RNode df = select_fatjets(*p.df, cuts);
+            p.central = PT_Sum_FatJet<Region::kCentral, NBins>(df, p.df->GetNSlots());
+            p.forward = PT_Sum_FatJet<Region::kForward, NBins>(df, p.df->GetNSlots());
+            pending.push_back(std::move(p));
         }
-      }
-    }, {phi_column.Data(), eta_column.Data(), pt_column.Data()});
+    }
 
-    return FatJet_pt_sum;
-}
+    void handles(std::vector<ROOT::RDF::RResultHandle>& out) {
+        for (PendingFile& p : pending) {
+            out.emplace_back(p.central);
+            out.emplace_back(p.forward);
+        }
+    }
+
+    // After RunGraphs: caches and adds the results of the processed files.
+    void finish(const ResultCache& cache) {
+        for (PendingFile& p : pending) {
+            std::vector<float> both(*p.central);
+            both.insert(both.end(), p.forward->begin(), p.forward->end());
+            cache.store(p.file, both);
+            add(both.data());
+        }
+        pending.clear();
+    }
 
+private:
+    void add(const float* both) {
+        for (size_t i = 0; i < central.size(); ++i) central[i] += both[i];
+        for (size_t i = 0; i < forward.size(); ++i) forward[i] += both[central.size() + i];
+    }
+};
 
 
-void fatjet_image() {
+// fromNano = true goes straight from NanoAOD to images, applying the cuts of
+// cutsFile lazily and reusing the per-file results in cacheDir ("" disables
+// the cache); fromNano = false reads the FatJet_Sel.py skims, which that
+// script keeps up to date file by file.
+void fatjet_image(bool fromNano = true, const char* cutsFile = "fatjet_cuts.cfg",
+                  const char* cacheDir = ".fatjet_cache/fatjet_image") {
     // square matrix
-    int Nbins = 30;
-    std::vector<float> ptSum_ssWW_central;
-    std::vector<float> ptSum_ssWW_frw;
-    std::vector<float> ptSum_ZZ_central;
-    std::vector<float> ptSum_ZZ_frw;
+    constexpr int Nbins = 30;
     std::system("mkdir -p images");
-    if (gSystem->AccessPathName("WW_cleanFatJet.root")) std::system("python3 FatJet_Sel.py ssWW");
-    if (gSystem->AccessPathName("ZZ_cleanFatJet.root")) std::system("python3 FatJet_Sel.py ZZ");
-
-    ROOT::RDataFrame df_ssWW("Events", rdf_ssWW.Data());
-    ROOT::RDataFrame df_ZZ("Events", rdf_ZZ.Data());
-    
-    ptSum_ssWW_central = PT_Sum_FatJet(df_ssWW, Nbins, "FatJet_central_phi", "FatJet_central_eta", "FatJet_central_pt");
-    ptSum_ssWW_frw = PT_Sum_FatJet(df_ssWW, Nbins, "FatJet_frw_phi", "FatJet_frw_eta", "FatJet_frw_pt");
-
-    ptSum_ZZ_central = PT_Sum_FatJet(df_ZZ, Nbins, "FatJet_central_phi", "FatJet_central_eta", "FatJet_central_pt");
-    ptSum_ZZ_frw = PT_Sum_FatJet(df_ZZ, Nbins, "FatJet_frw_phi", "FatJet_frw_eta", "FatJet_frw_pt");
-
-    // Create histograms
-    TH2F* h_central_scatter_ssWW_eta_phi_pt = new TH2F(
-        "h_central_scatter_ssWW_eta_phi_pt", 
-        "h_central_scatter_ssWW_eta_phi_pt", 
-        Nbins, 0, 2.4,   
-        Nbins, -3.14, 3.14  
-    );
-    TH2F* h_central_scatter_ZZ_eta_phi_pt = new TH2F(
-        "h_central_scatter_ZZ_eta_phi_pt", 
-        "h_central_scatter_ZZ_eta_phi_pt", 
-        Nbins, 0, 2.4,   
-        Nbins, -3.14, 3.14  
-    );
-    TH2F* h_frw_scatter_ssWW_eta_phi_pt = new TH2F(
-        "h_frw_scatter_ssWW_eta_phi_pt", 
-        "h_frw_scatter_ssWW_eta_phi_pt", 
-        Nbins, 2.4, 4.5,   
-        Nbins, -3.14, 3.14 
-    );
-    TH2F* h_frw_scatter_ZZ_eta_phi_pt = new TH2F(
-        "h_frw_scatter_ZZ_eta_phi_pt", 
-        "h_frw_scatter_ZZ_eta_phi_pt", 
-        Nbins, 2.4, 4.5,   
-        Nbins, -3.14, 3.14  
-    );
-
-    // Fill the histograms with the accumulated pt sums
-    for (int phibin = 0; phibin < Nbins; phibin++) {
-        for (int etabin = 0; etabin < Nbins; etabin++) {
-            int bin_index = etabin * Nbins + phibin;
-            h_central_scatter_ssWW_eta_phi_pt->SetBinContent(phibin + 1, etabin + 1, ptSum_ssWW_central[bin_index]);
-            h_central_scatter_ZZ_eta_phi_pt->SetBinContent(phibin + 1, etabin + 1, ptSum_ZZ_central[bin_index]); 
-            h_frw_scatter_ssWW_eta_phi_pt->SetBinContent(phibin + 1, etabin + 1, ptSum_ssWW_frw[bin_index]);
-            h_frw_scatter_ZZ_eta_phi_pt->SetBinContent(phibin + 1, etabin + 1, ptSum_ZZ_frw[bin_index]); 
-        }
+    ROOT::EnableImplicitMT();
+
+    SampleImages<Nbins> ssWW, ZZ;
+    if (fromNano) {
+        const FatJetCuts cuts = FatJetCuts::load(cutsFile);
+        std::cout << "***  central cuts *******" << std::endl << cuts.centralMask() << std::endl;
+        std::cout << "*** forward cuts ******* " << std::endl << cuts.forwardMask() << std::endl;
+        const ResultCache cache(cacheDir, "fatjet_image v1 Nbins=" + std::to_string(Nbins) + " " + cuts.fingerprint());
+
+        ssWW.book(nano_ssWW, cuts, cache);
+        ZZ.book(nano_ZZ, cuts, cache);
+        std::cout << "ssWW: " << ssWW.nCached << " files cached, " << ssWW.pending.size() << " to process" << std::endl;
+        std::cout << "ZZ: " << ZZ.nCached << " files cached, " << ZZ.pending.size() << " to process" << std::endl;
+        std::vector<ROOT::RDF::RResultHandle> handles;
+        ssWW.handles(handles);
+        ZZ.handles(handles);
+        if (!handles.empty()) ROOT::RDF::RunGraphs(handles);
+        ssWW.finish(cache);
+        ZZ.finish(cache);
+    } else {
+        std::system("python3 FatJet_Sel.py ssWW");
+        std::system("python3 FatJet_Sel.py ZZ");
+        ROOT::RDataFrame df_ssWW("Events", rdf_ssWW.Data());
+        ROOT::RDataFrame df_ZZ("Events", rdf_ZZ.Data());
+        const unsigned int nSlots = df_ssWW.GetNSlots();
+
+        // Both regions are booked on the same dataset, so each file is read
+        // once, and the two event loops run concurrently.
+        auto ptSum_ssWW_central = PT_Sum_FatJet<Region::kCentral, Nbins>(df_ssWW, nSlots);
+        auto ptSum_ssWW_frw = PT_Sum_FatJet<Region::kForward, Nbins>(df_ssWW, nSlots);
+        auto ptSum_ZZ_central = PT_Sum_FatJet<Region::kCentral, Nbins>(df_ZZ, nSlots);
+        auto ptSum_ZZ_frw = PT_Sum_FatJet<Region::kForward, Nbins>(df_ZZ, nSlots);
+        ROOT::RDF::RunGraphs({ptSum_ssWW_central, ptSum_ZZ_central});
+        ssWW.central = *ptSum_ssWW_central;
+        ssWW.forward = *ptSum_ssWW_frw;
+        ZZ.central = *ptSum_ZZ_central;
+        ZZ.forward = *ptSum_ZZ_frw;
     }
 
-    TCanvas* c = new TCanvas();
-    c->cd();
-    h_central_scatter_ssWW_eta_phi_pt->Draw("COLZ");
-    h_central_scatter_ssWW_eta_phi_pt->GetXaxis()->SetTitle("#eta");
-    h_central_scatter_ssWW_eta_phi_pt->GetYaxis()->SetTitle("#phi");
-    h_central_scatter_ssWW_eta_phi_pt->GetZaxis()->SetTitle("p^{sum}_{T}");
-    h_central_scatter_ssWW_eta_phi_pt->SetStats(0);
-    c->SaveAs("./images/fatjet_image_ssWW_central.pdf");
-
-    TCanvas* c2 = new TCanvas();
-    c2->cd();
-    h_frw_scatter_ssWW_eta_phi_pt->Draw("COLZ");
-    h_frw_scatter_ssWW_eta_phi_pt->GetXaxis()->SetTitle("#eta");
-    h_frw_scatter_ssWW_eta_phi_pt->GetYaxis()->SetTitle("#phi");
-    h_frw_scatter_ssWW_eta_phi_pt->GetZaxis()->SetTitle("p^{sum}_{T}");
-    h_frw_scatter_ssWW_eta_phi_pt->SetStats(0);
-    c2->SaveAs("./images/fatjet_image_ssWW_frw.pdf");
-
-    TCanvas* c3 = new TCanvas();
-    c3->cd();
-    h_central_scatter_ZZ_eta_phi_pt->Draw("COLZ");
-    h_central_scatter_ZZ_eta_phi_pt->GetXaxis()->SetTitle("#eta");
-    h_central_scatter_ZZ_eta_phi_pt->GetYaxis()->SetTitle("#phi");
-    h_central_scatter_ZZ_eta_phi_pt->GetZaxis()->SetTitle("p^{sum}_{T}");
-    h_central_scatter_ZZ_eta_phi_pt->SetStats(0);
-    c3->SaveAs("./images/fatjet_image_ZZ_central.pdf");
-
-    TCanvas* c4 = new TCanvas();
-    c4->cd();
-    h_frw_scatter_ZZ_eta_phi_pt->Draw("COLZ");
-    h_frw_scatter_ZZ_eta_phi_pt->GetXaxis()->SetTitle("#eta");
-    h_frw_scatter_ZZ_eta_phi_pt->GetYaxis()->SetTitle("#phi");
-    h_frw_scatter_ZZ_eta_phi_pt->GetZaxis()->SetTitle("p^{sum}_{T}");
-    h_frw_scatter_ZZ_eta_phi_pt->SetStats(0);
-    c4->SaveAs("./images/fatjet_image_ZZ_frw.pdf");
+    draw_image(make_image<Region::kCentral>("h_central_scatter_ssWW_eta_phi_pt", ssWW.central, Nbins),
+               "./images/fatjet_image_ssWW_central.pdf");
+    draw_image(make_image<Region::kForward>("h_frw_scatter_ssWW_eta_phi_pt", ssWW.forward, Nbins),
+               "./images/fatjet_image_ssWW_frw.pdf");
+    draw_image(make_image<Region::kCentral>("h_central_scatter_ZZ_eta_phi_pt", ZZ.central, Nbins),
+               "./images/fatjet_image_ZZ_central.pdf");
+    draw_image(make_image<Region::kForward>("h_frw_scatter_ZZ_eta_phi_pt", ZZ.forward, Nbins),
+               "./images/fatjet_image_ZZ_frw.pdf");
 
     gROOT->ProcessLine(".q");
 }
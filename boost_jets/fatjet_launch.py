@@ -0,0 +1,153 @@
+"""Runs fatJetAnalyzer_cfg.py over a sample as N local cmsRun shards and merges them.
+
+The input files are split by event range: the events of all files, in order,
+are cut into --jobs contiguous ranges of equal size, and every shard gets the
+files its range touches plus a skipEvents into the first one. The shards run
+--parallel at a time with --threads each, write <work-dir>/shard_NNN.root and
+.log (histograms) and shard_NNN_trees.root (the analyzer's trees), and are
+merged with fatjet_merge (tree-structured, fast-cloned) into --output and
+its _trees.root companion.
+
+  python3 fatjet_launch.py --jobs 16 --threads 4 --output WLZL.root '/eos/.../AOD/*.root'
+  python3 fatjet_launch.py --jobs 8 --max-events 100000 --dry-run files.txt
+"""
+
+import argparse
+import concurrent.futures
+import glob
+import os
+import subprocess
+import sys
+
+import ROOT
+
+
+here = os.path.dirname(os.path.abspath(__file__))
+cfg_file = os.path.join(here, "fatJetAnalyzer_cfg.py")
+
+
+def expand_inputs(patterns):
+    """Files from globs, comma-separated lists and .txt file lists, in order."""
+    files = []
+    for pattern in patterns:
+        if pattern.endswith(".txt"):
+            with open(pattern) as f:
+                files += [line.strip() for line in f if line.strip() and not line.startswith("#")]
+            continue
+        for item in pattern.split(","):
+            if "://" in item or item.startswith("file:"):
+                files.append(item)
+            else:
+                files += sorted(glob.glob(item)) or [item]
+    return [f if "://" in f or f.startswith("file:") else "file:" + os.path.abspath(f) for f in files]
+
+
+def count_events(fileName):
+    """Entries of the EDM Events tree of one input file."""
+    f = ROOT.TFile.Open(fileName[len("file:"):] if fileName.startswith("file:") else fileName)
+    if not f or f.IsZombie():
+        raise RuntimeError(f"cannot open {fileName}")
+    tree = f.Get("Events")
+    n = tree.GetEntries() if tree else 0
+    f.Close()
+    return n
+
+
+def split_events(files, counts, jobs, max_events):
+    """(files, skipEvents, maxEvents) of each shard; empty ranges are dropped."""
+    total = sum(counts)
+    if max_events >= 0:
+        total = min(total, max_events)
+    starts = [0]
+    for n in counts:
+        starts.append(starts[-1] + n)
+    shards = []
+    for job in range(jobs):
+        first, last = job * total // jobs, (job + 1) * total // jobs
+        if first == last:
+            continue
+        i = max(k for k in range(len(files)) if starts[k] <= first)
+        j = max(k for k in range(len(files)) if starts[k] < last)
+        shards.append((files[i:j + 1], first - starts[i], last - first))
+    return shards
+
+
+def trees_file(output):
+    """The tree file FatJetAnalyzer writes next to the TFileService output."""
+    return output[:-len(".root")] + "_trees.root" if output.endswith(".root") else output + "_trees"
+
+
+def run_shard(command, log):
+    with open(log, "w") as f:
+        return subprocess.run(command, stdout=f, stderr=subprocess.STDOUT).returncode
+
+
+def merge(output, shards, parallel):
+    merger = os.path.join(here, "fatjet_merge")
+    if os.path.exists(merger):
+        command = [merger, "-j", str(parallel), output] + shards
+    else:
+        print("fatjet_merge not built, falling back to hadd")
+        command = ["hadd", "-f", "-j", str(parallel), output] + shards
+    print(" ".join(command))
+    return subprocess.run(command).returncode
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("inputs", nargs="+", help="files, globs, comma lists or .txt file lists")
+    parser.add_argument("--jobs", type=int, default=os.cpu_count(), help="number of event-range shards")
+    parser.add_argument("--parallel", type=int, default=0, help="shards running at once; 0: all")
+    parser.add_argument("--threads", type=int, default=1, help="cmsRun threads per shard")
+    parser.add_argument("--max-events", type=int, default=-1, help="events of the whole sample; -1: all")
+    parser.add_argument("--work-dir", default="fatjet_shards")
+    parser.add_argument("--output", default="FatJetAnalyzer_merged.root", help="merged output; empty: no merge")
+    parser.add_argument("--keep-shards", action="store_true", help="keep the shard outputs after the merge")
+    parser.add_argument("--dry-run", action="store_true", help="print the shard commands only")
+    args = parser.parse_args()
+    if args.jobs < 1 or args.threads < 1 or args.parallel < 0:
+        parser.error("--jobs and --threads must be positive, --parallel not negative")
+    parallel = args.parallel or args.jobs
+
+    files = expand_inputs(args.inputs)
+    counts = [count_events(f) for f in files]
+    shards = split_events(files, counts, args.jobs, args.max_events)
+    print(f"{len(files)} files, {sum(counts)} events, {len(shards)} shards of "
+          f"~{max((s[2] for s in shards), default=0)} events")
+
+    os.makedirs(args.work_dir, exist_ok=True)
+    commands, outputs = [], []
+    for job, (shard_files, skip, n) in enumerate(shards):
+        output = os.path.join(args.work_dir, f"shard_{job:03d}.root")
+        commands.append(["cmsRun", cfg_file, "inputFiles=" + ",".join(shard_files), f"skipEvents={skip}",
+                         f"maxEvents={n}", "outputFile=" + output, f"threads={args.threads}"])
+        outputs.append(output)
+    if args.dry_run:
+        for command in commands:
+            print(" ".join(command))
+        return 0
+
+    failed = []
+    with concurrent.futures.ThreadPoolExecutor(max_workers=parallel) as pool:
+        codes = pool.map(run_shard, commands, [o[:-len(".root")] + ".log" for o in outputs])
+        for output, code in zip(outputs, codes):
+            if code != 0:
+                failed.append(output)
+    if failed:
+        print(f"{len(failed)} shards failed, see their logs: " + " ".join(failed), file=sys.stderr)
+        return 1
+    print(f"{len(outputs)} shards done in {args.work_dir}")
+
+    if args.output:
+        for merged, inputs in ((args.output, outputs), (trees_file(args.output), [trees_file(o) for o in outputs])):
+            inputs = [f for f in inputs if os.path.exists(f)]  # no tree file without saveTree/saveFeatureTree
+            if inputs and merge(merged, inputs, parallel) != 0:
+                return 1
+            if not args.keep_shards:
+                for f in inputs:
+                    os.remove(f)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,163 @@
+// Parallel, tree-structured merge of FatJetAnalyzer and image_builder outputs.
+//
+// The inputs are merged in groups of --fan-in files, each group in its own
+// process (-j at a time), and the partial outputs are merged the same way
+// until one file is left: log_fanin(N) rounds instead of one serial hadd.
+// TFileMerger does the work, so the trees (FatJetAnalyzer_AOD, FatJetTree,
+// FatJetAnalyzerProfile) are concatenated and the histograms (hFatJet*, the
+// image_builder pf_image_* accumulators) are summed in every directory.
+//
+// The trees are fast-cloned: their baskets are copied without being
+// decompressed whenever the branch layout of an input matches the output,
+// which is the case for the shards of one configuration; other inputs fall
+// back to an entry-by-entry copy. The output keeps the compression of the
+// first input, so a copied basket never needs recompressing either. With
+// fast cloning a round costs about one read and one write of the data, so
+// the default fan-in is large and the rounds are few.
+//
+//   g++ -O2 -std=c++17 -o fatjet_merge fatjet_merge.cpp $(root-config --cflags --libs)
+//   ./fatjet_merge -j 16 FatJetAnalyzer_merged.root fatjet_shards/shard_*.root
+//   ./fatjet_merge -j 4 --fan-in 2 images.root images_part*.root
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <TFile.h>
+#include <TFileMerger.h>
+#include <TROOT.h>
+#include <ROOT/TProcessExecutor.hxx>
+#include <ROOT/TSeq.hxx>
+
+namespace {
+
+    struct Options {
+        unsigned nProcesses = 0;  // 0: one per core
+        size_t fanIn = 8;
+        std::string output;
+        std::vector<std::string> inputs;
+        std::string tmpDir;  // empty: next to the output
+        bool fast = true;
+    };
+
+    struct MergeTask {
+        std::vector<std::string> inputs;
+        std::string output;
+    };
+
+    // Runs in a child process; 0 on success.
+    int mergeGroup(const MergeTask& task, int compression, bool fast) {
+        TFileMerger merger(false, false);
+        merger.SetFastMethod(fast);
+        merger.SetPrintLevel(0);
+        if (!merger.OutputFile(task.output.c_str(), "RECREATE", compression)) return 1;
+        for (const auto& input : task.inputs) {
+            if (!merger.AddFile(input.c_str(), false)) return 2;
+        }
+        return merger.Merge() ? 0 : 3;
+    }
+
+    // The groups of one round: n files in ceil(n / fanIn) groups of nearly
+    // equal size, so the last one is not a straggler.
+    std::vector<MergeTask> planRound(const std::vector<std::string>& files, size_t fanIn, const std::string& base,
+                                     int round, bool last) {
+        const size_t nGroups = (files.size() + fanIn - 1) / fanIn;
+        std::vector<MergeTask> tasks(nGroups);
+        for (size_t g = 0; g < nGroups; ++g) {
+            const size_t first = g * files.size() / nGroups;
+            const size_t end = (g + 1) * files.size() / nGroups;
+            tasks[g].inputs.assign(files.begin() + first, files.begin() + end);
+            if (!last) tasks[g].output = base + ".round" + std::to_string(round) + "_" + std::to_string(g) + ".root";
+        }
+        return tasks;
+    }
+
+    int compressionOf(const std::string& file) {
+        std::unique_ptr<TFile> f(TFile::Open(file.c_str()));
+        if (f == nullptr || f->IsZombie()) return -1;
+        return f->GetCompressionSettings();
+    }
+
+    void removeFiles(const std::vector<std::string>& files) {
+        for (const auto& file : files) std::remove(file.c_str());
+    }
+
+    void usage(const char* argv0) {
+        std::cerr << "usage: " << argv0 << " [-j processes] [--fan-in n] [--tmp-dir dir] [--no-fast]"
+                  << " output.root input.root ..." << std::endl;
+    }
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "-j" && hasValue) options.nProcesses = std::atoi(argv[++i]);
+        else if (arg == "--fan-in" && hasValue) options.fanIn = std::atol(argv[++i]);
+        else if (arg == "--tmp-dir" && hasValue) options.tmpDir = argv[++i];
+        else if (arg == "--no-fast") options.fast = false;
+        else if (arg == "-h" || arg == "--help") { usage(argv[0]); return 0; }
+        else if (options.output.empty()) options.output = arg;
+        else options.inputs.push_back(arg);
+    }
+    if (options.output.empty() || options.inputs.empty() || options.fanIn < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (options.nProcesses == 0) options.nProcesses = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+
+    const int compression = compressionOf(options.inputs.front());
+    if (compression < 0) {
+        std::cerr << "cannot open " << options.inputs.front() << std::endl;
+        return 1;
+    }
+    std::string base = options.output;
+    if (!options.tmpDir.empty()) base = options.tmpDir + "/" + base.substr(base.rfind('/') + 1);
+    base += "." + std::to_string(getpid());
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> files = options.inputs;
+    bool partial = false;  // files are this tool's temporaries
+    for (int round = 0;; ++round) {
+        const bool last = files.size() <= options.fanIn;
+        std::vector<MergeTask> tasks = planRound(files, options.fanIn, base, round, last);
+        if (last) tasks[0].output = options.output;
+
+        std::vector<int> status;
+        if (tasks.size() == 1) {
+            status.push_back(mergeGroup(tasks[0], compression, options.fast));
+        } else {
+            ROOT::TProcessExecutor pool(std::min<unsigned>(options.nProcesses, tasks.size()));
+            status = pool.Map([&](int g) { return mergeGroup(tasks[g], compression, options.fast); },
+                              ROOT::TSeqI(tasks.size()));
+        }
+
+        std::vector<std::string> outputs;
+        for (const auto& task : tasks) outputs.push_back(task.output);
+        for (size_t g = 0; g < tasks.size(); ++g) {
+            if (status[g] == 0) continue;
+            std::cerr << "merging " << tasks[g].inputs.size() << " files into " << tasks[g].output
+                      << " failed (" << status[g] << ")" << std::endl;
+            if (partial) removeFiles(files);
+            if (!last) removeFiles(outputs);
+            return 1;
+        }
+        std::printf("round %d: %zu files -> %zu\n", round, files.size(), tasks.size());
+        if (partial) removeFiles(files);
+        if (last) break;
+        files = outputs;
+        partial = true;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("merged %zu files into %s in %.1f s\n", options.inputs.size(), options.output.c_str(), seconds);
+    return 0;
+}
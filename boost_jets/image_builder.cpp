@@ -0,0 +1,774 @@
+// Parallel constituent image builder for the FatJetAnalyzer tree files (<output>_trees.root).
+//
+// Builds the eta-phi pT-sum and multiplicity maps of the PF constituents for
+// any number of samples in one run. Every sample is a list of files or globs;
+// its entries are processed in parallel with TTreeProcessorMT, each task
+// accumulates into its own buffers and the buffers are reduced at the end.
+//
+// With --shards DIR it also writes one centred, rotated jet image per fat jet
+// to DIR/<sample>_NNNNN.npy (see ImageShardWriter.h) for training, or with
+// --sparse only the lit pixels, as COO shards (see SparseShardWriter.h). Each
+// task keeps a single batch of images, so the memory use does not grow with
+// the sample size.
+//
+// With --point-clouds DIR it writes the pT-ordered point cloud of every jet
+// of the FatJetTree (JetPointCloud.h features), zero-padded to --max-points
+// as DIR/<sample>_pc_NNNNN.npy of shape (n, maxPoints, 7), or ragged with
+// --max-points 0.
+//
+// --precision SPEC sets the stored precision of the jet image values and
+// --point-precision SPEC that of the point-cloud features: "half" writes
+// float16 shards, the PrecisionPolicy.h specs ("truncate:N",
+// "quantize:min:max:N", "float16:...") round the float32 values so that
+// they compress better. A quantize range applies to every feature.
+//
+// The maps of every input file are cached in .fatjet_cache/image_builder
+// (--cache DIR, --no-cache), keyed on path, size, mtime, tree and binning,
+// so a rerun after adding files to a sample only reads the new ones.
+//
+// The trees are read from fatJetAnalyzer/FatJetAnalyzer_AOD and
+// fatJetAnalyzer/FatJetTree, the module-label directory of the analyzer;
+// --tree and --feature-tree give other paths.
+//
+//   g++ -O2 -std=c++17 -IjetConstituents/plugins -o image_builder image_builder.cpp $(root-config --cflags --libs) -lTreePlayer
+//   ./image_builder -j 8 -o images.root ssWW='/eos/.../ssWW_*/*.root' ZZ=zz_1.root,zz_2.root
+//   ./image_builder -j 8 --shards shards --pixels 33 ssWW='/eos/.../ssWW_*/*.root'
+//   ./image_builder -j 8 --shards shards --sparse --point-clouds clouds ssWW='/eos/.../ssWW_*/*.root'
+//   ./image_builder -j 8 --shards shards --precision half ssWW='/eos/.../ssWW_*/*.root'
+
+#include <glob.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <TBranch.h>
+#include <TChain.h>
+#include <TFile.h>
+#include <TH1F.h>
+#include <TH2F.h>
+#include <TLeaf.h>
+#include <TROOT.h>
+#include <TTree.h>
+#include <TTreeReader.h>
+#include <TTreeReaderArray.h>
+#include <TTreeReaderValue.h>
+#include <ROOT/TTreeProcessorMT.hxx>
+
+#include "EtaPhiGrid.h"
+#include "ImageShardWriter.h"
+#include "SparseShardWriter.h"
+#include "ResultCache.h"
+#include "JetImage.h"
+#include "JetPointCloud.h"
+#include "PrecisionPolicy.h"
+
+namespace {
+
+    // Stored precision of shard values: float16 shards, or float32 rounded
+    // as in PrecisionPolicy.h.
+    struct ShardPrecision {
+        bool half = false;
+        fatjet::Precision rounding;
+
+        void apply(std::vector<float>& values) const { rounding.apply(values); }
+    };
+
+    bool parseShardPrecision(const std::string& spec, ShardPrecision& out) {
+        out = ShardPrecision();
+        if (spec == "half") {
+            out.half = true;
+            return true;
+        }
+        return fatjet::parsePrecision(spec, out.rounding);
+    }
+
+    struct Options {
+        int nBins = 100;
+        float etaMax = 2.4;
+        unsigned nThreads = 0;  // 0: let ROOT decide
+        std::string output = "constituent_images.root";
+
+        std::string shardDir;  // empty: no per-jet images
+        bool sparse = false;   // COO instead of dense per-jet images
+        fatjet::JetImageConfig image;
+        size_t imagesPerShard = 65536;
+        size_t batchSize = 1024;
+        ShardPrecision imagePrecision;
+
+        std::string pointCloudDir;  // empty: no point clouds
+        int maxPoints = 100;        // 0: ragged
+        ShardPrecision pointPrecision;
+
+        std::string cacheDir = ".fatjet_cache/image_builder";  // empty: no cache
+
+        // The analyzer writes its trees in a directory named after the module
+        // label (fatJetMiniAODAnalyzer/... for MiniAOD).
+        std::string tree = "fatJetAnalyzer/FatJetAnalyzer_AOD";
+        std::string featureTree = "fatJetAnalyzer/FatJetTree";
+    };
+
+    struct Sample {
+        std::string name;
+        std::vector<std::string> files;
+    };
+
+    // pT-sum and multiplicity maps in |eta| x phi, row-major in eta, plus the
+    // per-event constituent multiplicity.
+    struct ImageAccumulator {
+        int nBins;
+        float etaMax;
+        EtaPhiGrid<0> grid;
+        std::vector<float> ptSum;
+        std::vector<float> multiplicity;
+        std::vector<float> nConstituents;  // 0..99, like h_N_constituents
+        long long nEntries = 0;
+
+        ImageAccumulator(int bins, float eta)
+            : nBins(bins),
+              etaMax(eta),
+              grid(0.f, eta, true, bins),
+              ptSum(bins * bins, 0.f),
+              multiplicity(bins * bins, 0.f),
+              nConstituents(100, 0.f) {}
+
+        void fill(const float* pt, const float* eta, const float* phi, size_t n) {
+            ++nEntries;
+            if (n == 0) return;
+            if (n < nConstituents.size()) nConstituents[n] += 1.f;
+            grid.fill(eta, phi, pt, n, ptSum.data(), multiplicity.data());
+        }
+
+        // ptSum, multiplicity and nConstituents back to back, for the cache.
+        std::vector<float> serialize() const {
+            std::vector<float> data(ptSum);
+            data.insert(data.end(), multiplicity.begin(), multiplicity.end());
+            data.insert(data.end(), nConstituents.begin(), nConstituents.end());
+            return data;
+        }
+
+        bool addSerialized(const std::vector<float>& data, long long entries) {
+            if (data.size() != ptSum.size() + multiplicity.size() + nConstituents.size()) return false;
+            const float* p = data.data();
+            for (float& x : ptSum) x += *p++;
+            for (float& x : multiplicity) x += *p++;
+            for (float& x : nConstituents) x += *p++;
+            nEntries += entries;
+            return true;
+        }
+
+        void add(const ImageAccumulator& other) {
+            for (size_t i = 0; i < ptSum.size(); ++i) ptSum[i] += other.ptSum[i];
+            for (size_t i = 0; i < multiplicity.size(); ++i) multiplicity[i] += other.multiplicity[i];
+            for (size_t i = 0; i < nConstituents.size(); ++i) nConstituents[i] += other.nConstituents[i];
+            nEntries += other.nEntries;
+        }
+    };
+
+    std::vector<std::string> expandGlob(const std::string& pattern) {
+        std::vector<std::string> files;
+        glob_t result;
+        if (glob(pattern.c_str(), 0, nullptr, &result) == 0) {
+            for (size_t i = 0; i < result.gl_pathc; ++i) files.emplace_back(result.gl_pathv[i]);
+        }
+        globfree(&result);
+        if (files.empty()) std::cerr << "warning: no file matches " << pattern << std::endl;
+        return files;
+    }
+
+    // name=pattern[,pattern...]; a bare pattern is its own sample name.
+    Sample parseSample(const std::string& arg) {
+        Sample sample;
+        std::string patterns = arg;
+        const size_t eq = arg.find('=');
+        if (eq != std::string::npos) {
+            sample.name = arg.substr(0, eq);
+            patterns = arg.substr(eq + 1);
+        } else {
+            sample.name = arg;
+        }
+        size_t start = 0;
+        while (start <= patterns.size()) {
+            const size_t comma = patterns.find(',', start);
+            const std::string pattern = patterns.substr(start, comma - start);
+            if (!pattern.empty()) {
+                for (auto& file : expandGlob(pattern)) sample.files.push_back(std::move(file));
+            }
+            if (comma == std::string::npos) break;
+            start = comma + 1;
+        }
+        return sample;
+    }
+
+    // One event of FatJetAnalyzer_AOD as plain arrays.
+    struct EventView {
+        int nPF = 0;
+        const float* pt = nullptr;
+        const float* eta = nullptr;
+        const float* phi = nullptr;
+        int nJets = 0;
+        const float* jetPt = nullptr;
+        const float* jetEta = nullptr;
+        const float* jetPhi = nullptr;
+        const int* jetNPF = nullptr;  // columnar: constituents per jet
+        const int* pfJet = nullptr;   // vector: jet of every constituent
+    };
+
+    // Reads the branches of the image pass, and only those, straight into
+    // contiguous buffers with one TBranch::GetEntry per branch and entry.
+    // Columnar trees are read in bulk into arrays sized from the nPF/nFatJet
+    // counters, with no reader proxy between the basket and the loops;
+    // vector trees into std::vectors whose storage is reused.
+    class EventTreeReader {
+    public:
+        explicit EventTreeReader(bool jets) : jets_(jets) {}
+
+        EventTreeReader(const EventTreeReader&) = delete;
+        EventTreeReader& operator=(const EventTreeReader&) = delete;
+
+        // Binds the tree the chain has loaded; call again on every tree change.
+        void bind(TTree* tree) {
+            branches_.clear();
+            columnar_ = tree->GetBranch("nPF") != nullptr;
+            if (columnar_) {
+                bindArrays(tree, "nPF", nPF_, {{"pf_pt", &pt_}, {"pf_eta", &eta_}, {"pf_phi", &phi_}});
+                if (!jets_) return;
+                bindArrays(tree, "nFatJet", nJets_,
+                           {{"fatjet_pt", &jetPt_}, {"fatjet_eta", &jetEta_}, {"fatjet_phi", &jetPhi_}});
+                jetNPF_.resize(jetPt_.size());
+                bindAddress(tree, "fatjet_nPF", jetNPF_.data());
+                return;
+            }
+            bindVector(tree, "pf_pt", vectors_.pt);
+            bindVector(tree, "pf_eta", vectors_.eta);
+            bindVector(tree, "pf_phi", vectors_.phi);
+            if (!jets_) return;
+            bindVector(tree, "fatjet_pt", vectors_.jetPt);
+            bindVector(tree, "fatjet_eta", vectors_.jetEta);
+            bindVector(tree, "fatjet_phi", vectors_.jetPhi);
+            bindVector(tree, "pf_IdxFatJet", vectors_.pfJet);
+        }
+
+        // entry is the entry number in the bound tree.
+        EventView read(long long entry) {
+            for (TBranch* branch : branches_) {
+                if (branch->GetEntry(entry) < 0) {
+                    throw std::runtime_error(std::string("cannot read ") + branch->GetName());
+                }
+            }
+            EventView event;
+            event.nPF = columnar_ ? nPF_ : pt_.size();
+            event.pt = pt_.data();
+            event.eta = eta_.data();
+            event.phi = phi_.data();
+            if (!jets_) return event;
+            event.nJets = columnar_ ? nJets_ : jetPt_.size();
+            event.jetPt = jetPt_.data();
+            event.jetEta = jetEta_.data();
+            event.jetPhi = jetPhi_.data();
+            if (columnar_) event.jetNPF = jetNPF_.data();
+            else event.pfJet = pfJet_.data();
+            return event;
+        }
+
+    private:
+        void bindAddress(TTree* tree, const char* name, void* address) {
+            TBranch* branch = tree->GetBranch(name);
+            if (branch == nullptr) {
+                throw std::runtime_error(std::string("no branch ") + name + " in " + tree->GetName());
+            }
+            branch->SetAddress(address);
+            branches_.push_back(branch);
+        }
+
+        // The counter is bound first, so that it is read before its arrays.
+        // The arrays hold the largest count of the tree: the maximum the
+        // counter leaf recorded while writing, or else a scan of the tree.
+        void bindArrays(TTree* tree, const char* counter, int& count,
+                        std::initializer_list<std::pair<const char*, std::vector<float>*>> arrays) {
+            bindAddress(tree, counter, &count);
+            const TLeaf* leaf = tree->GetLeaf(counter);
+            long long maximum = leaf != nullptr ? leaf->GetMaximum() : 0;
+            if (maximum <= 0) maximum = tree->GetMaximum(counter);
+            for (const auto& [name, array] : arrays) {
+                array->resize(std::max<long long>(maximum, 1));
+                bindAddress(tree, name, array->data());
+            }
+        }
+
+        // The branch streams into *address, one of our vectors, so the
+        // storage is reused; SetBranchAddress checks the type.
+        template <typename T>
+        void bindVector(TTree* tree, const char* name, std::vector<T>*& address) {
+            if (tree->SetBranchAddress(name, &address) < 0) {
+                throw std::runtime_error(std::string("cannot read ") + name + " as a std::vector");
+            }
+            branches_.push_back(tree->GetBranch(name));
+        }
+
+        bool jets_;
+        bool columnar_ = false;
+        std::vector<TBranch*> branches_;
+        int nPF_ = 0, nJets_ = 0;
+        // Arrays of the columnar layout, or the vectors of the vector layout.
+        std::vector<float> pt_, eta_, phi_, jetPt_, jetEta_, jetPhi_;
+        std::vector<int> jetNPF_, pfJet_;
+        struct {
+            std::vector<float>* pt;
+            std::vector<float>* eta;
+            std::vector<float>* phi;
+            std::vector<float>* jetPt;
+            std::vector<float>* jetEta;
+            std::vector<float>* jetPhi;
+            std::vector<int>* pfJet;
+        } vectors_{&pt_, &eta_, &phi_, &jetPt_, &jetEta_, &jetPhi_, &pfJet_};
+    };
+
+    // Per-jet image writers of one sample; exactly one is set.
+    struct JetImageWriters {
+        ImageShardWriter* dense = nullptr;
+        SparseShardWriter* sparse = nullptr;
+    };
+
+    // Per-task batch of per-jet images, handed to the shard writer when full.
+    // Constituents of a jet are contiguous in both tree layouts; their count
+    // is fatjet_nPF (columnar) or the run length of pf_IdxFatJet (vector).
+    class JetImageBatch {
+    public:
+        JetImageBatch(const JetImageWriters& writers, const Options& options)
+            : writers_(writers),
+              builder_(options.image),
+              precision_(options.imagePrecision),
+              capacity_(options.batchSize) {
+            if (writers_.dense != nullptr) images_.reserve(capacity_ * writers_.dense->imageSize());
+            index_.reserve(capacity_);
+        }
+        ~JetImageBatch() { flush(); }
+
+        void fill(int file, long long entry, const EventView& event) {
+            int first = 0;
+            for (int jet = 0; jet < event.nJets; ++jet) {
+                int last = first;
+                if (event.jetNPF != nullptr) last = std::min(first + event.jetNPF[jet], event.nPF);
+                else while (last < event.nPF && event.pfJet[last] == jet) ++last;
+
+                const int n = last - first;
+                const float* pt = event.pt + first;
+                const float* eta = event.eta + first;
+                const float* phi = event.phi + first;
+                if (writers_.sparse != nullptr) {
+                    builder_.buildSparse(pt, eta, phi, n, event.jetEta[jet], event.jetPhi[jet], jetPixels_,
+                                         jetValues_);
+                    pixels_.insert(pixels_.end(), jetPixels_.begin(), jetPixels_.end());
+                    images_.insert(images_.end(), jetValues_.begin(), jetValues_.end());
+                    counts_.push_back(jetPixels_.size());
+                } else {
+                    const size_t offset = images_.size();
+                    images_.resize(offset + writers_.dense->imageSize());
+                    builder_.build(pt, eta, phi, n, event.jetEta[jet], event.jetPhi[jet], images_.data() + offset);
+                }
+                index_.push_back({file, entry, jet, event.jetPt[jet], event.jetEta[jet], event.jetPhi[jet]});
+                if (index_.size() == capacity_) flush();
+                first = last;
+            }
+        }
+
+        void flush() {
+            if (index_.empty()) return;
+            precision_.apply(images_);
+            if (writers_.sparse != nullptr) writers_.sparse->write(images_, pixels_, counts_, index_);
+            else writers_.dense->write(images_, index_);
+            images_.clear();
+            pixels_.clear();
+            counts_.clear();
+            index_.clear();
+        }
+
+    private:
+        JetImageWriters writers_;
+        fatjet::JetImageBuilder builder_;
+        ShardPrecision precision_;
+        size_t capacity_;
+        std::vector<float> images_;  // dense images, or COO values
+        std::vector<int> pixels_;    // COO pixels
+        std::vector<int> counts_;    // COO pixels per image
+        std::vector<ImageIndexEntry> index_;
+        std::vector<int> jetPixels_;
+        std::vector<float> jetValues_;
+    };
+
+    // A file name as TFile::GetName() may report it: no file: prefix, local
+    // paths absolute and resolved, URLs without the query and with single
+    // slashes after the host.
+    std::string normalizedFileName(std::string name) {
+        if (name.rfind("file:", 0) == 0) name.erase(0, 5);
+        const size_t scheme = name.find("://");
+        if (scheme == std::string::npos) {
+            std::error_code error;
+            const std::filesystem::path path = std::filesystem::weakly_canonical(name, error);
+            return error ? name : path.string();
+        }
+        name = name.substr(0, name.find('?'));
+        const size_t path = name.find('/', scheme + 3);
+        if (path == std::string::npos) return name;
+        std::string normalized = name.substr(0, path);
+        for (size_t i = path; i < name.size(); ++i) {
+            if (name[i] != '/' || normalized.back() != '/') normalized += name[i];
+        }
+        return normalized;
+    }
+
+    std::vector<std::string> normalizedFileNames(const std::vector<std::string>& files) {
+        std::vector<std::string> names;
+        for (const auto& file : files) names.push_back(normalizedFileName(file));
+        return names;
+    }
+
+    // Index of the file the reader is in, in the files given as
+    // normalizedFileNames(): the file of the same name or, failing that, the
+    // tree number of a chain over all the files, which numbers its trees in
+    // their order. Throws when the file cannot be identified, rather than
+    // lose its entries or credit them to another file.
+    int fileIndex(const std::vector<std::string>& files, TTreeReader& reader) {
+        if (files.size() == 1) return 0;
+        const TFile* file = reader.GetTree()->GetCurrentFile();
+        if (file == nullptr) {
+            throw std::runtime_error("no input file for entry " + std::to_string(reader.GetCurrentEntry()));
+        }
+        const std::string name = normalizedFileName(file->GetName());
+        for (size_t i = 0; i < files.size(); ++i) {
+            if (files[i] == name) return i;
+        }
+        const auto* chain = dynamic_cast<const TChain*>(reader.GetTree());
+        if (chain != nullptr && chain->GetNtrees() == int(files.size())) return chain->GetTreeNumber();
+        throw std::runtime_error(std::string("cannot match the input file ") + file->GetName() +
+                                 " to one of the " + std::to_string(files.size()) + " files of the sample");
+    }
+
+    // Fills one accumulator per input file, so that each file's result can be
+    // cached on its own. Task accumulators are flushed when the task moves to
+    // another file. Every accumulator is checked against the entries of its
+    // file's tree before it is returned, so a result attributed to the wrong
+    // file never reaches the cache.
+    std::vector<ImageAccumulator> processFiles(const std::vector<std::string>& files, const Options& options,
+                                               const JetImageWriters* shards) {
+        std::vector<ImageAccumulator> perFile(files.size(), ImageAccumulator(options.nBins, options.etaMax));
+        std::vector<long long> treeEntries(files.size(), 0);  // guarded by perFileMutex
+        std::mutex perFileMutex;
+        const std::vector<std::string> names = normalizedFileNames(files);
+
+        ROOT::TTreeProcessorMT processor(files, options.tree);
+        processor.Process([&](TTreeReader& reader) {
+            EventTreeReader events(shards != nullptr);
+            std::unique_ptr<JetImageBatch> batch;
+            if (shards != nullptr) batch = std::make_unique<JetImageBatch>(*shards, options);
+
+            ImageAccumulator local(options.nBins, options.etaMax);
+            int file = -1, treeNumber = -1;
+            auto flush = [&] {
+                if (local.nEntries == 0) return;
+                std::lock_guard<std::mutex> guard(perFileMutex);
+                perFile[file].add(local);
+                local = ImageAccumulator(options.nBins, options.etaMax);
+            };
+            while (reader.Next()) {
+                if (reader.GetTree()->GetTreeNumber() != treeNumber) {
+                    flush();
+                    treeNumber = reader.GetTree()->GetTreeNumber();
+                    file = fileIndex(names, reader);
+                    events.bind(reader.GetTree()->GetTree());
+                    std::lock_guard<std::mutex> guard(perFileMutex);
+                    treeEntries[file] = reader.GetTree()->GetTree()->GetEntries();
+                }
+                // The reader has loaded the entry, this is its number in the current tree.
+                const EventView event = events.read(reader.GetTree()->GetTree()->GetReadEntry());
+                local.fill(event.pt, event.eta, event.phi, event.nPF);
+                if (batch) batch->fill(file, reader.GetCurrentEntry(), event);
+            }
+            flush();
+        });
+        for (size_t i = 0; i < files.size(); ++i) {
+            if (perFile[i].nEntries != treeEntries[i]) {
+                throw std::runtime_error(files[i] + ": " + std::to_string(perFile[i].nEntries) +
+                                         " entries accumulated, the tree has " + std::to_string(treeEntries[i]));
+            }
+        }
+        return perFile;
+    }
+
+    // Files with a cached result are not read. Every per-jet image has to be
+    // rebuilt for the shards, so the cache is bypassed when they are written.
+    ImageAccumulator processSample(const Sample& sample, const Options& options, const JetImageWriters* shards,
+                                   const ResultCache& cache, size_t& nCached) {
+        ImageAccumulator total(options.nBins, options.etaMax);
+        std::vector<std::string> toProcess;
+        nCached = 0;
+        for (const std::string& file : sample.files) {
+            std::vector<float> data;
+            long long entries = 0;
+            if (shards == nullptr && cache.load(file, data, &entries) && total.addSerialized(data, entries)) {
+                ++nCached;
+            } else {
+                toProcess.push_back(file);
+            }
+        }
+        if (toProcess.empty()) return total;
+
+        const std::vector<ImageAccumulator> perFile = processFiles(toProcess, options, shards);
+        for (size_t i = 0; i < toProcess.size(); ++i) {
+            cache.store(toProcess[i], perFile[i].serialize(), perFile[i].nEntries);
+            total.add(perFile[i]);
+        }
+        return total;
+    }
+
+    // Point-cloud writers of one sample; exactly one is set.
+    struct PointCloudWriters {
+        ImageShardWriter* padded = nullptr;
+        SparseShardWriter* ragged = nullptr;
+    };
+
+    // Per-task batch of point clouds, one per FatJetTree entry.
+    class PointCloudBatch {
+    public:
+        PointCloudBatch(const PointCloudWriters& writers, const Options& options)
+            : writers_(writers),
+              builder_(options.maxPoints),
+              precision_(options.pointPrecision),
+              capacity_(options.batchSize) {
+            index_.reserve(capacity_);
+        }
+        ~PointCloudBatch() { flush(); }
+
+        void fill(const ImageIndexEntry& entry, const TTreeReaderArray<float>& pt, const TTreeReaderArray<float>& deta,
+                  const TTreeReaderArray<float>& dphi, const TTreeReaderArray<float>& energy,
+                  const TTreeReaderArray<int>& charge, const TTreeReaderArray<int>& pdgId,
+                  const TTreeReaderArray<float>& puppi) {
+            const int n = pt.GetSize();
+            copy(pt, pt_, n);
+            copy(deta, deta_, n);
+            copy(dphi, dphi_, n);
+            copy(energy, energy_, n);
+            copy(charge, charge_, n);
+            copy(pdgId, pdgId_, n);
+            copy(puppi, puppi_, n);
+            const int kept = builder_.build(pt_.data(), deta_.data(), dphi_.data(), energy_.data(), charge_.data(),
+                                            pdgId_.data(), puppi_.data(), n);
+            const int rows = writers_.padded != nullptr ? builder_.maxPoints() : kept;
+            const size_t offset = values_.size();
+            values_.resize(offset + size_t(rows) * fatjet::kNPointFeatures);
+            builder_.fillRows(values_.data() + offset, rows);
+            counts_.push_back(kept);
+            index_.push_back(entry);
+            if (index_.size() == capacity_) flush();
+        }
+
+        void flush() {
+            if (index_.empty()) return;
+            precision_.apply(values_);
+            if (writers_.ragged != nullptr) writers_.ragged->write(values_, {}, counts_, index_);
+            else writers_.padded->write(values_, index_);
+            values_.clear();
+            counts_.clear();
+            index_.clear();
+        }
+
+    private:
+        // Reader arrays do not guarantee contiguous storage, the builder
+        // wants plain pointers.
+        template <typename T>
+        static void copy(const TTreeReaderArray<T>& in, std::vector<T>& out, int n) {
+            out.resize(n);
+            for (int i = 0; i < n; ++i) out[i] = i < int(in.GetSize()) ? in[i] : T(0);
+        }
+
+        PointCloudWriters writers_;
+        fatjet::PointCloudBuilder builder_;
+        ShardPrecision precision_;
+        size_t capacity_;
+        std::vector<float> values_;
+        std::vector<int> counts_;
+        std::vector<ImageIndexEntry> index_;
+        std::vector<float> pt_, deta_, dphi_, energy_, puppi_;
+        std::vector<int> charge_, pdgId_;
+    };
+
+    // FatJetTree has one entry per jet with the features of every
+    // constituent, relative to the jet axis. Point clouds are never cached.
+    void processPointClouds(const Sample& sample, const Options& options, const PointCloudWriters& writers) {
+        const std::vector<std::string> names = normalizedFileNames(sample.files);
+        ROOT::TTreeProcessorMT processor(sample.files, options.featureTree);
+        processor.Process([&](TTreeReader& reader) {
+            TTreeReaderValue<float> jetPt(reader, "fj_pt");
+            TTreeReaderValue<float> jetEta(reader, "fj_eta");
+            TTreeReaderValue<float> jetPhi(reader, "fj_phi");
+            TTreeReaderArray<float> pt(reader, "pfc_pt");
+            TTreeReaderArray<float> deta(reader, "pfc_etarel");
+            TTreeReaderArray<float> dphi(reader, "pfc_phirel");
+            TTreeReaderArray<float> energy(reader, "pfc_energy");
+            TTreeReaderArray<int> charge(reader, "pfc_charge");
+            TTreeReaderArray<int> pdgId(reader, "pfc_pdgId");
+            TTreeReaderArray<float> puppi(reader, "pfc_puppiWeight");
+
+            PointCloudBatch batch(writers, options);
+            int file = -1, treeNumber = -1;
+            while (reader.Next()) {
+                if (reader.GetTree()->GetTreeNumber() != treeNumber) {
+                    treeNumber = reader.GetTree()->GetTreeNumber();
+                    file = fileIndex(names, reader);
+                }
+                batch.fill({file, reader.GetCurrentEntry(), 0, *jetPt, *jetEta, *jetPhi}, pt, deta, dphi, energy,
+                           charge, pdgId, puppi);
+            }
+        });
+    }
+
+    void write(TFile& out, const std::string& name, const ImageAccumulator& acc) {
+        TDirectory* dir = out.mkdir(name.c_str());
+        dir->cd();
+        const int n = acc.nBins;
+        TH2F ptSum("pf_image_eta_phi_pt", (name + " constituents - |#eta| vs #phi with p_{T} sum;|#eta|;#phi").c_str(),
+                   n, 0., acc.etaMax, n, acc.grid.phiMin(), acc.grid.phiMax());
+        TH2F multiplicity("pf_image_eta_phi_multiplicity", (name + " constituents - |#eta| vs #phi multiplicity;|#eta|;#phi").c_str(),
+                          n, 0., acc.etaMax, n, acc.grid.phiMin(), acc.grid.phiMax());
+        TH1F nConstituents("h_N_constituents", (name + ";N_{constituents};Events").c_str(), 100, 0, 100);
+        for (int etaBin = 0; etaBin < n; ++etaBin) {
+            for (int phiBin = 0; phiBin < n; ++phiBin) {
+                const int bin = etaBin * n + phiBin;
+                ptSum.SetBinContent(etaBin + 1, phiBin + 1, acc.ptSum[bin]);
+                multiplicity.SetBinContent(etaBin + 1, phiBin + 1, acc.multiplicity[bin]);
+            }
+        }
+        for (int i = 0; i < 100; ++i) nConstituents.SetBinContent(i + 1, acc.nConstituents[i]);
+        ptSum.Write();
+        multiplicity.Write();
+        nConstituents.Write();
+    }
+
+    bool createDirectory(const std::string& dir) {
+        std::error_code error;
+        std::filesystem::create_directories(dir, error);
+        if (error) std::cerr << "cannot create " << dir << ": " << error.message() << std::endl;
+        return !error;
+    }
+
+    void usage(const char* argv0) {
+        std::cerr << "usage: " << argv0 << " [-j threads] [-n bins] [--eta-max x] [-o output.root]"
+                  << " [--cache dir | --no-cache] [--tree dir/name] [--feature-tree dir/name]"
+                  << " [--shards dir [--sparse] [--pixels n] [--half-width x] [--no-rotate] [--shard-size n]"
+                  << " [--batch n] [--precision spec]]"
+                  << " [--point-clouds dir [--max-points n] [--point-precision spec]]"
+                  << " name=file_or_glob[,file_or_glob...] ..." << std::endl;
+    }
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    std::vector<Sample> samples;
+    std::string imagePrecision = "full", pointPrecision = "full";
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "-j" && hasValue) options.nThreads = std::atoi(argv[++i]);
+        else if (arg == "-n" && hasValue) options.nBins = std::atoi(argv[++i]);
+        else if (arg == "--eta-max" && hasValue) options.etaMax = std::atof(argv[++i]);
+        else if (arg == "-o" && hasValue) options.output = argv[++i];
+        else if (arg == "--cache" && hasValue) options.cacheDir = argv[++i];
+        else if (arg == "--no-cache") options.cacheDir.clear();
+        else if (arg == "--tree" && hasValue) options.tree = argv[++i];
+        else if (arg == "--feature-tree" && hasValue) options.featureTree = argv[++i];
+        else if (arg == "--shards" && hasValue) options.shardDir = argv[++i];
+        else if (arg == "--sparse") options.sparse = true;
+        else if (arg == "--point-clouds" && hasValue) options.pointCloudDir = argv[++i];
+        else if (arg == "--max-points" && hasValue) options.maxPoints = std::atoi(argv[++i]);
+        else if (arg == "--precision" && hasValue) imagePrecision = argv[++i];
+        else if (arg == "--point-precision" && hasValue) pointPrecision = argv[++i];
+        else if (arg == "--pixels" && hasValue) options.image.nPixels = std::atoi(argv[++i]);
+        else if (arg == "--half-width" && hasValue) options.image.halfWidth = std::atof(argv[++i]);
+        else if (arg == "--no-rotate") options.image.rotate = options.image.flip = false;
+        else if (arg == "--shard-size" && hasValue) options.imagesPerShard = std::atol(argv[++i]);
+        else if (arg == "--batch" && hasValue) options.batchSize = std::atol(argv[++i]);
+        else if (arg == "-h" || arg == "--help") { usage(argv[0]); return 0; }
+        else samples.push_back(parseSample(arg));
+    }
+    if (samples.empty() || options.nBins <= 0 || options.etaMax <= 0 || options.image.nPixels <= 0 ||
+        options.image.halfWidth <= 0 || options.imagesPerShard == 0 || options.batchSize == 0 ||
+        options.maxPoints < 0 || !parseShardPrecision(imagePrecision, options.imagePrecision) ||
+        !parseShardPrecision(pointPrecision, options.pointPrecision)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ROOT::EnableImplicitMT(options.nThreads);
+
+    const ResultCache cache(options.cacheDir, std::string("image_builder v1 tree=") + options.tree + " n=" +
+                                                  std::to_string(options.nBins) + " etaMax=" +
+                                                  std::to_string(options.etaMax));
+
+    TFile out(options.output.c_str(), "RECREATE");
+    for (const Sample& sample : samples) {
+        if (sample.files.empty()) {
+            std::cerr << "skipping sample " << sample.name << ": no input files" << std::endl;
+            continue;
+        }
+        std::unique_ptr<ImageShardWriter> denseShards;
+        std::unique_ptr<SparseShardWriter> sparseShards;
+        JetImageWriters shards;
+        if (!options.shardDir.empty()) {
+            if (!createDirectory(options.shardDir)) return 1;
+            if (options.sparse) {
+                sparseShards = std::make_unique<SparseShardWriter>(options.shardDir, sample.name, 1, true,
+                                                                   options.imagesPerShard,
+                                                                   options.imagePrecision.half);
+            } else {
+                denseShards = std::make_unique<ImageShardWriter>(options.shardDir, sample.name, options.image.nPixels,
+                                                                 options.imagesPerShard,
+                                                                 options.imagePrecision.half);
+            }
+            shards = {denseShards.get(), sparseShards.get()};
+        }
+        size_t nCached = 0;
+        const ImageAccumulator acc =
+            processSample(sample, options, options.shardDir.empty() ? nullptr : &shards, cache, nCached);
+        std::cout << sample.name << ": " << sample.files.size() << " files (" << nCached << " cached), "
+                  << acc.nEntries << " entries";
+        if (denseShards) std::cout << ", " << denseShards->imagesWritten() << " jet images";
+        if (sparseShards) {
+            std::cout << ", " << sparseShards->rowsWritten() << " sparse jet images ("
+                      << sparseShards->pointsWritten() << " pixels)";
+        }
+
+        if (!options.pointCloudDir.empty()) {
+            if (!createDirectory(options.pointCloudDir)) return 1;
+            const std::string prefix = sample.name + "_pc";
+            std::unique_ptr<ImageShardWriter> padded;
+            std::unique_ptr<SparseShardWriter> ragged;
+            if (options.maxPoints > 0) {
+                padded = std::make_unique<ImageShardWriter>(
+                    options.pointCloudDir, prefix,
+                    std::vector<size_t>{size_t(options.maxPoints), size_t(fatjet::kNPointFeatures)},
+                    options.imagesPerShard, options.pointPrecision.half);
+            } else {
+                ragged = std::make_unique<SparseShardWriter>(options.pointCloudDir, prefix, fatjet::kNPointFeatures,
+                                                             false, options.imagesPerShard,
+                                                             options.pointPrecision.half);
+            }
+            processPointClouds(sample, options, {padded.get(), ragged.get()});
+            std::cout << ", " << (padded ? padded->imagesWritten() : ragged->rowsWritten()) << " point clouds";
+        }
+        std::cout << std::endl;
+        write(out, sample.name, acc);
+    }
+    out.Close();
+    return 0;
+}
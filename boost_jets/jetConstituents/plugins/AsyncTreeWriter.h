@@ -0,0 +1,218 @@
+#ifndef AsyncTreeWriter_h
+#define AsyncTreeWriter_h
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "oneapi/tbb/task_group.h"
+
+#include "Compression.h"
+#include "TBranch.h"
+#include "TFile.h"
+#include "TLeaf.h"
+#include "TObjArray.h"
+#include "TTree.h"
+
+#include "FatJetTreeColumns.h"
+
+namespace fatjet {
+
+    // Storage settings of the output trees; the defaults keep ROOT's (and
+    // the TFileService file's) choices.
+    struct TreeOutputConfig {
+        int compressionAlgorithm = -1;  // ROOT::RCompressionSetting::EAlgorithm, -1: the file's
+        int compressionLevel = -1;      // -1: the algorithm's default level
+        int basketSize = 0;             // bytes per branch basket, 0: ROOT default
+        int autoFlush = 0;              // > 0: entries, < 0: bytes between flushes, 0: ROOT default
+        bool implicitMT = true;         // compress the baskets of one Fill in parallel when ROOT IMT is on
+    };
+
+    // ROOT's default level of a ROOT::RCompressionSetting::EAlgorithm.
+    inline int defaultCompressionLevel(int algorithm) {
+        using Algorithm = ROOT::RCompressionSetting::EAlgorithm;
+        using Level = ROOT::RCompressionSetting::ELevel;
+        switch (algorithm) {
+            case Algorithm::kLZ4: return Level::kDefaultLZ4;
+            case Algorithm::kZSTD: return Level::kDefaultZSTD;
+            case Algorithm::kLZMA: return Level::kDefaultLZMA;
+            default: return Level::kDefaultZLIB;
+        }
+    }
+
+    // Applies config to every branch booked so far, so call it after book().
+    inline void configureTree(TTree* tree, const TreeOutputConfig& config) {
+        if (config.compressionAlgorithm >= 0 || config.compressionLevel >= 0) {
+            int algorithm = config.compressionAlgorithm;
+            if (algorithm < 0) {
+                const TFile* file = tree->GetCurrentFile();
+                algorithm = file != nullptr ? file->GetCompressionAlgorithm() : 0;
+            }
+            const int level =
+                config.compressionLevel >= 0 ? config.compressionLevel : defaultCompressionLevel(algorithm);
+            const int settings =
+                ROOT::CompressionSettings(ROOT::RCompressionSetting::EAlgorithm::EValues(algorithm), level);
+            TObjArray* leaves = tree->GetListOfLeaves();
+            for (int i = 0; i < leaves->GetEntriesFast(); ++i) {
+                static_cast<TLeaf*>(leaves->UncheckedAt(i))->GetBranch()->SetCompressionSettings(settings);
+            }
+        }
+        if (config.basketSize > 0) tree->SetBasketSize("*", config.basketSize);
+        if (config.autoFlush != 0) tree->SetAutoFlush(config.autoFlush);
+        tree->SetImplicitMT(config.implicitMT);
+    }
+
+    // One event's worth of tree input, handed from a stream to the writer.
+    struct TreeFillBatch {
+        EventColumns columns;
+        std::vector<JetFeatureRow> featureRows;  // the first nFeatureRows are valid
+        size_t nFeatureRows = 0;
+    };
+
+    // Deferred output stage. The streams swap their filled buffers into a
+    // free batch and queue it; the Fill calls run as TBB tasks next to the
+    // event processing, one at a time (at most one drain task is scheduled),
+    // and ROOT IMT compresses the baskets of each Fill in parallel. The
+    // batch then returns, with its capacity, to the free list. With depth
+    // batches in flight a stream only waits when depth events are queued.
+    // The trees must be in a file of their own, not in the TFileService
+    // one: the fills are serialized here, not with the other modules.
+    //
+    // Nothing spins or sleeps: a stream that finds no free batch fills the
+    // oldest queued one itself and keeps it, and blocks only while every
+    // batch is being filled; each submit() wakes one waiting stream, so the
+    // queue drains even when no thread is left for the drain task. The
+    // fills are serialized by fillMutex_; ROOT runs the compression in its
+    // own task arena, so a thread waiting for it there does not pick up a
+    // drain task or an event.
+    //
+    // An exception thrown by the sink stops the writing; it is rethrown to
+    // the next acquire() or to stop().
+    class AsyncTreeWriter {
+    public:
+        using Sink = std::function<long long(TreeFillBatch&)>;  // returns the bytes filled
+
+        AsyncTreeWriter(size_t depth, Sink sink) : sink_(std::move(sink)) {
+            batches_.resize(std::max<size_t>(depth, 1));
+            for (auto& batch : batches_) {
+                batch = std::make_unique<TreeFillBatch>();
+                free_.push_back(batch.get());
+            }
+        }
+
+        ~AsyncTreeWriter() { tasks_.wait(); }
+
+        AsyncTreeWriter(const AsyncTreeWriter&) = delete;
+        AsyncTreeWriter& operator=(const AsyncTreeWriter&) = delete;
+
+        // A free batch, or a queued one after filling it. Thread safe.
+        TreeFillBatch* acquire() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (;;) {
+                rethrowIfFailed();
+                if (!free_.empty()) {
+                    TreeFillBatch* batch = free_.back();
+                    free_.pop_back();
+                    return batch;
+                }
+                if (!filled_.empty()) {
+                    TreeFillBatch* batch = filled_.front();
+                    filled_.pop_front();
+                    lock.unlock();
+                    write(*batch);
+                    lock.lock();
+                    rethrowIfFailed();
+                    return batch;
+                }
+                available_.wait(lock);
+            }
+        }
+
+        // Queues a batch from acquire() and schedules the drain task if none
+        // is. Thread safe; never waits.
+        void submit(TreeFillBatch* batch) {
+            {
+                std::lock_guard<std::mutex> guard(mutex_);
+                filled_.push_back(batch);
+                available_.notify_one();
+                if (drainScheduled_) return;
+                drainScheduled_ = true;
+            }
+            tasks_.run([this] { drain(); });
+        }
+
+        // Waits for the drain task and writes what is left. Call once no
+        // stream submits any more, and before the file is closed.
+        void stop() {
+            tasks_.wait();
+            drain();
+            std::lock_guard<std::mutex> guard(mutex_);
+            rethrowIfFailed();
+        }
+
+        long long batchesWritten() const { return batchesWritten_.load(std::memory_order_relaxed); }
+        long long bytesWritten() const { return bytesWritten_.load(std::memory_order_relaxed); }
+
+    private:
+        // Under mutex_.
+        void rethrowIfFailed() const {
+            if (error_) std::rethrow_exception(error_);
+        }
+
+        // Fills the queued batches until the queue is empty.
+        void drain() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!filled_.empty()) {
+                TreeFillBatch* batch = filled_.front();
+                filled_.pop_front();
+                lock.unlock();
+                write(*batch);
+                lock.lock();
+                free_.push_back(batch);
+                available_.notify_one();
+            }
+            drainScheduled_ = false;
+        }
+
+        void write(TreeFillBatch& batch) {
+            std::lock_guard<std::mutex> fill(fillMutex_);
+            if (!failed_) {
+                try {
+                    bytesWritten_.fetch_add(sink_(batch), std::memory_order_relaxed);
+                } catch (...) {
+                    failed_ = true;
+                    std::lock_guard<std::mutex> guard(mutex_);
+                    error_ = std::current_exception();
+                }
+            }
+            batchesWritten_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        std::vector<std::unique_ptr<TreeFillBatch>> batches_;
+        Sink sink_;
+
+        std::mutex mutex_;  // guards free_, filled_, drainScheduled_ and error_
+        std::condition_variable available_;  // a batch was freed or queued
+        std::vector<TreeFillBatch*> free_;
+        std::deque<TreeFillBatch*> filled_;
+        bool drainScheduled_ = false;
+        std::exception_ptr error_;
+
+        std::mutex fillMutex_;
+        bool failed_ = false;  // under fillMutex_
+        std::atomic<long long> batchesWritten_{0};
+        std::atomic<long long> bytesWritten_{0};
+        tbb::task_group tasks_;
+    };
+
+}  // namespace fatjet
+
+#endif
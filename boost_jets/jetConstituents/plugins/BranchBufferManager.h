@@ -0,0 +1,153 @@
+#ifndef BranchBufferManager_h
+#define BranchBufferManager_h
+
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+#include "FatJetProfiler.h"
+#include "FatJetTreeColumns.h"
+
+namespace fatjet {
+
+    // Capacity policy of the per-stream branch buffers: the EventColumns of
+    // FatJetAnalyzer_AOD and the JetFeatureRows of FatJetTree.
+    //
+    // Before the jet loop every column is grown once from the totals of the
+    // event (selected jets, and their daughters as an upper bound of the
+    // gathered constituents) plus 25% headroom, so that no push_back inside
+    // the loop reallocates. Capacity is kept across events. Every
+    // trimInterval events, a column holding more than twice what the
+    // largest event of the interval needed is shrunk back to that need, so
+    // that a single high-pileup event does not pin its memory for the rest
+    // of the job.
+    //
+    // Counters go to the ProfileStats given to each call; a null pointer
+    // skips them, as for PhaseTimer.
+    class BranchBufferManager {
+    public:
+        // eventTree = false manages only the constituent buffer, the event
+        // tree columns are then never filled. trimInterval = 0 never trims.
+        explicit BranchBufferManager(OutputFormat format = OutputFormat::kVector, bool eventTree = true,
+                                     int trimInterval = 1000)
+            : format_(format), eventTree_(eventTree), trimInterval_(trimInterval) {}
+
+        // Start of the event, on cleared columns.
+        void prepare(EventColumns& columns, size_t nJets, size_t nConstituents, ProfileStats* profile) {
+            reserved_.clear();
+            reserve(columns, nJets, nConstituents, reserved_, profile);
+            peakJets_ = std::max(peakJets_, nJets);
+            peakConstituents_ = std::max(peakConstituents_, nConstituents);
+        }
+
+        // Row rowIndex of the event, cleared, for a jet with nConstituents
+        // daughters.
+        void prepare(JetFeatureRow& row, size_t rowIndex, size_t nConstituents, ProfileStats* profile) {
+            if (rowReserved_.size() <= rowIndex) rowReserved_.resize(rowIndex + 1);
+            rowReserved_[rowIndex].clear();
+            reserve(row, 0, nConstituents, rowReserved_[rowIndex], profile);
+            peakRows_ = std::max(peakRows_, rowIndex + 1);
+            peakJetConstituents_ = std::max(peakJetConstituents_, nConstituents);
+        }
+
+        // End of the event, after the trees are filled: counts the columns
+        // that still had to grow in the loop, and trims at interval ends.
+        // Rows past the first nRows are not looked at.
+        void finish(EventColumns& columns, std::vector<JetFeatureRow>& rows, size_t nRows, ProfileStats* profile) {
+            if (profile != nullptr) {
+                profile->bufferReallocations += countGrown(columns, reserved_);
+                for (size_t i = 0; i < std::min(nRows, rowReserved_.size()); ++i) {
+                    profile->bufferReallocations += countGrown(rows[i], rowReserved_[i]);
+                }
+            }
+            if (trimInterval_ <= 0 || ++events_ < trimInterval_) return;
+
+            long long trims = trim(columns, peakJets_, peakConstituents_);
+            if (rows.size() > peakRows_) {
+                trims += rows.size() - peakRows_;
+                rows.erase(rows.begin() + peakRows_, rows.end());
+            }
+            for (auto& row : rows) trims += trim(row, 0, peakJetConstituents_);
+            if (profile != nullptr) profile->bufferTrims += trims;
+
+            events_ = 0;
+            peakJets_ = peakConstituents_ = peakRows_ = peakJetConstituents_ = 0;
+        }
+
+    private:
+        static constexpr size_t kMinCapacity = 16;
+
+        static size_t withHeadroom(size_t n) { return std::max(n + n / 4, kMinCapacity); }
+
+        // Calls f(column, perConstituent) for the managed columns.
+        template <typename F>
+        void visit(EventColumns& columns, F&& f) const {
+            if (eventTree_) columns.forEachColumn(format_, f);
+            else columns.constituents.forEachColumn(f);
+        }
+
+        template <typename F>
+        void visit(JetFeatureRow& row, F&& f) const {
+            row.forEachColumn(f);
+        }
+
+        template <typename Columns>
+        void reserve(Columns& columns, size_t nJets, size_t nConstituents, std::vector<size_t>& reserved,
+                     ProfileStats* profile) const {
+            visit(columns, [&](auto& column, bool perConstituent) {
+                const size_t need = perConstituent ? nConstituents : nJets + 1;
+                if (column.capacity() < need) {
+                    column.reserve(withHeadroom(need));
+                    if (profile != nullptr) profile->bufferGrowths += 1;
+                }
+                reserved.push_back(column.capacity());
+            });
+        }
+
+        template <typename Columns>
+        long long countGrown(Columns& columns, const std::vector<size_t>& reserved) const {
+            long long grown = 0;
+            size_t i = 0;
+            visit(columns, [&](auto& column, bool) {
+                if (i < reserved.size() && column.capacity() != reserved[i]) ++grown;
+                ++i;
+            });
+            return grown;
+        }
+
+        // Reallocates the oversized columns, keeping their contents.
+        template <typename Columns>
+        long long trim(Columns& columns, size_t nJets, size_t nConstituents) const {
+            long long trims = 0;
+            visit(columns, [&](auto& column, bool perConstituent) {
+                const size_t target = withHeadroom(std::max(perConstituent ? nConstituents : nJets + 1, column.size()));
+                if (column.capacity() <= 2 * target) return;
+                std::remove_reference_t<decltype(column)> fresh;
+                fresh.reserve(target);
+                fresh.assign(column.begin(), column.end());
+                column.swap(fresh);
+                ++trims;
+            });
+            return trims;
+        }
+
+        OutputFormat format_;
+        bool eventTree_;
+        int trimInterval_;
+
+        // Capacities right after prepare(), to spot growth in the loop.
+        std::vector<size_t> reserved_;
+        std::vector<std::vector<size_t>> rowReserved_;
+
+        // Largest needs seen in the current trim interval.
+        int events_ = 0;
+        size_t peakJets_ = 0;
+        size_t peakConstituents_ = 0;
+        size_t peakRows_ = 0;
+        size_t peakJetConstituents_ = 0;
+    };
+
+}  // namespace fatjet
+
+#endif
@@ -1,116 +1,378 @@
-#include <memory>
-#include <vector>
-#include <string> // Added for std::string
-
-// ROOT includes
-#include "TMath.h"
-#include "TString.h"
-#include "TTree.h"
-#include "TH1F.h"
-#include "TH2F.h"
-
-// FWCore includes
-#include "FWCore/Framework/interface/Frameworkfwd.h"
-#include "FWCore/Framework/interface/one/EDAnalyzer.h"
-#include "FWCore/Framework/interface/Event.h"
-#include "FWCore/Framework/interface/MakerMacros.h"
-#include "FWCore/ParameterSet/interface/ParameterSet.h"
-#include "FWCore/ServiceRegistry/interface/Service.h"
-#include "CommonTools/UtilAlgos/interface/TFileService.h"
+#include "FatJetAnalyzer.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+
 #include "FWCore/MessageLogger/interface/MessageLogger.h" // For edm::LogError
+#include "FWCore/Utilities/interface/Exception.h"
 
-// Data formats
-#include "DataFormats/JetReco/interface/PFJet.h"
-#include "DataFormats/JetReco/interface/PFJetCollection.h"
-#include "DataFormats/ParticleFlowCandidate/interface/PFCandidate.h" // For reco::PFCandidate
-#include "DataFormats/Candidate/interface/Candidate.h" // For edm::Ptr<reco::Candidate>
-
-class FatJetAnalyzer : public edm::one::EDAnalyzer<edm::one::SharedResources> {
-public:
-    explicit FatJetAnalyzer(const edm::ParameterSet&);
-    ~FatJetAnalyzer() override;
-
-    static void fillDescriptions(edm::ConfigurationDescriptions& descriptions);
-
-private:
-    void beginJob() override;
-    void analyze(const edm::Event&, const edm::EventSetup&) override;
-    void endJob() override;
-
-    void initializeHistograms();
-
-    // Configuration parameters
-    const bool saveHistograms_;
-    const bool saveTree_;
-    const double minFatJetPt_;
-    const edm::InputTag fatjetsInputTag_; // Store the InputTag
-
-    // Tokens
-    const edm::EDGetTokenT<reco::PFJetCollection> fatjetsToken_;
-
-    // Tree
-    TTree* eventTree_;
-
-    // --- Branches for the new TTree structure ---
-    std::vector<float> fatjet_pt_;
-    std::vector<float> fatjet_eta_;
-    std::vector<float> fatjet_phi_;
-    std::vector<float> fatjet_mass_;
-    std::vector<int>   fatjet_Idx_;
-
-    std::vector<float> pf_pt_;
-    std::vector<float> pf_eta_;
-    std::vector<float> pf_phi_;
-    std::vector<int>   pf_IdxFatJet_;
-
-    // Histograms (optional)
-    TH1F* hFatJetPt_;
-    TH1F* hFatJetEta_;
-    TH1F* hFatJetPhi_;
-    TH1F* hFatJetMass_;
-    TH1F* hFatJetNConstituents_;
-    TH2F* hFatJetEtaVsPhi_;
-    TH2F* hFatJetPtVsEta_;
-    TH2F* hFatJetConstituentPtVsEta_;
-};
-
-FatJetAnalyzer::FatJetAnalyzer(const edm::ParameterSet& iConfig) :
+template <typename Input>
+FatJetAnalyzerT<Input>::FatJetAnalyzerT(const edm::ParameterSet& iConfig) :
     saveHistograms_(iConfig.getParameter<bool>("saveHistograms")),
     saveTree_(iConfig.getParameter<bool>("saveTree")),
+    saveFeatureTree_(iConfig.getParameter<bool>("saveFeatureTree")),
+    saveImages_(iConfig.getParameter<bool>("saveImages")),
+    sparseImages_(parseImageFormat(iConfig.getParameter<std::string>("imageFormat"))),
+    savePointCloud_(iConfig.getParameter<bool>("savePointCloud")),
+    pointCloudMaxPoints_(iConfig.getParameter<int>("pointCloudMaxPoints")),
+    profile_(iConfig.getParameter<bool>("profile")),
+    computeSubstructure_(iConfig.getParameter<bool>("computeSubstructure")),
+    imageConfig_(parseImageConfig(iConfig)),
+    substructureConfig_(parseSubstructureConfig(iConfig)),
+    outputFormat_(parseOutputFormat(iConfig.getParameter<std::string>("outputFormat"))),
+    treeOutputConfig_(parseTreeOutputConfig(iConfig)),
+    precision_(parsePrecisionPolicy(iConfig)),
+    histogramSpecs_(parseHistogramSpecs(iConfig)),
+    asyncTreeWriter_(iConfig.getParameter<bool>("asyncTreeWriter")),
+    asyncQueueDepth_(iConfig.getParameter<int>("asyncQueueDepth")),
     minFatJetPt_(iConfig.getParameter<double>("minFatJetPt")),
+    signalLabel_(iConfig.getParameter<int>("signalLabel")),
+    bufferTrimInterval_(iConfig.getParameter<int>("bufferTrimInterval")),
+    treeFileName_(iConfig.getParameter<std::string>("treeFile")),
     fatjetsInputTag_(iConfig.getParameter<edm::InputTag>("fatjets")), // Initialize here
-    fatjetsToken_(consumes<reco::PFJetCollection>(fatjetsInputTag_))   // Use the stored InputTag
+    verticesTag_ps_(iConfig.getParameter<edm::InputTag>("vertices")),
+    fatjetsToken_(consumes<JetCollection>(fatjetsInputTag_)),  // Use the stored InputTag
+    input_(iConfig, consumesCollector(), saveFeatureTree_, !computeSubstructure_),
+    eventTree_(nullptr),
+    fatJetTree_(nullptr)
 {
-    usesResource("TFileService");
+    if ((saveImages_ || savePointCloud_) && !saveFeatureTree_) {
+        throw cms::Exception("Configuration")
+            << "FatJetAnalyzer: saveImages and savePointCloud require saveFeatureTree, "
+            << "the images and point clouds are written in FatJetTree";
+    }
+    if (pointCloudMaxPoints_ < 0) {
+        throw cms::Exception("Configuration") << "FatJetAnalyzer: pointCloudMaxPoints must not be negative";
+    }
+    if (asyncQueueDepth_ < 1) {
+        throw cms::Exception("Configuration") << "FatJetAnalyzer: asyncQueueDepth must be at least 1";
+    }
+
+    // The feature-only products are not consumed when the tree is off; the
+    // input policy does the same for its own products.
+    if (saveFeatureTree_ && !verticesTag_ps_.label().empty()) {
+        verticesToken_ = consumes<reco::VertexCollection>(verticesTag_ps_);
+    }
+}
+
+template <typename Input>
+FatJetAnalyzerT<Input>::~FatJetAnalyzerT() {}
+
+template <typename Input>
+fatjet::OutputFormat FatJetAnalyzerT<Input>::parseOutputFormat(const std::string& name) {
+    if (name == "vector") return fatjet::OutputFormat::kVector;
+    if (name == "columnar") return fatjet::OutputFormat::kColumnar;
+    throw cms::Exception("Configuration") << "FatJetAnalyzer: unknown outputFormat '" << name
+                                          << "', expected 'vector' or 'columnar'";
+}
+
+// True for the sparse (COO) image branches.
+template <typename Input>
+bool FatJetAnalyzerT<Input>::parseImageFormat(const std::string& name) {
+    if (name == "dense") return false;
+    if (name == "sparse") return true;
+    throw cms::Exception("Configuration") << "FatJetAnalyzer: unknown imageFormat '" << name
+                                          << "', expected 'dense' or 'sparse'";
+}
+
+template <typename Input>
+fatjet::JetImageConfig FatJetAnalyzerT<Input>::parseImageConfig(const edm::ParameterSet& iConfig) {
+    fatjet::JetImageConfig config;
+    config.nPixels = iConfig.getParameter<int>("imagePixels");
+    config.halfWidth = iConfig.getParameter<double>("imageHalfWidth");
+    config.rotate = iConfig.getParameter<bool>("imageRotate");
+    config.flip = iConfig.getParameter<bool>("imageFlip");
+    if (config.nPixels <= 0 || config.halfWidth <= 0) {
+        throw cms::Exception("Configuration") << "FatJetAnalyzer: imagePixels and imageHalfWidth must be positive";
+    }
+    return config;
+}
+
+template <typename Input>
+fatjet::SubstructureConfig FatJetAnalyzerT<Input>::parseSubstructureConfig(const edm::ParameterSet& iConfig) {
+    fatjet::SubstructureConfig config;
+    config.nsubBeta = iConfig.getParameter<double>("nsubjettinessBeta");
+    config.nsubR0 = iConfig.getParameter<double>("nsubjettinessR0");
+    config.softDropZCut = iConfig.getParameter<double>("softDropZCut");
+    config.softDropBeta = iConfig.getParameter<double>("softDropBeta");
+    config.softDropR0 = iConfig.getParameter<double>("softDropR0");
+    config.ecfBeta = iConfig.getParameter<double>("ecfBeta");
+    config.ecfMaxConstituents = iConfig.getParameter<int>("ecfMaxConstituents");
+    if (config.nsubR0 <= 0 || config.softDropR0 <= 0 || config.nsubBeta <= 0 || config.ecfBeta <= 0) {
+        throw cms::Exception("Configuration") << "FatJetAnalyzer: the substructure radii and angular exponents "
+                                              << "must be positive";
+    }
+    return config;
+}
+
+template <typename Input>
+fatjet::TreeOutputConfig FatJetAnalyzerT<Input>::parseTreeOutputConfig(const edm::ParameterSet& iConfig) {
+    using Algorithm = ROOT::RCompressionSetting::EAlgorithm;
+    fatjet::TreeOutputConfig config;
+    const std::string algorithm = iConfig.getParameter<std::string>("compressionAlgorithm");
+    if (algorithm == "") config.compressionAlgorithm = -1;
+    else if (algorithm == "ZLIB") config.compressionAlgorithm = Algorithm::kZLIB;
+    else if (algorithm == "LZMA") config.compressionAlgorithm = Algorithm::kLZMA;
+    else if (algorithm == "LZ4") config.compressionAlgorithm = Algorithm::kLZ4;
+    else if (algorithm == "ZSTD") config.compressionAlgorithm = Algorithm::kZSTD;
+    else {
+        throw cms::Exception("Configuration") << "FatJetAnalyzer: unknown compressionAlgorithm '" << algorithm
+                                              << "', expected '', 'ZLIB', 'LZMA', 'LZ4' or 'ZSTD'";
+    }
+    config.compressionLevel = iConfig.getParameter<int>("compressionLevel");
+    config.basketSize = iConfig.getParameter<int>("basketSize");
+    config.autoFlush = iConfig.getParameter<int>("autoFlush");
+    config.implicitMT = iConfig.getParameter<bool>("parallelCompression");
+    if (config.compressionLevel > 9 || config.basketSize < 0) {
+        throw cms::Exception("Configuration") << "FatJetAnalyzer: compressionLevel must be at most 9 and "
+                                              << "basketSize not negative";
+    }
+    return config;
 }
 
-FatJetAnalyzer::~FatJetAnalyzer() {}
+// defaultPrecision for every float branch, branchPrecision.<name> for the
+// listed ones.
+template <typename Input>
+fatjet::PrecisionPolicy FatJetAnalyzerT<Input>::parsePrecisionPolicy(const edm::ParameterSet& iConfig) {
+    const auto parse = [](const std::string& name, const std::string& spec) {
+        fatjet::Precision precision;
+        if (!fatjet::parsePrecision(spec, precision)) {
+            throw cms::Exception("Configuration")
+                << "FatJetAnalyzer: bad precision '" << spec << "' for " << name << ", expected 'full', "
+                << "'truncate:N', 'quantize:min:max:N', 'float16:N' or 'float16:min:max:N'";
+        }
+        return precision;
+    };
+    const fatjet::Precision fallback =
+        parse("defaultPrecision", iConfig.getParameter<std::string>("defaultPrecision"));
+    std::map<std::string, fatjet::Precision> branches;
+    const auto& branchPrecision = iConfig.getParameter<edm::ParameterSet>("branchPrecision");
+    for (const auto& name : branchPrecision.getParameterNamesForType<std::string>()) {
+        branches[name] = parse(name, branchPrecision.getParameter<std::string>(name));
+    }
+    return fatjet::PrecisionPolicy(fallback, std::move(branches));
+}
+
+template <typename Input>
+std::vector<fatjet::HistogramSpec> FatJetAnalyzerT<Input>::parseHistogramSpecs(const edm::ParameterSet& iConfig) {
+    // A missing range is only allowed for fj_pt, which then spans
+    // minFatJetPt to minFatJetPt + 1000 GeV and so follows the selection.
+    const double minPt = iConfig.getParameter<double>("minFatJetPt");
+    const auto range = [minPt](const edm::ParameterSet& pset, const std::string& observable, const char* minName,
+                               const char* maxName, double& min, double& max) {
+        const bool hasMin = pset.existsAs<double>(minName);
+        const bool hasMax = pset.existsAs<double>(maxName);
+        if (hasMin) min = pset.getParameter<double>(minName);
+        if (hasMax) max = pset.getParameter<double>(maxName);
+        if (hasMin && hasMax) return;
+        if (observable != "fj_pt") {
+            throw cms::Exception("Configuration")
+                << "FatJetAnalyzer: histogram '" << pset.getParameter<std::string>("name") << "': " << minName
+                << " and " << maxName << " can only be omitted for fj_pt";
+        }
+        if (!hasMin) min = minPt;
+        if (!hasMax) max = min + 1000.;
+    };
+    std::vector<fatjet::HistogramSpec> specs;
+    for (const auto& pset : iConfig.getParameter<std::vector<edm::ParameterSet>>("histograms")) {
+        fatjet::HistogramSpec spec;
+        spec.name = pset.getParameter<std::string>("name");
+        spec.title = pset.getParameter<std::string>("title");
+        spec.x = pset.getParameter<std::string>("x");
+        spec.y = pset.getParameter<std::string>("y");
+        spec.nBinsX = pset.getParameter<int>("nBinsX");
+        range(pset, spec.x, "xMin", "xMax", spec.xMin, spec.xMax);
+        spec.nBinsY = pset.getParameter<int>("nBinsY");
+        if (!spec.y.empty()) range(pset, spec.y, "yMin", "yMax", spec.yMin, spec.yMax);
+        const std::string problem = fatjet::HistogramRegistry::problem(spec);
+        if (!problem.empty()) {
+            throw cms::Exception("Configuration") << "FatJetAnalyzer: histogram '" << spec.name << "': " << problem;
+        }
+        specs.push_back(spec);
+    }
+    return specs;
+}
+
+// An empty range (min == max) is left out of the PSet, see
+// parseHistogramSpecs.
+template <typename Input>
+edm::ParameterSet FatJetAnalyzerT<Input>::histogramPSet(const fatjet::HistogramSpec& spec) {
+    edm::ParameterSet pset;
+    pset.addParameter<std::string>("name", spec.name);
+    pset.addParameter<std::string>("title", spec.title);
+    pset.addParameter<std::string>("x", spec.x);
+    pset.addParameter<std::string>("y", spec.y);
+    pset.addParameter<int>("nBinsX", spec.nBinsX);
+    if (spec.xMin != spec.xMax) {
+        pset.addParameter<double>("xMin", spec.xMin);
+        pset.addParameter<double>("xMax", spec.xMax);
+    }
+    pset.addParameter<int>("nBinsY", spec.nBinsY);
+    if (!spec.y.empty() && spec.yMin != spec.yMax) {
+        pset.addParameter<double>("yMin", spec.yMin);
+        pset.addParameter<double>("yMax", spec.yMax);
+    }
+    return pset;
+}
 
-void FatJetAnalyzer::fillDescriptions(edm::ConfigurationDescriptions& descriptions) {
+template <typename Input>
+void FatJetAnalyzerT<Input>::fillDescriptions(edm::ConfigurationDescriptions& descriptions) {
     edm::ParameterSetDescription desc;
     desc.add<bool>("saveHistograms", true);
+    edm::ParameterSetDescription histogram;
+    histogram.add<std::string>("name");
+    histogram.add<std::string>("title", "");
+    histogram.add<std::string>("x")->setComment("jet observable: fj_pt, fj_eta, fj_phi, fj_mass, fj_nConstituents, "
+                                                "fj_msoftdrop, fj_tau1..3, fj_tau21, fj_tau32, fj_n2, fj_d2; "
+                                                "or constituent observable: pf_pt, pf_eta, pf_phi, pf_deta, pf_dphi, "
+                                                "pf_ptFraction");
+    histogram.add<std::string>("y", "")->setComment("observable of the same kind as x for a TH2F; empty: TH1F");
+    histogram.add<int>("nBinsX", 100);
+    histogram.addOptional<double>("xMin")->setComment("required but for fj_pt, default minFatJetPt");
+    histogram.addOptional<double>("xMax")->setComment("required but for fj_pt, default xMin + 1000");
+    histogram.add<int>("nBinsY", 100);
+    histogram.addOptional<double>("yMin")->setComment("as xMin, for a TH2F");
+    histogram.addOptional<double>("yMax")->setComment("as xMax, for a TH2F");
+    // The histograms the analyzer always had. The pT ranges are left out
+    // (min == max), so they start at minFatJetPt.
+    const std::vector<fatjet::HistogramSpec> defaultHistograms = {
+        {"hFatJetPt", "FatJet p_{T} (p_{T} > minPt);p_{T} [GeV];FatJets", "fj_pt", "", 100, 0., 0.},
+        {"hFatJetEta", "FatJet #eta;#eta;FatJets", "fj_eta", "", 100, -5., 5.},
+        {"hFatJetPhi", "FatJet #phi;#phi;FatJets", "fj_phi", "", 100, -3.1416, 3.1416},
+        {"hFatJetMass", "FatJet mass;Mass [GeV];FatJets", "fj_mass", "", 100, 0., 500.},
+        {"hFatJetNConstituents", "FatJet constituents;N_{constituents};FatJets", "fj_nConstituents", "", 100, 0., 200.},
+        {"hFatJetEtaVsPhi", "FatJet #eta vs #phi;#eta;#phi", "fj_eta", "fj_phi", 100, -5., 5., 100, -3.1416, 3.1416},
+        {"hFatJetPtVsEta", "FatJet p_{T} vs #eta;p_{T} [GeV];#eta", "fj_pt", "fj_eta", 100, 0., 0., 100, -5., 5.},
+        {"hFatJetConstituentPtVsEta", "FatJet constituent p_{T} vs #eta;p_{T} [GeV];#eta", "pf_pt", "pf_eta", 100, 0.,
+         200., 100, -5., 5.},
+    };
+    std::vector<edm::ParameterSet> histograms;
+    for (const auto& spec : defaultHistograms) histograms.push_back(histogramPSet(spec));
+    desc.addVPSet("histograms", histogram, histograms)
+        ->setComment("histograms filled when saveHistograms is set; the substructure observables stay at -1 "
+                     "without saveFeatureTree");
     desc.add<bool>("saveTree", true);
+    desc.add<std::string>("treeFile", "")
+        ->setComment("file of FatJetAnalyzer_AOD and FatJetTree, written by this module (the streams fill them "
+                     "concurrently, which the TFileService file does not allow); empty: the TFileService file "
+                     "name with '_trees' before '.root'");
+    desc.add<std::string>("outputFormat", "vector")
+        ->setComment("'vector': std::vector branches; 'columnar': nFatJet/nPF counters, "
+                     "leaf-list C-arrays and per-jet offsets into the pf_* arrays");
+    desc.add<bool>("saveFeatureTree", true)
+        ->setComment("per-jet FatJetTree with the tagging features (IP, PUPPI, N-subjettiness)");
+    desc.add<bool>("saveImages", false)
+        ->setComment("write a pT-fraction jet image per jet in FatJetTree");
+    desc.add<std::string>("imageFormat", "dense")
+        ->setComment("'dense': fj_image[imagePixels^2]; 'sparse': the lit pixels only, as fj_image_index "
+                     "(flat pixel) and fj_image_value vectors");
+    desc.add<int>("imagePixels", 33);
+    desc.add<double>("imageHalfWidth", 0.8)->setComment("half size of the image in eta and phi");
+    desc.add<bool>("imageRotate", true)->setComment("align the principal axis with eta");
+    desc.add<bool>("imageFlip", true)->setComment("put the hardest half-planes at positive eta/phi");
+    desc.add<bool>("savePointCloud", false)
+        ->setComment("pT-ordered point cloud per jet in FatJetTree: pc_deta, pc_dphi, pc_logpt, pc_loge, "
+                     "pc_charge, pc_pdgclass, pc_puppi");
+    desc.add<int>("pointCloudMaxPoints", 0)
+        ->setComment("0: ragged vectors of all the constituents; > 0: the hardest N, as zero-padded pc_*[N] arrays");
+    desc.add<bool>("computeSubstructure", false)
+        ->setComment("compute fj_tau1..3 (exclusive-kT axes), fj_msoftdrop and, with ecfMaxConstituents > 1, "
+                     "fj_n2 and fj_d2 from the constituents instead of reading the softDropMassMap/tau*Map "
+                     "products (AOD) or the jet userFloats (MiniAOD); costs about 0.3 ms per jet, 0.5 ms "
+                     "with N2/D2 on 100 constituents");
+    desc.add<double>("nsubjettinessBeta", 1.0);
+    desc.add<double>("nsubjettinessR0", 0.8);
+    desc.add<double>("softDropZCut", 0.1);
+    desc.add<double>("softDropBeta", 0.0);
+    desc.add<double>("softDropR0", 0.8);
+    desc.add<double>("ecfBeta", 1.0)->setComment("angular exponent of N2 and D2");
+    desc.add<int>("ecfMaxConstituents", 0)
+        ->setComment("N2/D2 on the hardest groomed constituents only, the cost grows as the cube; "
+                     "< 2: not computed, fj_n2 and fj_d2 stay -1");
+    desc.add<bool>("profile", false)
+        ->setComment("time the analyze phases, count constituents and tree bytes; "
+                     "summary in the log and in the FatJetAnalyzerProfile tree at endJob");
+    desc.add<int>("bufferTrimInterval", 1000)
+        ->setComment("events between shrinks of the per-stream branch buffers to the recent peak need; "
+                     "0: keep the largest capacity seen");
+    desc.add<bool>("asyncTreeWriter", false)
+        ->setComment("fill the trees in TBB tasks, one event at a time; analyze() only queues the event's buffers");
+    desc.add<int>("asyncQueueDepth", 8)
+        ->setComment("events queued for the background writer before a stream waits; each holds its buffers");
+    desc.add<std::string>("compressionAlgorithm", "")
+        ->setComment("'ZLIB', 'LZMA', 'LZ4' or 'ZSTD' for the tree branches; empty: the TFileService file's");
+    desc.add<int>("compressionLevel", -1)->setComment("0-9; -1: the algorithm's default");
+    desc.add<int>("basketSize", 0)->setComment("bytes per branch basket; 0: ROOT default");
+    desc.add<int>("autoFlush", 0)
+        ->setComment("> 0: entries, < 0: bytes between basket flushes (TTree::SetAutoFlush); 0: ROOT default");
+    desc.add<bool>("parallelCompression", true)
+        ->setComment("compress the baskets of a Fill in parallel (TTree::SetImplicitMT) when ROOT IMT is on");
+    desc.add<std::string>("defaultPrecision", "full")
+        ->setComment("stored precision of the float branches: 'full', 'truncate:N' (N mantissa bits), "
+                     "'quantize:min:max:N' (N-bit fixed point), 'float16:N' or 'float16:min:max:N' "
+                     "(Float16_t on leaf-list branches, the same rounding in place on vectors)");
+    edm::ParameterSetDescription branchPrecision;
+    branchPrecision.addWildcard<std::string>("*")->setComment("branch name = precision, as defaultPrecision");
+    desc.add<edm::ParameterSetDescription>("branchPrecision", branchPrecision)
+        ->setComment("per-branch overrides of defaultPrecision, e.g. pfc_dz_error = 'truncate:10'");
     desc.add<double>("minFatJetPt", 150.0);
-    desc.add<edm::InputTag>("fatjets", edm::InputTag("ak8PFJetsPuppi"));
-    descriptions.add("fatJetAnalyzer", desc);
+    desc.add<int>("signalLabel", 0)->setComment("stored as fj_label, e.g. 1 = WL, 2 = WT");
+    desc.add<edm::InputTag>("fatjets", edm::InputTag(Input::kDefaultJets));
+    desc.add<edm::InputTag>("vertices", edm::InputTag(Input::kDefaultVertices))
+        ->setComment("origin of pfc_dxy/pfc_dz; empty: (0, 0, 0)");
+    Input::fillDescriptions(desc);
+    descriptions.add(Input::kModuleLabel, desc);
 }
 
-void FatJetAnalyzer::beginJob() {
+// The tree file takes the compression of the TFileService file and the same
+// layout, the trees in a directory named after the module label, so the
+// readers find them at the same path.
+template <typename Input>
+void FatJetAnalyzerT<Input>::openTreeFile() {
     edm::Service<TFileService> fs;
+    std::string name = treeFileName_;
+    if (name.empty()) {
+        name = fs->file().GetName();
+        const size_t suffix = name.rfind(".root");
+        name.insert(suffix != std::string::npos ? suffix : name.size(), "_trees");
+    }
+    treeFile_.reset(TFile::Open(name.c_str(), "RECREATE", "", fs->file().GetCompressionSettings()));
+    if (treeFile_ == nullptr || treeFile_->IsZombie()) {
+        throw cms::Exception("FileOpenError") << "FatJetAnalyzer: cannot create the tree file '" << name << "'";
+    }
+    treeFile_->mkdir(moduleDescription().moduleLabel().c_str())->cd();
+}
+
+template <typename Input>
+void FatJetAnalyzerT<Input>::beginJob() {
+    // The trees attach to gDirectory, the module directory of treeFile_.
+    TDirectory::TContext context;
+    if (saveTree_ || saveFeatureTree_) openTreeFile();
 
     if (saveTree_) {
-        eventTree_ = fs->make<TTree>("FatJetAnalyzer_AOD", "FatJet and PF Candidate information");
+        eventTree_ = new TTree("FatJetAnalyzer_AOD", "FatJet and PF Candidate information");
 
-        eventTree_->Branch("fatjet_pt", &fatjet_pt_);
-        eventTree_->Branch("fatjet_eta", &fatjet_eta_);
-        eventTree_->Branch("fatjet_phi", &fatjet_phi_);
-        eventTree_->Branch("fatjet_mass", &fatjet_mass_);
-        eventTree_->Branch("fatjet_Idx", &fatjet_Idx_);
+        treeBranches_.book(eventTree_, outputFormat_, precision_);
+    }
 
-        eventTree_->Branch("pf_pt", &pf_pt_);
-        eventTree_->Branch("pf_eta", &pf_eta_);
-        eventTree_->Branch("pf_phi", &pf_phi_);
-        eventTree_->Branch("pf_IdxFatJet", &pf_IdxFatJet_);
+    if (saveFeatureTree_) {
+        fatJetTree_ = new TTree("FatJetTree", "Per-jet tagging features");
+        fatjet::FeatureTreeLayout layout;
+        layout.imageSize = saveImages_ && !sparseImages_ ? imageConfig_.nPixels * imageConfig_.nPixels : 0;
+        layout.sparseImage = saveImages_ && sparseImages_;
+        layout.pointCloud = savePointCloud_;
+        layout.pointCloudSize = pointCloudMaxPoints_;
+        featureBranches_.book(fatJetTree_, layout, precision_);
+    }
+    for (TTree* tree : {eventTree_, fatJetTree_}) {
+        if (tree != nullptr) fatjet::configureTree(tree, treeOutputConfig_);
+    }
+    if (asyncTreeWriter_ && (saveTree_ || saveFeatureTree_)) {
+        asyncWriter_ = std::make_unique<fatjet::AsyncTreeWriter>(
+            asyncQueueDepth_, [this](fatjet::TreeFillBatch& batch) {
+                return fillTrees(batch.columns, batch.featureRows, batch.nFeatureRows);
+            });
     }
 
     if (saveHistograms_) {
@@ -118,44 +380,106 @@ void FatJetAnalyzer::beginJob() {
     }
 }
 
-void FatJetAnalyzer::initializeHistograms() {
+template <typename Input>
+void FatJetAnalyzerT<Input>::initializeHistograms() {
     edm::Service<TFileService> fs;
+    histograms_ = fatjet::HistogramRegistry(histogramSpecs_, [&fs](const fatjet::HistogramSpec& spec) -> TH1* {
+        if (spec.y.empty()) {
+            return fs->make<TH1F>(spec.name.c_str(), spec.title.c_str(), spec.nBinsX, spec.xMin, spec.xMax);
+        }
+        return fs->make<TH2F>(spec.name.c_str(), spec.title.c_str(), spec.nBinsX, spec.xMin, spec.xMax,
+                              spec.nBinsY, spec.yMin, spec.yMax);
+    });
+}
 
-    hFatJetPt_ = fs->make<TH1F>("hFatJetPt", "FatJet p_{T} (p_{T} > minPt);p_{T} [GeV];FatJets",
-                              100, minFatJetPt_, 1000 + minFatJetPt_);
-    hFatJetEta_ = fs->make<TH1F>("hFatJetEta", "FatJet #eta;#eta;FatJets",
-                               100, -5, 5);
-    hFatJetPhi_ = fs->make<TH1F>("hFatJetPhi", "FatJet #phi;#phi;FatJets",
-                               100, -3.1416, 3.1416);
-    hFatJetMass_ = fs->make<TH1F>("hFatJetMass", "FatJet mass;Mass [GeV];FatJets",
-                                100, 0, 500);
-    hFatJetNConstituents_ = fs->make<TH1F>("hFatJetNConstituents", "FatJet constituents;N_{constituents};FatJets",
-                                         100, 0, 200);
-
-    hFatJetEtaVsPhi_ = fs->make<TH2F>("hFatJetEtaVsPhi", "FatJet #eta vs #phi;#eta;#phi",
-                                    100, -5, 5, 100, -3.1416, 3.1416);
-    hFatJetPtVsEta_ = fs->make<TH2F>("hFatJetPtVsEta", "FatJet p_{T} vs #eta;p_{T} [GeV];#eta",
-                                   100, minFatJetPt_, 1000 + minFatJetPt_, 100, -5, 5);
-    hFatJetConstituentPtVsEta_ = fs->make<TH2F>("hFatJetConstituentPtVsEta",
-                                               "FatJet constituent p_{T} vs #eta;p_{T} [GeV];#eta",
-                                               100, 0, 200, 100, -5, 5);
-}
-
-void FatJetAnalyzer::analyze(const edm::Event& iEvent, const edm::EventSetup& iSetup) {
-    if (saveTree_) {
-        fatjet_pt_.clear();
-        fatjet_eta_.clear();
-        fatjet_phi_.clear();
-        fatjet_mass_.clear();
-        fatjet_Idx_.clear();
-
-        pf_pt_.clear();
-        pf_eta_.clear();
-        pf_phi_.clear();
-        pf_IdxFatJet_.clear();
+template <typename Input>
+std::unique_ptr<fatjet::StreamCache> FatJetAnalyzerT<Input>::beginStream(edm::StreamID) const {
+    auto cache = std::make_unique<fatjet::StreamCache>();
+    cache->imageBuilder = fatjet::JetImageBuilder(imageConfig_);
+    cache->pointCloud = fatjet::PointCloudBuilder(pointCloudMaxPoints_);
+    cache->substructure = fatjet::SubstructureEngine(substructureConfig_);
+    cache->buffers = fatjet::BranchBufferManager(outputFormat_, saveTree_, bufferTrimInterval_);
+    if (saveHistograms_) {
+        // Clone() registers the copy in gDirectory, so serialize it.
+        std::lock_guard<std::mutex> guard(histogramMutex_);
+        cache->histograms = histograms_.clone();
     }
+    return cache;
+}
 
-    edm::Handle<reco::PFJetCollection> fatjets;
+template <typename Input>
+typename Input::Products FatJetAnalyzerT<Input>::fetchProducts(const edm::Event& iEvent) const {
+    Products products;
+    const reco::VertexCollection* vertices = fatjet::productOrNull(iEvent, verticesToken_);
+    if (vertices != nullptr && !vertices->empty()) products.primaryVertex = &vertices->front();
+    input_.fetch(iEvent, products);
+    return products;
+}
+
+// Walks the constituents of the jet once, through the Candidate interface,
+// so that no temporary std::vector of Ptrs is built. The tagging features
+// are appended in the same pass when a row is given.
+template <typename Input>
+void FatJetAnalyzerT<Input>::gatherConstituents(const Jet& fatjet,
+                                                const Products& products,
+                                                JetConstituentSoA& constituents,
+                                                fatjet::JetFeatureRow* featureRow) const {
+    Input::forEachConstituent(fatjet, [&](const reco::CandidatePtr& constituent) {
+        const reco::Candidate::PolarLorentzVector p4 = input_.p4(constituent, products);
+        constituents.push_back(p4.pt(), p4.eta(), p4.phi(), p4.mass());
+        if (featureRow != nullptr) appendConstituentFeatures(fatjet, constituent, p4, products, *featureRow);
+    });
+    constituents.closeJet();
+}
+
+template <typename Input>
+void FatJetAnalyzerT<Input>::appendConstituentFeatures(const Jet& fatjet,
+                                                       const reco::CandidatePtr& constituent,
+                                                       const reco::Candidate::PolarLorentzVector& p4,
+                                                       const Products& products,
+                                                       fatjet::JetFeatureRow& row) const {
+    const reco::Candidate& cand = *constituent;
+    row.pfc_pt.push_back(p4.pt());
+    row.pfc_eta.push_back(p4.eta());
+    row.pfc_phi.push_back(p4.phi());
+    row.pfc_energy.push_back(p4.energy());
+    row.pfc_mass.push_back(p4.mass());
+    row.pfc_etarel.push_back(p4.eta() - fatjet.eta());
+    row.pfc_phirel.push_back(reco::deltaPhi(p4.phi(), fatjet.phi()));
+    row.pfc_pdgId.push_back(cand.pdgId());
+    row.pfc_charge.push_back(cand.charge());
+    row.pfc_puppiWeight.push_back(input_.puppiWeight(constituent, products));
+    row.pfc_puppiWeightNoLep.push_back(input_.puppiWeightNoLep(constituent, products));
+
+    const reco::Vertex::Point origin = products.primaryVertex != nullptr ? products.primaryVertex->position()
+                                                                         : reco::Vertex::Point(0, 0, 0);
+    const fatjet::TrackFeatures track = Input::trackFeatures(cand, origin);
+    row.pfc_dxy.push_back(track.dxy);
+    row.pfc_dz.push_back(track.dz);
+    row.pfc_dxy_error.push_back(track.dxyError);
+    row.pfc_dz_error.push_back(track.dzError);
+    row.pfc_numberOfValidHits.push_back(track.numberOfValidHits);
+    row.pfc_normalizedChi2.push_back(track.normalizedChi2);
+}
+
+template <typename Input>
+void FatJetAnalyzerT<Input>::analyze(edm::StreamID streamID, const edm::Event& iEvent, const edm::EventSetup& iSetup) const {
+    fatjet::StreamCache& cache = *streamCache(streamID);
+    fatjet::EventColumns& columns = cache.columns;
+    fatjet::HistogramRegistry& histograms = cache.histograms;
+    JetConstituentSoA& constituents = columns.constituents;
+    columns.clear();
+    cache.nFeatureRows = 0;
+
+    fatjet::ProfileStats* profile = profile_ ? &cache.profile : nullptr;
+    fatjet::PhaseTimer fetchTimer(profile, fatjet::kFetch);
+    fatjet::PhaseTimer constituentTimer(profile, fatjet::kConstituents);
+    fatjet::PhaseTimer substructureTimer(profile, fatjet::kSubstructure);
+    fatjet::PhaseTimer histogramTimer(profile, fatjet::kHistograms);
+    fatjet::PhaseTimer treeTimer(profile, fatjet::kTreeFill);
+
+    fetchTimer.start();
+    edm::Handle<JetCollection> fatjets;
     iEvent.getByToken(fatjetsToken_, fatjets);
 
     if (!fatjets.isValid()) {
@@ -165,53 +489,290 @@ void FatJetAnalyzer::analyze(const edm::Event& iEvent, const edm::EventSetup& iS
         return;
     }
 
+    // The daughters of the selected jets bound the constituents gathered
+    // below, so the buffers are sized once, before the loop.
+    size_t nSelected = 0;
+    size_t nDaughters = 0;
+    for (const Jet& fatjet : *fatjets) {
+        if (fatjet.pt() < minFatJetPt_) continue;
+        ++nSelected;
+        nDaughters += Input::maxConstituents(fatjet);
+    }
+
+    // Vertices and ValueMaps are fetched once and shared by all jets, and
+    // only when a jet passes: they are not even read for the other events.
+    // Without the feature tree only the PUPPI weights are consumed.
+    const Products products = nSelected > 0 ? fetchProducts(iEvent) : Products();
+    fetchTimer.stop();
+
+    cache.buffers.prepare(columns, nSelected, nDaughters, profile);
+
     int currentFatJetIndex = 0;
 
-    for (const auto& fatjet : *fatjets) {
+    for (size_t iJet = 0; iJet < fatjets->size(); ++iJet) {
+        const Jet& fatjet = (*fatjets)[iJet];
         if (fatjet.pt() < minFatJetPt_) continue;
 
+        constituentTimer.start();
+        fatjet::JetFeatureRow* featureRow = nullptr;
+        if (saveFeatureTree_) {
+            if (cache.nFeatureRows == cache.featureRows.size()) cache.featureRows.emplace_back();
+            featureRow = &cache.featureRows[cache.nFeatureRows];
+            featureRow->clear();
+            cache.buffers.prepare(*featureRow, cache.nFeatureRows++, Input::maxConstituents(fatjet), profile);
+
+            featureRow->fj_pt = fatjet.pt();
+            featureRow->fj_eta = fatjet.eta();
+            featureRow->fj_phi = fatjet.phi();
+            featureRow->fj_mass = fatjet.mass();
+            if (!computeSubstructure_) input_.readSubstructure(fatjets, iJet, products, *featureRow);
+            featureRow->fj_label = signalLabel_;
+        }
+
+        gatherConstituents(fatjet, products, constituents, featureRow);
+        const int first = constituents.begin(currentFatJetIndex);
+        const int last = constituents.end(currentFatJetIndex);
+        if (featureRow != nullptr) {
+            featureRow->fj_nConstituents = last - first;
+            if (saveImages_ && sparseImages_) {
+                cache.imageBuilder.buildSparse(constituents.pt.data() + first, constituents.eta.data() + first,
+                                               constituents.phi.data() + first, last - first, fatjet.eta(),
+                                               fatjet.phi(), featureRow->fj_image_index, featureRow->fj_image_value);
+            } else if (saveImages_) {
+                fatjet::JetImageBuilder& builder = cache.imageBuilder;
+                featureRow->fj_image.resize(builder.size());
+                builder.build(constituents.pt.data() + first, constituents.eta.data() + first,
+                              constituents.phi.data() + first, last - first,
+                              fatjet.eta(), fatjet.phi(), featureRow->fj_image.data());
+            }
+            if (savePointCloud_) fillPointCloud(cache.pointCloud, *featureRow);
+        }
+
         if (saveTree_) {
-            fatjet_pt_.push_back(fatjet.pt());
-            fatjet_eta_.push_back(fatjet.eta());
-            fatjet_phi_.push_back(fatjet.phi());
-            fatjet_mass_.push_back(fatjet.mass());
-            fatjet_Idx_.push_back(currentFatJetIndex);
-
-            // Corrected loop for constituents: use edm::Ptr<reco::PFCandidate>
-            for (const edm::Ptr<reco::PFCandidate>& constituentPtr : fatjet.getPFConstituents()) {
-                if (constituentPtr.isNull()) continue;
-
-                pf_pt_.push_back(constituentPtr->pt());
-                pf_eta_.push_back(constituentPtr->eta());
-                pf_phi_.push_back(constituentPtr->phi());
-                pf_IdxFatJet_.push_back(currentFatJetIndex);
+            columns.fatjet_pt.push_back(fatjet.pt());
+            columns.fatjet_eta.push_back(fatjet.eta());
+            columns.fatjet_phi.push_back(fatjet.phi());
+            columns.fatjet_mass.push_back(fatjet.mass());
+            if (outputFormat_ == fatjet::OutputFormat::kColumnar) {
+                columns.fatjet_nPF.push_back(last - first);
+            } else {
+                columns.fatjet_Idx.push_back(currentFatJetIndex);
+                columns.pf_IdxFatJet.insert(columns.pf_IdxFatJet.end(), last - first, currentFatJetIndex);
             }
         }
+        constituentTimer.stop();
+
+        if (featureRow != nullptr && computeSubstructure_) {
+            substructureTimer.start();
+            const fatjet::SubstructureResult substructure = cache.substructure.compute(
+                constituents.pt.data() + first, constituents.eta.data() + first, constituents.phi.data() + first,
+                constituents.mass.data() + first, last - first);
+            featureRow->fj_tau1 = substructure.tau1;
+            featureRow->fj_tau2 = substructure.tau2;
+            featureRow->fj_tau3 = substructure.tau3;
+            featureRow->fj_msoftdrop = substructure.msoftdrop;
+            featureRow->fj_n2 = substructure.n2;
+            featureRow->fj_d2 = substructure.d2;
+            substructureTimer.stop();
+        }
 
         if (saveHistograms_) {
-            hFatJetPt_->Fill(fatjet.pt());
-            hFatJetEta_->Fill(fatjet.eta());
-            hFatJetPhi_->Fill(fatjet.phi());
-            hFatJetMass_->Fill(fatjet.mass());
-            hFatJetNConstituents_->Fill(fatjet.getPFConstituents().size());
-            hFatJetEtaVsPhi_->Fill(fatjet.eta(), fatjet.phi());
-            hFatJetPtVsEta_->Fill(fatjet.pt(), fatjet.eta());
-
-            // Corrected loop for constituents here as well
-            for (const edm::Ptr<reco::PFCandidate>& constituentPtr : fatjet.getPFConstituents()) {
-                if (constituentPtr.isNull()) continue;
-                hFatJetConstituentPtVsEta_->Fill(constituentPtr->pt(), constituentPtr->eta());
+            histogramTimer.start();
+            fatjet::JetRecord record;
+            record.pt = fatjet.pt();
+            record.eta = fatjet.eta();
+            record.phi = fatjet.phi();
+            record.mass = fatjet.mass();
+            record.nConstituents = last - first;
+            if (featureRow != nullptr) {
+                record.msoftdrop = featureRow->fj_msoftdrop;
+                record.tau1 = featureRow->fj_tau1;
+                record.tau2 = featureRow->fj_tau2;
+                record.tau3 = featureRow->fj_tau3;
+                record.n2 = featureRow->fj_n2;
+                record.d2 = featureRow->fj_d2;
             }
+            histograms.fillJet(record);
+            histograms.fillConstituents(constituents, first, last, record);
+            histogramTimer.stop();
         }
+        if (profile != nullptr) profile->constituentsPerJet.fill(last - first);
         currentFatJetIndex++;
     }
 
-    if (saveTree_ && !fatjet_pt_.empty()) {
-        eventTree_->Fill();
+    if (saveHistograms_) {
+        histogramTimer.start();
+        histograms.flush();
+        histogramTimer.stop();
+    }
+
+    // The async writer counts its bytes itself, they are added at endJob.
+    long long treeBytes = 0;
+    if (currentFatJetIndex > 0 && asyncWriter_ == nullptr) {
+        treeTimer.start();
+        treeBytes = fillTrees(columns, cache.featureRows, cache.nFeatureRows);
+        treeTimer.stop();
+    }
+    cache.buffers.finish(columns, cache.featureRows, cache.nFeatureRows, profile);
+
+    if (profile != nullptr) {
+        profile->events += 1;
+        profile->jets += currentFatJetIndex;
+        profile->constituents += constituents.size();
+        profile->constituentsPerEvent.fill(constituents.size());
+        profile->treeBytes += treeBytes;
+        size_t scratch = columns.capacityBytes();
+        for (const auto& row : cache.featureRows) scratch += row.capacityBytes();
+        profile->peakScratchBytes = std::max(profile->peakScratchBytes, scratch);
+    }
+
+    if (currentFatJetIndex > 0 && asyncWriter_ != nullptr) {
+        treeTimer.start();
+        submitTrees(cache);
+        treeTimer.stop();
+    }
+}
+
+// Sorted from the per-constituent columns of the row; the padding of the
+// fixed-size layout is added by the branches.
+template <typename Input>
+void FatJetAnalyzerT<Input>::fillPointCloud(fatjet::PointCloudBuilder& builder, fatjet::JetFeatureRow& row) const {
+    const int kept = builder.build(row.pfc_pt.data(), row.pfc_etarel.data(), row.pfc_phirel.data(),
+                                   row.pfc_energy.data(), row.pfc_charge.data(), row.pfc_pdgId.data(),
+                                   row.pfc_puppiWeight.data(), row.pfc_pt.size());
+    float* columns[fatjet::kNPointFeatures];
+    for (int f = 0; f < fatjet::kNPointFeatures; ++f) {
+        std::vector<float>& column = row.*fatjet::kPointCloudColumns[f].member;
+        column.resize(kept);
+        columns[f] = column.data();
+    }
+    builder.fillColumns(columns, kept);
+}
+
+// Returns the bytes filled into the trees, for the profile. Runs on the
+// stream, or in a task of the writer with asyncTreeWriter.
+template <typename Input>
+long long FatJetAnalyzerT<Input>::fillTrees(fatjet::EventColumns& columns, std::vector<fatjet::JetFeatureRow>& rows,
+                                           size_t nRows) const {
+    long long bytes = 0;
+    std::lock_guard<std::mutex> guard(treeMutex_);
+    if (saveTree_) bytes += treeBranches_.fill(columns);
+    for (size_t i = 0; i < nRows; ++i) {
+        bytes += featureBranches_.fill(rows[i]);
+    }
+    return bytes;
+}
+
+// Swaps the event's buffers with a free batch of the writer, so that the
+// stream goes on with the recycled capacity of an event already written.
+// Waits only when asyncQueueDepth events are still queued.
+template <typename Input>
+void FatJetAnalyzerT<Input>::submitTrees(fatjet::StreamCache& cache) const {
+    fatjet::TreeFillBatch* batch = asyncWriter_->acquire();
+    batch->columns.swap(cache.columns);
+    batch->featureRows.swap(cache.featureRows);
+    batch->nFeatureRows = cache.nFeatureRows;
+    asyncWriter_->submit(batch);
+}
+
+template <typename Input>
+void FatJetAnalyzerT<Input>::endStream(edm::StreamID streamID) const {
+    if (profile_) {
+        std::lock_guard<std::mutex> guard(profileMutex_);
+        profileTotal_.add(streamCache(streamID)->profile);
     }
+    if (!saveHistograms_) return;
+
+    std::lock_guard<std::mutex> guard(histogramMutex_);
+    histograms_.add(streamCache(streamID)->histograms);
 }
 
-void FatJetAnalyzer::endJob() {
+template <typename Input>
+void FatJetAnalyzerT<Input>::endJob() {
+    // Drains the queue before the trees are written.
+    if (asyncWriter_ != nullptr) {
+        asyncWriter_->stop();
+        profileTotal_.treeBytes += asyncWriter_->bytesWritten();
+    }
+    if (profile_) writeProfile();
+    if (treeFile_ != nullptr) {
+        // Close() deletes the trees.
+        treeFile_->Write();
+        treeFile_->Close();
+        treeFile_.reset();
+        eventTree_ = fatJetTree_ = nullptr;
+    }
+}
+
+// Summary of the instrumentation: a table in the log, the per-phase time and
+// multiplicity histograms and a one-entry FatJetAnalyzerProfile tree.
+template <typename Input>
+void FatJetAnalyzerT<Input>::writeProfile() const {
+    const fatjet::ProfileStats& stats = profileTotal_;
+    edm::Service<TFileService> fs;
+    TFileDirectory dir = fs->mkdir("profile");
+
+    const auto toTH1 = [&dir](const char* name, const char* title, const auto& hist) {
+        TH1F* h = dir.make<TH1F>(name, title, hist.nBins(), hist.lo, hist.hi);
+        for (int bin = 0; bin <= hist.nBins() + 1; ++bin) h->SetBinContent(bin, hist.counts[bin]);
+        h->SetEntries(std::accumulate(hist.counts.begin(), hist.counts.end(), 0.));
+    };
+
+    TTree* tree = dir.make<TTree>("FatJetAnalyzerProfile", "FatJetAnalyzer instrumentation summary");
+    long long events = stats.events, jets = stats.jets, constituents = stats.constituents;
+    long long treeBytes = stats.treeBytes;
+    long long zipBytes = 0;
+    long long peakScratchBytes = stats.peakScratchBytes;
+    // Buffer counters per 1000 events
+    const double perKiloEvent = events > 0 ? 1e3 / events : 0.;
+    double bufferGrowths = perKiloEvent * stats.bufferGrowths;
+    double bufferReallocations = perKiloEvent * stats.bufferReallocations;
+    double bufferTrims = perKiloEvent * stats.bufferTrims;
+    if (eventTree_ != nullptr) zipBytes += eventTree_->GetZipBytes();
+    if (fatJetTree_ != nullptr) zipBytes += fatJetTree_->GetZipBytes();
+    tree->Branch("events", &events, "events/L");
+    tree->Branch("jets", &jets, "jets/L");
+    tree->Branch("constituents", &constituents, "constituents/L");
+    tree->Branch("treeBytes", &treeBytes, "treeBytes/L");
+    tree->Branch("treeZipBytes", &zipBytes, "treeZipBytes/L");
+    tree->Branch("peakScratchBytes", &peakScratchBytes, "peakScratchBytes/L");
+    tree->Branch("bufferGrowthsPer1k", &bufferGrowths, "bufferGrowthsPer1k/D");
+    tree->Branch("bufferReallocationsPer1k", &bufferReallocations, "bufferReallocationsPer1k/D");
+    tree->Branch("bufferTrimsPer1k", &bufferTrims, "bufferTrimsPer1k/D");
+
+    std::array<long long, fatjet::kNPhases> calls = stats.calls;
+    std::array<double, fatjet::kNPhases> wall = stats.wallSeconds;
+    std::array<double, fatjet::kNPhases> cpu = stats.cpuSeconds;
+
+    edm::LogInfo log("FatJetAnalyzerProfile");
+    log << "FatJetAnalyzer profile: " << events << " events, " << jets << " jets, " << constituents
+        << " constituents, " << treeBytes << " tree bytes filled (" << zipBytes << " compressed so far), "
+        << "peak scratch " << peakScratchBytes << " bytes/stream\n"
+        << "branch buffers per 1k events: " << bufferGrowths << " columns grown before the jet loop, "
+        << bufferReallocations << " reallocated inside it, " << bufferTrims << " trimmed\n"
+        << std::setw(14) << "phase" << std::setw(12) << "calls" << std::setw(14) << "wall [ms]"
+        << std::setw(14) << "cpu [ms]" << std::setw(16) << "wall/evt [us]" << "\n";
+
+    for (int p = 0; p < fatjet::kNPhases; ++p) {
+        const std::string name = fatjet::phaseName(p);
+        tree->Branch((name + "_calls").c_str(), &calls[p], (name + "_calls/L").c_str());
+        tree->Branch((name + "_wall_s").c_str(), &wall[p], (name + "_wall_s/D").c_str());
+        tree->Branch((name + "_cpu_s").c_str(), &cpu[p], (name + "_cpu_s/D").c_str());
+
+        toTH1((name + "_wall").c_str(), (name + " wall time per call;log_{10}(t/#mus);Calls").c_str(),
+              stats.wallHist[p]);
+        toTH1((name + "_cpu").c_str(), (name + " CPU time per call;log_{10}(t/#mus);Calls").c_str(),
+              stats.cpuHist[p]);
+
+        log << std::setw(14) << name << std::setw(12) << calls[p] << std::setw(14) << std::fixed
+            << std::setprecision(2) << 1e3 * wall[p] << std::setw(14) << 1e3 * cpu[p] << std::setw(16)
+            << (events > 0 ? 1e6 * wall[p] / events : 0.) << "\n";
+    }
+    toTH1("constituentsPerJet", "Constituents per jet;N_{constituents};Jets", stats.constituentsPerJet);
+    toTH1("constituentsPerEvent", "Selected-jet constituents per event;N_{constituents};Events",
+          stats.constituentsPerEvent);
+    tree->Fill();
 }
 
-DEFINE_FWK_MODULE(FatJetAnalyzer);
\ No newline at end of file
+DEFINE_FWK_MODULE(FatJetAnalyzer);
+DEFINE_FWK_MODULE(FatJetMiniAODAnalyzer);
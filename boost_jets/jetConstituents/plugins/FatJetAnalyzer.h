@@ -2,13 +2,18 @@
 #define FatJetAnalyzer_h
 
 #include <memory>
+#include <map>
+#include <mutex>
 #include <vector>
 #include <string>
+#include "TFile.h"
 #include "TTree.h"
+#include "TH1F.h"
+#include "TH2F.h"
 
 // FWCore includes
 #include "FWCore/Framework/interface/Frameworkfwd.h"
-#include "FWCore/Framework/interface/one/EDAnalyzer.h"
+#include "FWCore/Framework/interface/global/EDAnalyzer.h"
 #include "FWCore/Framework/interface/Event.h"
 #include "FWCore/Framework/interface/MakerMacros.h"
 #include "FWCore/ParameterSet/interface/ParameterSet.h"
@@ -17,81 +22,155 @@
 #include "FWCore/Utilities/interface/InputTag.h"
 
 // Data formats
-#include "DataFormats/JetReco/interface/PFJet.h"
-#include "DataFormats/JetReco/interface/PFJetCollection.h"
-#include "DataFormats/ParticleFlowCandidate/interface/PFCandidate.h"
-#include "DataFormats/ParticleFlowCandidate/interface/PFCandidateFwd.h"
 #include "DataFormats/VertexReco/interface/Vertex.h"
 #include "DataFormats/VertexReco/interface/VertexFwd.h"
 #include "DataFormats/Math/interface/deltaPhi.h"
-#include "DataFormats/TrackReco/interface/Track.h"
-#include "DataFormats/Common/interface/ValueMap.h"
 
-class FatJetAnalyzer : public edm::one::EDAnalyzer<edm::one::SharedResources> {
+#include "AsyncTreeWriter.h"
+#include "FatJetInput.h"
+#include "JetConstituentSoA.h"
+#include "FatJetTreeColumns.h"
+#include "HistogramRegistry.h"
+#include "PrecisionPolicy.h"
+#include "JetImage.h"
+#include "JetPointCloud.h"
+#include "JetSubstructure.h"
+#include "FatJetProfiler.h"
+#include "BranchBufferManager.h"
+
+namespace fatjet {
+
+    // Everything a stream mutates while processing an event.
+    struct StreamCache {
+        EventColumns columns;
+        // Detached clone of the booked histograms, filled per event.
+        HistogramRegistry histograms;
+
+        // Rows of FatJetTree for the current event; only the first
+        // nFeatureRows are valid, the rest keep their capacity.
+        std::vector<JetFeatureRow> featureRows;
+        size_t nFeatureRows = 0;
+
+        JetImageBuilder imageBuilder;
+        PointCloudBuilder pointCloud;
+        SubstructureEngine substructure;
+
+        // Sizes columns and featureRows from each event's totals.
+        BranchBufferManager buffers;
+
+        ProfileStats profile;  // only filled when profile = True
+    };
+
+}  // namespace fatjet
+
+// Input is one of the policies of FatJetInput.h; the two modules below
+// differ only in the collections they read and write the same trees.
+template <typename Input>
+class FatJetAnalyzerT : public edm::global::EDAnalyzer<edm::StreamCache<fatjet::StreamCache>> {
 public:
-    explicit FatJetAnalyzer(const edm::ParameterSet&);
-    ~FatJetAnalyzer() override;
+    using Jet = typename Input::Jet;
+    using JetCollection = typename Input::JetCollection;
+    using Products = typename Input::Products;
+
+    explicit FatJetAnalyzerT(const edm::ParameterSet&);
+    ~FatJetAnalyzerT() override;
     static void fillDescriptions(edm::ConfigurationDescriptions& descriptions);
 
 private:
     void beginJob() override;
-    void analyze(const edm::Event&, const edm::EventSetup&) override;
+    std::unique_ptr<fatjet::StreamCache> beginStream(edm::StreamID) const override;
+    void analyze(edm::StreamID, const edm::Event&, const edm::EventSetup&) const override;
+    void endStream(edm::StreamID) const override;
     void endJob() override;
 
-    // Configuración
+    void initializeHistograms();
+    Products fetchProducts(const edm::Event& iEvent) const;
+    void gatherConstituents(const Jet& fatjet,
+                            const Products& products,
+                            JetConstituentSoA& constituents,
+                            fatjet::JetFeatureRow* featureRow) const;
+    void appendConstituentFeatures(const Jet& fatjet,
+                                   const reco::CandidatePtr& constituent,
+                                   const reco::Candidate::PolarLorentzVector& p4,
+                                   const Products& products,
+                                   fatjet::JetFeatureRow& row) const;
+    void fillPointCloud(fatjet::PointCloudBuilder& builder, fatjet::JetFeatureRow& row) const;
+    long long fillTrees(fatjet::EventColumns& columns, std::vector<fatjet::JetFeatureRow>& rows, size_t nRows) const;
+    void submitTrees(fatjet::StreamCache& cache) const;
+    void writeProfile() const;
+    void openTreeFile();
+
+    static fatjet::OutputFormat parseOutputFormat(const std::string& name);
+    static bool parseImageFormat(const std::string& name);
+    static fatjet::JetImageConfig parseImageConfig(const edm::ParameterSet& iConfig);
+    static fatjet::SubstructureConfig parseSubstructureConfig(const edm::ParameterSet& iConfig);
+    static fatjet::TreeOutputConfig parseTreeOutputConfig(const edm::ParameterSet& iConfig);
+    static fatjet::PrecisionPolicy parsePrecisionPolicy(const edm::ParameterSet& iConfig);
+    static std::vector<fatjet::HistogramSpec> parseHistogramSpecs(const edm::ParameterSet& iConfig);
+    static edm::ParameterSet histogramPSet(const fatjet::HistogramSpec& spec);
+
+    // Configuration
+    const bool saveHistograms_;
     const bool saveTree_;
+    const bool saveFeatureTree_;
+    const bool saveImages_;
+    const bool sparseImages_;
+    const bool savePointCloud_;
+    const int pointCloudMaxPoints_;
+    const bool profile_;
+    const bool computeSubstructure_;
+    const fatjet::JetImageConfig imageConfig_;
+    const fatjet::SubstructureConfig substructureConfig_;
+    const fatjet::OutputFormat outputFormat_;
+    const fatjet::TreeOutputConfig treeOutputConfig_;
+    const fatjet::PrecisionPolicy precision_;
+    const std::vector<fatjet::HistogramSpec> histogramSpecs_;
+    const bool asyncTreeWriter_;
+    const int asyncQueueDepth_;
     const double minFatJetPt_;
     const int signalLabel_;
-    
-    // InputTags almacenados para logging
-    const edm::InputTag fatjetsTag_ps_;
+    const int bufferTrimInterval_;
+    const std::string treeFileName_;
+
+    // InputTags kept for logging; an empty label disables the product
+    const edm::InputTag fatjetsInputTag_;
     const edm::InputTag verticesTag_ps_;
-    const edm::InputTag softDropMassMapTag_ps_;
-    const edm::InputTag tau1MapTag_ps_;
-    const edm::InputTag tau2MapTag_ps_;
-    const edm::InputTag tau3MapTag_ps_;
-    const edm::InputTag puppiWeightMapTag_ps_;      // NUEVO
-    const edm::InputTag puppiWeightNoLepMapTag_ps_; // NUEVO
-
-    // Tokens
-    edm::EDGetTokenT<reco::PFJetCollection> fatjetsToken_;
-    edm::EDGetTokenT<reco::VertexCollection> verticesToken_;
-    edm::EDGetTokenT<edm::ValueMap<float>> softDropMassToken_; 
-    edm::EDGetTokenT<edm::ValueMap<float>> tau1Token_;         
-    edm::EDGetTokenT<edm::ValueMap<float>> tau2Token_;         
-    edm::EDGetTokenT<edm::ValueMap<float>> tau3Token_;         
-    edm::EDGetTokenT<edm::ValueMap<float>> puppiWeightToken_;      // NUEVO
-    edm::EDGetTokenT<edm::ValueMap<float>> puppiWeightNoLepToken_; // NUEVO
 
+    // Tokens; the tier-specific ones are held by input_
+    const edm::EDGetTokenT<JetCollection> fatjetsToken_;
+    edm::EDGetTokenT<reco::VertexCollection> verticesToken_;
+    const Input input_;
 
-    // TTree y ramas
+    // Trees, shared by all streams. Each stream fills its own buffers and
+    // hands them to the branch holders under treeMutex_ only for the Fill.
+    // The trees live in a file of this module, not in the TFileService one:
+    // a global module cannot take the TFileService shared resource, and
+    // treeMutex_ only orders the Fill calls of this module.
+    std::unique_ptr<TFile> treeFile_;
+    TTree* eventTree_;
     TTree* fatJetTree_;
+    mutable fatjet::EventTreeBranches treeBranches_;
+    mutable fatjet::JetFeatureBranches featureBranches_;
+    mutable std::mutex treeMutex_;
+
+    // With asyncTreeWriter the streams only queue their buffers; the Fill
+    // calls run in TBB tasks of the writer, created at beginJob and drained
+    // at endJob.
+    std::unique_ptr<fatjet::AsyncTreeWriter> asyncWriter_;
 
-    // Variables del FatJet
-    float fj_pt_, fj_eta_, fj_phi_, fj_mass_;
-    float fj_msoftdrop_;
-    float fj_tau1_, fj_tau2_, fj_tau3_;
-    int fj_nConstituents_;
-    int fj_label_; 
-
-    // Variables de los constituyentes (vectores)
-    std::vector<float> pfc_pt_;
-    std::vector<float> pfc_eta_;
-    std::vector<float> pfc_phi_;
-    std::vector<float> pfc_energy_;
-    std::vector<float> pfc_mass_;
-    std::vector<float> pfc_etarel_;
-    std::vector<float> pfc_phirel_;
-    std::vector<float> pfc_dxy_;
-    std::vector<float> pfc_dz_;
-    std::vector<float> pfc_dxy_error_;
-    std::vector<float> pfc_dz_error_;
-    std::vector<int> pfc_pdgId_;
-    std::vector<int> pfc_charge_;
-    std::vector<int> pfc_numberOfValidHits_;
-    std::vector<float> pfc_normalizedChi2_;
-    std::vector<float> pfc_puppiWeight_;        
-    std::vector<float> pfc_puppiWeightNoLep_;  
+    // Histograms booked in the TFileService; the per-stream copies are added
+    // into them at endStream under histogramMutex_.
+    fatjet::HistogramRegistry histograms_;
+    mutable std::mutex histogramMutex_;
+
+    // Instrumentation merged from the streams at endStream, dumped at endJob.
+    mutable fatjet::ProfileStats profileTotal_;
+    mutable std::mutex profileMutex_;
 };
 
-#endif
\ No newline at end of file
+// AOD: reco::PFJets and reco::PFCandidates.
+using FatJetAnalyzer = FatJetAnalyzerT<fatjet::AODInput>;
+// MiniAOD: pat::Jets and pat::PackedCandidates.
+using FatJetMiniAODAnalyzer = FatJetAnalyzerT<fatjet::MiniAODInput>;
+
+#endif
@@ -0,0 +1,334 @@
+#ifndef FatJetInput_h
+#define FatJetInput_h
+
+#include <string>
+#include <vector>
+
+// FWCore includes
+#include "FWCore/Framework/interface/ConsumesCollector.h"
+#include "FWCore/Framework/interface/Event.h"
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/ParameterSet/interface/ParameterSetDescription.h"
+#include "FWCore/Utilities/interface/Exception.h"
+#include "FWCore/Utilities/interface/InputTag.h"
+
+// Data formats
+#include "DataFormats/Common/interface/Ref.h"
+#include "DataFormats/Common/interface/ValueMap.h"
+#include "DataFormats/JetReco/interface/PFJet.h"
+#include "DataFormats/JetReco/interface/PFJetCollection.h"
+#include "DataFormats/ParticleFlowCandidate/interface/PFCandidate.h"
+#include "DataFormats/PatCandidates/interface/Jet.h"
+#include "DataFormats/PatCandidates/interface/PackedCandidate.h"
+#include "DataFormats/TrackReco/interface/Track.h"
+#include "DataFormats/VertexReco/interface/Vertex.h"
+#include "DataFormats/VertexReco/interface/VertexFwd.h"
+
+#include "FatJetTreeColumns.h"
+
+// Input layer of FatJetAnalyzerT: what depends on the data tier.
+//
+// A policy names the jet collection type and reads, from its own products,
+// the jet-level substructure and the per-constituent PUPPI weights, track
+// features and kinematics. Everything else in the analyzer is shared.
+//
+//   AODInput      reco::PFJetCollection, reco::PFCandidate daughters,
+//                 PUPPI weights and substructure from ValueMaps
+//   MiniAODInput  pat::JetCollection, pat::PackedCandidate daughters,
+//                 PUPPI weights and IP/track information embedded in the
+//                 candidates, substructure from the jet userFloats
+namespace fatjet {
+
+    template <typename T>
+    edm::EDGetTokenT<T> consumesIfSet(edm::ConsumesCollector& iC, const edm::InputTag& tag) {
+        return tag.label().empty() ? edm::EDGetTokenT<T>() : iC.consumes<T>(tag);
+    }
+
+    template <typename T>
+    const T* productOrNull(const edm::Event& iEvent, const edm::EDGetTokenT<T>& token) {
+        if (token.isUninitialized()) return nullptr;
+        edm::Handle<T> handle = iEvent.getHandle(token);
+        return handle.isValid() ? handle.product() : nullptr;
+    }
+
+    template <typename Key>
+    float valueOr(const edm::ValueMap<float>* map, const Key& key, float fallback) {
+        if (map == nullptr || !map->contains(key.id())) return fallback;
+        return (*map)[key];
+    }
+
+    // Impact parameter and track quality of one constituent. Neutrals and
+    // candidates without a track keep the defaults.
+    struct TrackFeatures {
+        float dxy = 0.f;
+        float dz = 0.f;
+        float dxyError = -1.f;
+        float dzError = -1.f;
+        int numberOfValidHits = 0;
+        float normalizedChi2 = -1.f;
+    };
+
+    // Event products needed by the tagging features, fetched once per event
+    // and shared by every jet. A null pointer means "not configured or not
+    // in the input": the corresponding features keep their defaults. Each
+    // input policy extends it with its own products.
+    struct FeatureProducts {
+        const reco::Vertex* primaryVertex = nullptr;
+    };
+
+    class AODInput {
+    public:
+        using JetCollection = reco::PFJetCollection;
+        using Jet = reco::PFJet;
+
+        static constexpr const char* kModuleLabel = "fatJetAnalyzer";
+        static constexpr const char* kDefaultJets = "ak8PFJetsPuppi";
+        static constexpr const char* kDefaultVertices = "offlinePrimaryVertices";
+
+        struct Products : FeatureProducts {
+            const edm::ValueMap<float>* softDropMass = nullptr;
+            const edm::ValueMap<float>* tau1 = nullptr;
+            const edm::ValueMap<float>* tau2 = nullptr;
+            const edm::ValueMap<float>* tau3 = nullptr;
+            const edm::ValueMap<float>* puppiWeight = nullptr;
+            const edm::ValueMap<float>* puppiWeightNoLep = nullptr;
+        };
+
+        // The PUPPI weights scale the constituents, so they are consumed even
+        // without the feature tree; the rest only with it, and the
+        // substructure maps only when they are read instead of computed.
+        AODInput(const edm::ParameterSet& iConfig, edm::ConsumesCollector&& iC, bool features,
+                 bool substructureProducts) {
+            const auto valueMap = [&](const char* name) {
+                return consumesIfSet<edm::ValueMap<float>>(iC, iConfig.getParameter<edm::InputTag>(name));
+            };
+            puppiWeightToken_ = valueMap("puppiWeightMap");
+            if (!features) return;
+            if (substructureProducts) {
+                softDropMassToken_ = valueMap("softDropMassMap");
+                tau1Token_ = valueMap("tau1Map");
+                tau2Token_ = valueMap("tau2Map");
+                tau3Token_ = valueMap("tau3Map");
+            }
+            puppiWeightNoLepToken_ = valueMap("puppiWeightNoLepMap");
+        }
+
+        static void fillDescriptions(edm::ParameterSetDescription& desc) {
+            // Empty tags leave the corresponding features at their defaults.
+            desc.add<edm::InputTag>("softDropMassMap", edm::InputTag(""));
+            desc.add<edm::InputTag>("tau1Map", edm::InputTag(""));
+            desc.add<edm::InputTag>("tau2Map", edm::InputTag(""));
+            desc.add<edm::InputTag>("tau3Map", edm::InputTag(""));
+            desc.add<edm::InputTag>("puppiWeightMap", edm::InputTag(""))
+                ->setComment("also scales the constituent pT and mass, required in the input when set; "
+                             "empty for CHS jets");
+            desc.add<edm::InputTag>("puppiWeightNoLepMap", edm::InputTag(""));
+        }
+
+        // Fills everything but primaryVertex.
+        void fetch(const edm::Event& iEvent, Products& products) const {
+            products.softDropMass = productOrNull(iEvent, softDropMassToken_);
+            products.tau1 = productOrNull(iEvent, tau1Token_);
+            products.tau2 = productOrNull(iEvent, tau2Token_);
+            products.tau3 = productOrNull(iEvent, tau3Token_);
+            // The weights scale the constituents, so a configured map that is
+            // not in the input is an error (get() throws), not unweighted pT.
+            products.puppiWeight = puppiWeightToken_.isUninitialized() ? nullptr : &iEvent.get(puppiWeightToken_);
+            products.puppiWeightNoLep = productOrNull(iEvent, puppiWeightNoLepToken_);
+        }
+
+        void readSubstructure(const edm::Handle<JetCollection>& jets, size_t iJet, const Products& products,
+                              JetFeatureRow& row) const {
+            const edm::Ref<JetCollection> jetRef(jets, iJet);
+            row.fj_msoftdrop = valueOr(products.softDropMass, jetRef, -1.f);
+            row.fj_tau1 = valueOr(products.tau1, jetRef, -1.f);
+            row.fj_tau2 = valueOr(products.tau2, jetRef, -1.f);
+            row.fj_tau3 = valueOr(products.tau3, jetRef, -1.f);
+        }
+
+        // The daughters are the constituents. For ak8PFJetsPuppi they point
+        // back to the unweighted particleFlow candidates, see p4().
+        template <typename F>
+        static void forEachConstituent(const Jet& jet, F&& f) {
+            const size_t nDaughters = jet.numberOfDaughters();
+            for (size_t i = 0; i < nDaughters; ++i) {
+                const reco::CandidatePtr constituent = jet.daughterPtr(i);
+                if (constituent.isNull() || !constituent.isAvailable()) continue;
+                f(constituent);
+            }
+        }
+
+        static size_t maxConstituents(const Jet& jet) { return jet.numberOfDaughters(); }
+
+        // Scaled by the puppiWeightMap weight, as clustered into the PUPPI
+        // jets and as MiniAODInput does with the packed candidates.
+        reco::Candidate::PolarLorentzVector p4(const reco::CandidatePtr& constituent, const Products& products) const {
+            const reco::Candidate::PolarLorentzVector& p4 = constituent->polarP4();
+            if (products.puppiWeight == nullptr) return p4;
+            const float w = valueOr(products.puppiWeight, constituent, 1.f);
+            return reco::Candidate::PolarLorentzVector(w * p4.pt(), p4.eta(), p4.phi(), w * p4.mass());
+        }
+
+        float puppiWeight(const reco::CandidatePtr& constituent, const Products& products) const {
+            return valueOr(products.puppiWeight, constituent, 1.f);
+        }
+
+        float puppiWeightNoLep(const reco::CandidatePtr& constituent, const Products& products) const {
+            return valueOr(products.puppiWeightNoLep, constituent, 1.f);
+        }
+
+        // The track is resolved a single time and every feature is read from
+        // it.
+        static TrackFeatures trackFeatures(const reco::Candidate& cand, const reco::Vertex::Point& origin) {
+            TrackFeatures features;
+            const auto* pfCand = dynamic_cast<const reco::PFCandidate*>(&cand);
+            const reco::Track* track = pfCand != nullptr ? pfCand->bestTrack() : nullptr;
+            if (track == nullptr) return features;
+            features.dxy = track->dxy(origin);
+            features.dz = track->dz(origin);
+            features.dxyError = track->dxyError();
+            features.dzError = track->dzError();
+            features.numberOfValidHits = track->numberOfValidHits();
+            features.normalizedChi2 = track->normalizedChi2();
+            return features;
+        }
+
+    private:
+        edm::EDGetTokenT<edm::ValueMap<float>> softDropMassToken_;
+        edm::EDGetTokenT<edm::ValueMap<float>> tau1Token_;
+        edm::EDGetTokenT<edm::ValueMap<float>> tau2Token_;
+        edm::EDGetTokenT<edm::ValueMap<float>> tau3Token_;
+        edm::EDGetTokenT<edm::ValueMap<float>> puppiWeightToken_;
+        edm::EDGetTokenT<edm::ValueMap<float>> puppiWeightNoLepToken_;
+    };
+
+    class MiniAODInput {
+    public:
+        using JetCollection = pat::JetCollection;
+        using Jet = pat::Jet;
+
+        static constexpr const char* kModuleLabel = "fatJetMiniAODAnalyzer";
+        static constexpr const char* kDefaultJets = "slimmedJetsAK8";
+        static constexpr const char* kDefaultVertices = "offlineSlimmedPrimaryVertices";
+
+        // Everything else is embedded in the jets and candidates.
+        struct Products : FeatureProducts {};
+
+        MiniAODInput(const edm::ParameterSet& iConfig, edm::ConsumesCollector&&, bool, bool)
+            : applyPuppiWeights_(iConfig.getParameter<bool>("applyPuppiWeights")),
+              softDropMassUserFloat_(iConfig.getParameter<std::string>("softDropMassUserFloat")),
+              tauUserFloats_(iConfig.getParameter<std::vector<std::string>>("tauUserFloats")) {
+            if (tauUserFloats_.size() != 3) {
+                throw cms::Exception("Configuration")
+                    << "FatJetMiniAODAnalyzer: tauUserFloats needs the tau1, tau2 and tau3 names, got "
+                    << tauUserFloats_.size();
+            }
+        }
+
+        static void fillDescriptions(edm::ParameterSetDescription& desc) {
+            desc.add<bool>("applyPuppiWeights", true)
+                ->setComment("scale the packed candidates by their PUPPI weight, as clustered into the "
+                             "PUPPI jets; False for CHS jets");
+            desc.add<std::string>("softDropMassUserFloat", "ak8PFJetsPuppiSoftDropMass")
+                ->setComment("read when computeSubstructure = False; empty or missing: -1");
+            desc.add<std::vector<std::string>>("tauUserFloats",
+                                               {"NjettinessAK8Puppi:tau1", "NjettinessAK8Puppi:tau2",
+                                                "NjettinessAK8Puppi:tau3"});
+        }
+
+        void fetch(const edm::Event&, Products&) const {}
+
+        void readSubstructure(const edm::Handle<JetCollection>& jets, size_t iJet, const Products&,
+                              JetFeatureRow& row) const {
+            const Jet& jet = (*jets)[iJet];
+            row.fj_msoftdrop = userFloatOr(jet, softDropMassUserFloat_, -1.f);
+            row.fj_tau1 = userFloatOr(jet, tauUserFloats_[0], -1.f);
+            row.fj_tau2 = userFloatOr(jet, tauUserFloats_[1], -1.f);
+            row.fj_tau3 = userFloatOr(jet, tauUserFloats_[2], -1.f);
+        }
+
+        // The daughters of slimmedJetsAK8 are the soft-drop subjets plus the
+        // candidates groomed away; the subjets are unpacked one level so
+        // that only packed candidates come out, as for the AK4 jets.
+        template <typename F>
+        static void forEachConstituent(const Jet& jet, F&& f) {
+            const size_t nDaughters = jet.numberOfDaughters();
+            for (size_t i = 0; i < nDaughters; ++i) {
+                const reco::CandidatePtr daughter = jet.daughterPtr(i);
+                if (daughter.isNull() || !daughter.isAvailable()) continue;
+                const size_t nSub = daughter->numberOfDaughters();
+                if (nSub == 0) {
+                    f(daughter);
+                    continue;
+                }
+                for (size_t j = 0; j < nSub; ++j) {
+                    const reco::CandidatePtr constituent = daughter->daughterPtr(j);
+                    if (constituent.isNull() || !constituent.isAvailable()) continue;
+                    f(constituent);
+                }
+            }
+        }
+
+        static size_t maxConstituents(const Jet& jet) {
+            size_t n = 0;
+            for (size_t i = 0; i < jet.numberOfDaughters(); ++i) {
+                const reco::Candidate* daughter = jet.daughter(i);
+                n += daughter != nullptr && daughter->numberOfDaughters() > 0 ? daughter->numberOfDaughters() : 1;
+            }
+            return n;
+        }
+
+        // Packed candidates carry the unweighted four-momentum.
+        reco::Candidate::PolarLorentzVector p4(const reco::CandidatePtr& constituent, const Products&) const {
+            const reco::Candidate::PolarLorentzVector& p4 = constituent->polarP4();
+            const auto* packed = applyPuppiWeights_ ? asPacked(*constituent) : nullptr;
+            if (packed == nullptr) return p4;
+            const float w = packed->puppiWeight();
+            return reco::Candidate::PolarLorentzVector(w * p4.pt(), p4.eta(), p4.phi(), w * p4.mass());
+        }
+
+        float puppiWeight(const reco::CandidatePtr& constituent, const Products&) const {
+            const auto* packed = asPacked(*constituent);
+            return packed != nullptr ? packed->puppiWeight() : 1.f;
+        }
+
+        float puppiWeightNoLep(const reco::CandidatePtr& constituent, const Products&) const {
+            const auto* packed = asPacked(*constituent);
+            return packed != nullptr ? packed->puppiWeightNoLep() : 1.f;
+        }
+
+        // dxy/dz are packed for every charged candidate; the errors, hits and
+        // chi2 only exist with the track details (pT > 0.5 GeV or
+        // lostTracks), otherwise they keep the AOD defaults.
+        static TrackFeatures trackFeatures(const reco::Candidate& cand, const reco::Vertex::Point& origin) {
+            TrackFeatures features;
+            const pat::PackedCandidate* packed = asPacked(cand);
+            if (packed == nullptr || packed->charge() == 0) return features;
+            features.dxy = packed->dxy(origin);
+            features.dz = packed->dz(origin);
+            features.numberOfValidHits = packed->numberOfHits();
+            if (!packed->hasTrackDetails()) return features;
+            features.dxyError = packed->dxyError();
+            features.dzError = packed->dzError();
+            features.normalizedChi2 = packed->pseudoTrack().normalizedChi2();
+            return features;
+        }
+
+    private:
+        // pat::Jets made from AOD point to reco::PFCandidates instead.
+        static const pat::PackedCandidate* asPacked(const reco::Candidate& cand) {
+            return dynamic_cast<const pat::PackedCandidate*>(&cand);
+        }
+
+        static float userFloatOr(const Jet& jet, const std::string& name, float fallback) {
+            return !name.empty() && jet.hasUserFloat(name) ? jet.userFloat(name) : fallback;
+        }
+
+        const bool applyPuppiWeights_;
+        const std::string softDropMassUserFloat_;
+        std::vector<std::string> tauUserFloats_;
+    };
+
+}  // namespace fatjet
+
+#endif
@@ -0,0 +1,105 @@
+#include "FatJetPreFilter.h"
+
+#include <cmath>
+
+#include "FWCore/MessageLogger/interface/MessageLogger.h"
+#include "FWCore/ParameterSet/interface/ConfigurationDescriptions.h"
+#include "FWCore/ParameterSet/interface/ParameterSetDescription.h"
+#include "FWCore/Utilities/interface/Exception.h"
+#include "FWCore/Utilities/interface/RegexMatch.h"
+
+namespace {
+
+    // "HLT_AK8PFJet230_SoftDropMass40" as written in FatJet_Sel.py matches
+    // every version of the path; explicit versions and globs are kept.
+    std::string pathPattern(const std::string& name) {
+        if (edm::is_glob(name)) return name;
+        const size_t v = name.rfind("_v");
+        const bool versioned = v != std::string::npos && v + 2 < name.size() &&
+                               name.find_first_not_of("0123456789", v + 2) == std::string::npos;
+        return versioned ? name : name + "_v*";
+    }
+
+}  // namespace
+
+FatJetPreFilter::FatJetPreFilter(const edm::ParameterSet& iConfig) :
+    minLeadingJetPt_(iConfig.getParameter<double>("minLeadingJetPt")),
+    maxLeadingJetAbsEta_(iConfig.getParameter<double>("maxLeadingJetAbsEta")),
+    hltPaths_(iConfig.getParameter<std::vector<std::string>>("hltPaths")),
+    requireAllHLTPaths_(iConfig.getParameter<bool>("requireAllHLTPaths")),
+    fatjetsTag_(iConfig.getParameter<edm::InputTag>("fatjets")),
+    fatjetsToken_(consumes<edm::View<reco::Jet>>(fatjetsTag_)),
+    triggerResultsToken_(hltPaths_.empty()
+                             ? edm::EDGetTokenT<edm::TriggerResults>()
+                             : consumes<edm::TriggerResults>(iConfig.getParameter<edm::InputTag>("triggerResults")))
+{
+}
+
+void FatJetPreFilter::fillDescriptions(edm::ConfigurationDescriptions& descriptions) {
+    edm::ParameterSetDescription desc;
+    desc.add<edm::InputTag>("fatjets", edm::InputTag("ak8PFJetsPuppi"))->setComment("slimmedJetsAK8 on MiniAOD");
+    desc.add<double>("minLeadingJetPt", 150.0)->setComment("usually the minFatJetPt of FatJetAnalyzer");
+    desc.add<double>("maxLeadingJetAbsEta", 5.0);
+    desc.add<edm::InputTag>("triggerResults", edm::InputTag("TriggerResults", "", "HLT"));
+    desc.add<std::vector<std::string>>("hltPaths", std::vector<std::string>())
+        ->setComment("path names or globs; names without a version match every version (_v*). "
+                     "Empty: no trigger requirement");
+    desc.add<bool>("requireAllHLTPaths", true)
+        ->setComment("True: all paths must fire (FatJet_Sel.py); False: any of them");
+    descriptions.add("fatJetPreFilter", desc);
+}
+
+std::unique_ptr<fatjet::TriggerPathCache> FatJetPreFilter::beginStream(edm::StreamID) const {
+    return std::make_unique<fatjet::TriggerPathCache>();
+}
+
+void FatJetPreFilter::resolvePaths(fatjet::TriggerPathCache& cache, const edm::TriggerNames& names) const {
+    cache.menu = names.parameterSetID();
+    cache.pathIndices.assign(hltPaths_.size(), {});
+    for (size_t i = 0; i < hltPaths_.size(); ++i) {
+        for (const auto& match : edm::regexMatch(names.triggerNames(), pathPattern(hltPaths_[i]))) {
+            cache.pathIndices[i].push_back(names.triggerIndex(*match));
+        }
+        if (cache.pathIndices[i].empty()) {
+            edm::LogWarning("FatJetPreFilter") << "HLT path " << hltPaths_[i] << " is not in the trigger menu";
+        }
+    }
+}
+
+bool FatJetPreFilter::passTrigger(fatjet::TriggerPathCache& cache, const edm::Event& iEvent) const {
+    if (hltPaths_.empty()) return true;
+
+    edm::Handle<edm::TriggerResults> triggerResults = iEvent.getHandle(triggerResultsToken_);
+    if (!triggerResults.isValid()) {
+        throw cms::Exception("ProductNotFound") << "FatJetPreFilter: no TriggerResults, "
+                                                << "set hltPaths = [] to run without a trigger requirement";
+    }
+    const edm::TriggerNames& names = iEvent.triggerNames(*triggerResults);
+    if (names.parameterSetID() != cache.menu) resolvePaths(cache, names);
+
+    // A pattern fires if any of the path versions it matches accepted the event.
+    for (const auto& indices : cache.pathIndices) {
+        bool fired = false;
+        for (unsigned int index : indices) fired |= triggerResults->accept(index);
+        if (requireAllHLTPaths_ && !fired) return false;
+        if (!requireAllHLTPaths_ && fired) return true;
+    }
+    return requireAllHLTPaths_;
+}
+
+bool FatJetPreFilter::filter(edm::StreamID streamID, edm::Event& iEvent, const edm::EventSetup&) const {
+    // TriggerResults is tiny, so it goes first.
+    if (!passTrigger(*streamCache(streamID), iEvent)) return false;
+
+    edm::Handle<edm::View<reco::Jet>> fatjets = iEvent.getHandle(fatjetsToken_);
+    if (!fatjets.isValid()) {
+        throw cms::Exception("ProductNotFound") << "FatJetPreFilter: no jet collection " << fatjetsTag_.encode()
+                                                << ", check the fatjets tag";
+    }
+    for (const reco::Jet& fatjet : *fatjets) {
+        if (fatjet.pt() >= minLeadingJetPt_ && std::abs(fatjet.eta()) <= maxLeadingJetAbsEta_) return true;
+    }
+    return false;
+}
+
+DEFINE_FWK_MODULE(FatJetPreFilter);
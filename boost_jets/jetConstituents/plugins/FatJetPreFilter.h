@@ -0,0 +1,63 @@
+#ifndef FatJetPreFilter_h
+#define FatJetPreFilter_h
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// FWCore includes
+#include "FWCore/Framework/interface/Frameworkfwd.h"
+#include "FWCore/Framework/interface/global/EDFilter.h"
+#include "FWCore/Framework/interface/Event.h"
+#include "FWCore/Framework/interface/MakerMacros.h"
+#include "FWCore/Common/interface/TriggerNames.h"
+#include "FWCore/ParameterSet/interface/ParameterSet.h"
+#include "FWCore/Utilities/interface/InputTag.h"
+
+// Data formats
+#include "DataFormats/Common/interface/TriggerResults.h"
+#include "DataFormats/Common/interface/View.h"
+#include "DataFormats/JetReco/interface/Jet.h"
+#include "DataFormats/Provenance/interface/ParameterSetID.h"
+
+namespace fatjet {
+
+    // Trigger-result indices of the configured HLT paths for one menu. They
+    // are resolved again only when the menu (TriggerNames PSet ID) changes.
+    struct TriggerPathCache {
+        edm::ParameterSetID menu;
+        std::vector<std::vector<unsigned int>> pathIndices;  // per configured pattern
+    };
+
+}  // namespace fatjet
+
+// Cheap event selection in front of FatJetAnalyzer: the HLT bits of
+// FatJet_Sel.py and a leading jet above threshold. Only TriggerResults and
+// the jet collection are read, so events that fail never load the
+// constituents, vertices or ValueMaps. The jets are read as a View, so the
+// same module sits in front of FatJetAnalyzer (reco::PFJets) and
+// FatJetMiniAODAnalyzer (pat::Jets).
+class FatJetPreFilter : public edm::global::EDFilter<edm::StreamCache<fatjet::TriggerPathCache>> {
+public:
+    explicit FatJetPreFilter(const edm::ParameterSet&);
+    static void fillDescriptions(edm::ConfigurationDescriptions& descriptions);
+
+private:
+    std::unique_ptr<fatjet::TriggerPathCache> beginStream(edm::StreamID) const override;
+    bool filter(edm::StreamID, edm::Event&, const edm::EventSetup&) const override;
+
+    bool passTrigger(fatjet::TriggerPathCache& cache, const edm::Event& iEvent) const;
+    void resolvePaths(fatjet::TriggerPathCache& cache, const edm::TriggerNames& names) const;
+
+    // Configuration
+    const double minLeadingJetPt_;
+    const double maxLeadingJetAbsEta_;
+    const std::vector<std::string> hltPaths_;
+    const bool requireAllHLTPaths_;
+
+    const edm::InputTag fatjetsTag_;
+    const edm::EDGetTokenT<edm::View<reco::Jet>> fatjetsToken_;
+    const edm::EDGetTokenT<edm::TriggerResults> triggerResultsToken_;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef FatJetProfiler_h
+#define FatJetProfiler_h
+
+#include <time.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+
+namespace fatjet {
+
+    // Phases of FatJetAnalyzer::analyze that are timed when profile = True.
+    enum Phase : int { kFetch = 0, kConstituents, kSubstructure, kHistograms, kTreeFill, kNPhases };
+
+    inline const char* phaseName(int phase) {
+        static const char* const names[kNPhases] = {"fetch", "constituents", "substructure", "histograms", "treeFill"};
+        return names[phase];
+    }
+
+    // Fixed-binning histogram without ROOT, cheap to fill and to merge
+    // across streams. Log binning stores log10(x); bin 0 is the underflow,
+    // bin nBins + 1 the overflow, like TH1.
+    template <int NBins>
+    struct FixedHistogram {
+        double lo;
+        double hi;
+        bool logX;
+        std::array<double, NBins + 2> counts{};
+
+        FixedHistogram(double low, double high, bool logarithmic) : lo(low), hi(high), logX(logarithmic) {}
+
+        // The range is tested in double before the conversion to int, so a
+        // NaN (underflow) or a huge x (overflow) never reaches the cast.
+        void fill(double x) {
+            if (logX) x = x > 0 ? std::log10(x) : lo - 1;
+            int bin;
+            if (!(x >= lo)) bin = 0;
+            else if (x >= hi) bin = NBins + 1;
+            else bin = std::min(static_cast<int>((x - lo) / (hi - lo) * NBins) + 1, NBins);
+            counts[bin] += 1;
+        }
+
+        void add(const FixedHistogram& other) {
+            for (size_t i = 0; i < counts.size(); ++i) counts[i] += other.counts[i];
+        }
+
+        static constexpr int nBins() { return NBins; }
+    };
+
+    using TimeHistogram = FixedHistogram<80>;    // log10(microseconds), 0.01 us .. 1 s
+    using CountHistogram = FixedHistogram<100>;
+
+    // Per-stream (and, after endStream, per-job) instrumentation counters.
+    struct ProfileStats {
+        std::array<long long, kNPhases> calls{};
+        std::array<double, kNPhases> wallSeconds{};
+        std::array<double, kNPhases> cpuSeconds{};
+        std::array<TimeHistogram, kNPhases> wallHist = makeTimeHistograms();
+        std::array<TimeHistogram, kNPhases> cpuHist = makeTimeHistograms();
+
+        CountHistogram constituentsPerJet{0, 300, false};
+        CountHistogram constituentsPerEvent{0, 2000, false};
+
+        long long events = 0;
+        long long jets = 0;
+        long long constituents = 0;
+        long long treeBytes = 0;             // uncompressed bytes returned by TTree::Fill
+        size_t peakScratchBytes = 0;         // largest capacity held by the stream buffers
+
+        // BranchBufferManager: columns grown before the jet loop, columns
+        // that still reallocated inside it, and columns or rows trimmed.
+        long long bufferGrowths = 0;
+        long long bufferReallocations = 0;
+        long long bufferTrims = 0;
+
+        void add(const ProfileStats& other) {
+            for (int p = 0; p < kNPhases; ++p) {
+                calls[p] += other.calls[p];
+                wallSeconds[p] += other.wallSeconds[p];
+                cpuSeconds[p] += other.cpuSeconds[p];
+                wallHist[p].add(other.wallHist[p]);
+                cpuHist[p].add(other.cpuHist[p]);
+            }
+            constituentsPerJet.add(other.constituentsPerJet);
+            constituentsPerEvent.add(other.constituentsPerEvent);
+            events += other.events;
+            jets += other.jets;
+            constituents += other.constituents;
+            treeBytes += other.treeBytes;
+            peakScratchBytes = std::max(peakScratchBytes, other.peakScratchBytes);
+            bufferGrowths += other.bufferGrowths;
+            bufferReallocations += other.bufferReallocations;
+            bufferTrims += other.bufferTrims;
+        }
+
+    private:
+        static std::array<TimeHistogram, kNPhases> makeTimeHistograms() {
+            return {TimeHistogram(-2, 6, true), TimeHistogram(-2, 6, true), TimeHistogram(-2, 6, true),
+                    TimeHistogram(-2, 6, true), TimeHistogram(-2, 6, true)};
+        }
+    };
+
+    // Accumulates wall and thread-CPU time into one phase of a ProfileStats.
+    // A null stats pointer turns it into a no-op, so the timers can stay in
+    // the event loop when profiling is off. start()/stop() may be repeated
+    // (once per jet); every stop() counts as a call.
+    class PhaseTimer {
+    public:
+        PhaseTimer(ProfileStats* stats, Phase phase) : stats_(stats), phase_(phase) {}
+        ~PhaseTimer() { stop(); }
+
+        void start() {
+            if (stats_ == nullptr) return;
+            running_ = true;
+            wallStart_ = std::chrono::steady_clock::now();
+            cpuStart_ = threadCpuSeconds();
+        }
+
+        void stop() {
+            if (!running_) return;
+            running_ = false;
+            const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart_).count();
+            const double cpu = threadCpuSeconds() - cpuStart_;
+            stats_->calls[phase_] += 1;
+            stats_->wallSeconds[phase_] += wall;
+            stats_->cpuSeconds[phase_] += cpu;
+            stats_->wallHist[phase_].fill(wall * 1e6);
+            stats_->cpuHist[phase_].fill(cpu * 1e6);
+        }
+
+    private:
+        static double threadCpuSeconds() {
+            timespec ts;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+            return ts.tv_sec + 1e-9 * ts.tv_nsec;
+        }
+
+        ProfileStats* stats_;
+        Phase phase_;
+        bool running_ = false;
+        std::chrono::steady_clock::time_point wallStart_;
+        double cpuStart_ = 0;
+    };
+
+}  // namespace fatjet
+
+#endif
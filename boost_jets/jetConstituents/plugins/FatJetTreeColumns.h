@@ -0,0 +1,438 @@
+#ifndef FatJetTreeColumns_h
+#define FatJetTreeColumns_h
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "TBranch.h"
+#include "TTree.h"
+
+#include "JetConstituentSoA.h"
+#include "JetPointCloud.h"
+#include "PrecisionPolicy.h"
+
+namespace fatjet {
+
+    // Layout of the FatJetAnalyzer_AOD tree.
+    //  - kVector:   one std::vector branch per quantity, pf_IdxFatJet repeats
+    //               the jet index for every constituent.
+    //  - kColumnar: leaf-list C-arrays, nFatJet/nPF counters and per-jet
+    //               offsets into the flat pf_* arrays. No collection
+    //               streamer is involved on write or read.
+    enum class OutputFormat { kVector, kColumnar };
+
+    // Branch contents of one event of the FatJetAnalyzer_AOD tree.
+    struct EventColumns {
+        std::vector<float> fatjet_pt;
+        std::vector<float> fatjet_eta;
+        std::vector<float> fatjet_phi;
+        std::vector<float> fatjet_mass;
+        std::vector<int>   fatjet_Idx;   // kVector only
+        std::vector<int>   fatjet_nPF;   // kColumnar only
+
+        // Constituents of the selected jets, gathered once per jet. The
+        // pf_pt, pf_eta and pf_phi branches are filled from this buffer and
+        // its offsets become fatjet_pfOffset in the columnar layout.
+        JetConstituentSoA constituents;
+        std::vector<int>   pf_IdxFatJet; // kVector only
+
+        void clear() {
+            fatjet_pt.clear();
+            fatjet_eta.clear();
+            fatjet_phi.clear();
+            fatjet_mass.clear();
+            fatjet_Idx.clear();
+            fatjet_nPF.clear();
+            constituents.clear();
+            pf_IdxFatJet.clear();
+        }
+
+        size_t capacityBytes() const {
+            return sizeof(float) * (fatjet_pt.capacity() + fatjet_eta.capacity() + fatjet_phi.capacity() +
+                                    fatjet_mass.capacity() + constituents.pt.capacity() +
+                                    constituents.eta.capacity() + constituents.phi.capacity() +
+                                    constituents.mass.capacity()) +
+                   sizeof(int) * (fatjet_Idx.capacity() + fatjet_nPF.capacity() +
+                                  constituents.offset.capacity() + pf_IdxFatJet.capacity());
+        }
+
+        // Calls f(column, perConstituent) for every column the given layout
+        // fills; per-jet columns hold nJets (+1 for the offsets) entries.
+        template <typename F>
+        void forEachColumn(OutputFormat format, F&& f) {
+            f(fatjet_pt, false);
+            f(fatjet_eta, false);
+            f(fatjet_phi, false);
+            f(fatjet_mass, false);
+            if (format == OutputFormat::kColumnar) {
+                f(fatjet_nPF, false);
+            } else {
+                f(fatjet_Idx, false);
+                f(pf_IdxFatJet, true);
+            }
+            constituents.forEachColumn(f);
+        }
+
+        // O(1): exchanges the vector storage, capacities included. The
+        // constituent mass is not a branch and stays.
+        void swap(EventColumns& other) {
+            fatjet_pt.swap(other.fatjet_pt);
+            fatjet_eta.swap(other.fatjet_eta);
+            fatjet_phi.swap(other.fatjet_phi);
+            fatjet_mass.swap(other.fatjet_mass);
+            fatjet_Idx.swap(other.fatjet_Idx);
+            fatjet_nPF.swap(other.fatjet_nPF);
+            constituents.pt.swap(other.constituents.pt);
+            constituents.eta.swap(other.constituents.eta);
+            constituents.phi.swap(other.constituents.phi);
+            constituents.offset.swap(other.constituents.offset);
+            pf_IdxFatJet.swap(other.pf_IdxFatJet);
+        }
+    };
+
+    // Owns the branch bookkeeping of the event tree for either layout and
+    // fills one EventColumns per call. Not thread safe; callers serialize.
+    // The float columns are stored at the precision policy gives their
+    // branch name.
+    class EventTreeBranches {
+    public:
+        void book(TTree* tree, OutputFormat format, const PrecisionPolicy& precision = PrecisionPolicy()) {
+            tree_ = tree;
+            format_ = format;
+            rounded_.clear();
+            const bool leafList = format_ == OutputFormat::kColumnar;
+            const std::pair<const char*, std::vector<float>*> floatColumns[] = {
+                {"fatjet_pt", &bound_.fatjet_pt},         {"fatjet_eta", &bound_.fatjet_eta},
+                {"fatjet_phi", &bound_.fatjet_phi},       {"fatjet_mass", &bound_.fatjet_mass},
+                {"pf_pt", &bound_.constituents.pt},       {"pf_eta", &bound_.constituents.eta},
+                {"pf_phi", &bound_.constituents.phi},
+            };
+            for (const auto& [name, column] : floatColumns) {
+                if (precision(name).roundInPlace(leafList)) rounded_.emplace_back(column, precision(name));
+            }
+            if (format_ == OutputFormat::kVector) {
+                tree_->Branch("fatjet_pt", &bound_.fatjet_pt);
+                tree_->Branch("fatjet_eta", &bound_.fatjet_eta);
+                tree_->Branch("fatjet_phi", &bound_.fatjet_phi);
+                tree_->Branch("fatjet_mass", &bound_.fatjet_mass);
+                tree_->Branch("fatjet_Idx", &bound_.fatjet_Idx);
+
+                tree_->Branch("pf_pt", &bound_.constituents.pt);
+                tree_->Branch("pf_eta", &bound_.constituents.eta);
+                tree_->Branch("pf_phi", &bound_.constituents.phi);
+                tree_->Branch("pf_IdxFatJet", &bound_.pf_IdxFatJet);
+                return;
+            }
+
+            // Addresses are set on every fill, the dummy keeps Branch() happy.
+            const auto leaf = [&precision](const std::string& name, const char* counter) {
+                return name + "[" + counter + "]/" + precision(name).leafType();
+            };
+            tree_->Branch("nFatJet", &nFatJet_, "nFatJet/I");
+            jetBranches_ = {tree_->Branch("fatjet_pt", &dummy_, leaf("fatjet_pt", "nFatJet").c_str()),
+                            tree_->Branch("fatjet_eta", &dummy_, leaf("fatjet_eta", "nFatJet").c_str()),
+                            tree_->Branch("fatjet_phi", &dummy_, leaf("fatjet_phi", "nFatJet").c_str()),
+                            tree_->Branch("fatjet_mass", &dummy_, leaf("fatjet_mass", "nFatJet").c_str())};
+            nPFBranch_ = tree_->Branch("fatjet_nPF", &dummy_, "fatjet_nPF[nFatJet]/I");
+            offsetBranch_ = tree_->Branch("fatjet_pfOffset", &dummy_, "fatjet_pfOffset[nFatJet]/I");
+
+            tree_->Branch("nPF", &nPF_, "nPF/I");
+            pfBranches_ = {tree_->Branch("pf_pt", &dummy_, leaf("pf_pt", "nPF").c_str()),
+                           tree_->Branch("pf_eta", &dummy_, leaf("pf_eta", "nPF").c_str()),
+                           tree_->Branch("pf_phi", &dummy_, leaf("pf_phi", "nPF").c_str())};
+        }
+
+        // Returns what TTree::Fill returns: the number of bytes filled. The
+        // columns are rounded in place to their precision.
+        int fill(EventColumns& columns) {
+            bound_.swap(columns);
+            for (const auto& [column, precision] : rounded_) precision.apply(*column);
+            const int bytes = format_ == OutputFormat::kVector ? tree_->Fill() : fillColumnar();
+            bound_.swap(columns);
+            return bytes;
+        }
+
+    private:
+        int fillColumnar() {
+            nFatJet_ = static_cast<int>(bound_.fatjet_pt.size());
+            nPF_ = static_cast<int>(bound_.constituents.size());
+            jetBranches_[0]->SetAddress(addressOf(bound_.fatjet_pt));
+            jetBranches_[1]->SetAddress(addressOf(bound_.fatjet_eta));
+            jetBranches_[2]->SetAddress(addressOf(bound_.fatjet_phi));
+            jetBranches_[3]->SetAddress(addressOf(bound_.fatjet_mass));
+            nPFBranch_->SetAddress(addressOf(bound_.fatjet_nPF));
+            offsetBranch_->SetAddress(addressOf(bound_.constituents.offset));
+            pfBranches_[0]->SetAddress(addressOf(bound_.constituents.pt));
+            pfBranches_[1]->SetAddress(addressOf(bound_.constituents.eta));
+            pfBranches_[2]->SetAddress(addressOf(bound_.constituents.phi));
+            return tree_->Fill();
+        }
+
+        // A null address would make ROOT allocate its own leaf buffer.
+        template <typename T>
+        void* addressOf(std::vector<T>& v) {
+            return v.empty() ? static_cast<void*>(&dummy_) : static_cast<void*>(v.data());
+        }
+
+        TTree* tree_ = nullptr;
+        OutputFormat format_ = OutputFormat::kVector;
+
+        // The event being filled, swapped in from the caller. kVector: the
+        // branches point at these vectors.
+        EventColumns bound_;
+        std::vector<std::pair<std::vector<float>*, Precision>> rounded_;
+
+        // kColumnar
+        int nFatJet_ = 0;
+        int nPF_ = 0;
+        float dummy_ = 0;
+        std::vector<TBranch*> jetBranches_;
+        std::vector<TBranch*> pfBranches_;
+        TBranch* nPFBranch_ = nullptr;
+        TBranch* offsetBranch_ = nullptr;
+    };
+
+    // One row of the per-jet tagging-feature tree (FatJetTree): jet-level
+    // scalars plus one vector entry per constituent.
+    struct JetFeatureRow {
+        float fj_pt = 0, fj_eta = 0, fj_phi = 0, fj_mass = 0;
+        float fj_msoftdrop = -1;
+        float fj_tau1 = -1, fj_tau2 = -1, fj_tau3 = -1;
+        float fj_n2 = -1, fj_d2 = -1;
+        int fj_nConstituents = 0;
+        int fj_label = 0;
+
+        std::vector<float> pfc_pt;
+        std::vector<float> pfc_eta;
+        std::vector<float> pfc_phi;
+        std::vector<float> pfc_energy;
+        std::vector<float> pfc_mass;
+        std::vector<float> pfc_etarel;
+        std::vector<float> pfc_phirel;
+        std::vector<float> pfc_dxy;
+        std::vector<float> pfc_dz;
+        std::vector<float> pfc_dxy_error;
+        std::vector<float> pfc_dz_error;
+        std::vector<int>   pfc_pdgId;
+        std::vector<int>   pfc_charge;
+        std::vector<int>   pfc_numberOfValidHits;
+        std::vector<float> pfc_normalizedChi2;
+        std::vector<float> pfc_puppiWeight;
+        std::vector<float> pfc_puppiWeightNoLep;
+
+        // nPixels x nPixels jet image, written as a fixed-size array. Not
+        // part of the column tables: it is copied, not swapped, on fill.
+        std::vector<float> fj_image;
+
+        // The same image in COO form (imageFormat = "sparse"): flat pixel
+        // index and pT fraction of the lit pixels.
+        std::vector<int>   fj_image_index;
+        std::vector<float> fj_image_value;
+
+        // Point cloud (savePointCloud), pT-ordered, kPointFeatureNames order.
+        std::vector<float> pc_deta;
+        std::vector<float> pc_dphi;
+        std::vector<float> pc_logpt;
+        std::vector<float> pc_loge;
+        std::vector<float> pc_charge;
+        std::vector<float> pc_pdgclass;
+        std::vector<float> pc_puppi;
+
+        void clear();
+        void swap(JetFeatureRow& other);
+        size_t capacityBytes() const;
+
+        // Calls f(column, true) for every per-constituent column that is
+        // always filled; the optional image and point-cloud columns are not
+        // visited.
+        template <typename F>
+        void forEachColumn(F&& f);
+    };
+
+    template <typename T>
+    struct FeatureColumn {
+        const char* name;
+        T JetFeatureRow::*member;
+    };
+
+    inline constexpr FeatureColumn<float> kJetFloatScalars[] = {
+        {"fj_pt", &JetFeatureRow::fj_pt},
+        {"fj_eta", &JetFeatureRow::fj_eta},
+        {"fj_phi", &JetFeatureRow::fj_phi},
+        {"fj_mass", &JetFeatureRow::fj_mass},
+        {"fj_msoftdrop", &JetFeatureRow::fj_msoftdrop},
+        {"fj_tau1", &JetFeatureRow::fj_tau1},
+        {"fj_tau2", &JetFeatureRow::fj_tau2},
+        {"fj_tau3", &JetFeatureRow::fj_tau3},
+        {"fj_n2", &JetFeatureRow::fj_n2},
+        {"fj_d2", &JetFeatureRow::fj_d2},
+    };
+
+    inline constexpr FeatureColumn<int> kJetIntScalars[] = {
+        {"fj_nConstituents", &JetFeatureRow::fj_nConstituents},
+        {"fj_label", &JetFeatureRow::fj_label},
+    };
+
+    inline constexpr FeatureColumn<std::vector<float>> kConstituentFloatColumns[] = {
+        {"pfc_pt", &JetFeatureRow::pfc_pt},
+        {"pfc_eta", &JetFeatureRow::pfc_eta},
+        {"pfc_phi", &JetFeatureRow::pfc_phi},
+        {"pfc_energy", &JetFeatureRow::pfc_energy},
+        {"pfc_mass", &JetFeatureRow::pfc_mass},
+        {"pfc_etarel", &JetFeatureRow::pfc_etarel},
+        {"pfc_phirel", &JetFeatureRow::pfc_phirel},
+        {"pfc_dxy", &JetFeatureRow::pfc_dxy},
+        {"pfc_dz", &JetFeatureRow::pfc_dz},
+        {"pfc_dxy_error", &JetFeatureRow::pfc_dxy_error},
+        {"pfc_dz_error", &JetFeatureRow::pfc_dz_error},
+        {"pfc_normalizedChi2", &JetFeatureRow::pfc_normalizedChi2},
+        {"pfc_puppiWeight", &JetFeatureRow::pfc_puppiWeight},
+        {"pfc_puppiWeightNoLep", &JetFeatureRow::pfc_puppiWeightNoLep},
+    };
+
+    inline constexpr FeatureColumn<std::vector<int>> kConstituentIntColumns[] = {
+        {"pfc_pdgId", &JetFeatureRow::pfc_pdgId},
+        {"pfc_charge", &JetFeatureRow::pfc_charge},
+        {"pfc_numberOfValidHits", &JetFeatureRow::pfc_numberOfValidHits},
+    };
+
+    // Same order as kPointFeatureNames.
+    inline constexpr FeatureColumn<std::vector<float>> kPointCloudColumns[kNPointFeatures] = {
+        {"pc_deta", &JetFeatureRow::pc_deta},
+        {"pc_dphi", &JetFeatureRow::pc_dphi},
+        {"pc_logpt", &JetFeatureRow::pc_logpt},
+        {"pc_loge", &JetFeatureRow::pc_loge},
+        {"pc_charge", &JetFeatureRow::pc_charge},
+        {"pc_pdgclass", &JetFeatureRow::pc_pdgclass},
+        {"pc_puppi", &JetFeatureRow::pc_puppi},
+    };
+
+    inline void JetFeatureRow::clear() {
+        for (const auto& c : kConstituentFloatColumns) (this->*c.member).clear();
+        for (const auto& c : kConstituentIntColumns) (this->*c.member).clear();
+        for (const auto& c : kPointCloudColumns) (this->*c.member).clear();
+        fj_image_index.clear();
+        fj_image_value.clear();
+    }
+
+    template <typename F>
+    void JetFeatureRow::forEachColumn(F&& f) {
+        for (const auto& c : kConstituentFloatColumns) f(this->*c.member, true);
+        for (const auto& c : kConstituentIntColumns) f(this->*c.member, true);
+    }
+
+    inline size_t JetFeatureRow::capacityBytes() const {
+        size_t bytes = sizeof(float) * (fj_image.capacity() + fj_image_value.capacity()) +
+                       sizeof(int) * fj_image_index.capacity();
+        for (const auto& c : kConstituentFloatColumns) bytes += sizeof(float) * (this->*c.member).capacity();
+        for (const auto& c : kPointCloudColumns) bytes += sizeof(float) * (this->*c.member).capacity();
+        for (const auto& c : kConstituentIntColumns) bytes += sizeof(int) * (this->*c.member).capacity();
+        return bytes;
+    }
+
+    // O(1) for the vectors, capacities included.
+    inline void JetFeatureRow::swap(JetFeatureRow& other) {
+        for (const auto& c : kJetFloatScalars) std::swap(this->*c.member, other.*c.member);
+        for (const auto& c : kJetIntScalars) std::swap(this->*c.member, other.*c.member);
+        for (const auto& c : kConstituentFloatColumns) (this->*c.member).swap(other.*c.member);
+        for (const auto& c : kConstituentIntColumns) (this->*c.member).swap(other.*c.member);
+        for (const auto& c : kPointCloudColumns) (this->*c.member).swap(other.*c.member);
+        fj_image_index.swap(other.fj_image_index);
+        fj_image_value.swap(other.fj_image_value);
+    }
+
+    // Optional branches of FatJetTree.
+    struct FeatureTreeLayout {
+        int imageSize = 0;         // > 0: dense fj_image[imageSize]/F
+        bool sparseImage = false;  // fj_image_index / fj_image_value vectors
+        bool pointCloud = false;   // pc_* columns
+        int pointCloudSize = 0;    // > 0: pc_*[pointCloudSize]/F arrays, 0: ragged vectors
+    };
+
+    // Branch bookkeeping of the per-jet tagging-feature tree, one Fill per
+    // jet. Not thread safe; callers serialize. Fixed-size arrays (dense image,
+    // padded point cloud) are copied on fill, the vectors swapped. Float
+    // branches are stored at the precision policy gives their name.
+    class JetFeatureBranches {
+    public:
+        void book(TTree* tree, const FeatureTreeLayout& layout = FeatureTreeLayout(),
+                  const PrecisionPolicy& precision = PrecisionPolicy()) {
+            tree_ = tree;
+            rounded_.clear();
+            roundedScalars_.clear();
+            // Leaf-list float branch of size elements (0: scalar).
+            const auto floatLeaf = [&](const char* name, void* address, size_t size) {
+                const std::string dims = size > 0 ? "[" + std::to_string(size) + "]" : "";
+                tree_->Branch(name, address, (name + dims + "/" + precision(name).leafType()).c_str());
+            };
+            const auto floatVector = [&](const char* name, std::vector<float>* column) {
+                tree_->Branch(name, column);
+                if (precision(name).roundInPlace(false)) rounded_.emplace_back(column, precision(name));
+            };
+
+            if (layout.imageSize > 0) {
+                boundImage_.assign(layout.imageSize, 0.f);
+                floatLeaf("fj_image", boundImage_.data(), layout.imageSize);
+                if (precision("fj_image").roundInPlace(true)) {
+                    rounded_.emplace_back(&boundImage_, precision("fj_image"));
+                }
+            }
+            if (layout.sparseImage) {
+                tree_->Branch("fj_image_index", &bound_.fj_image_index);
+                floatVector("fj_image_value", &bound_.fj_image_value);
+            }
+            if (layout.pointCloud && layout.pointCloudSize > 0) {
+                const size_t size = layout.pointCloudSize;
+                boundPoints_.assign(kNPointFeatures, std::vector<float>(size, 0.f));
+                for (int f = 0; f < kNPointFeatures; ++f) {
+                    const char* name = kPointCloudColumns[f].name;
+                    floatLeaf(name, boundPoints_[f].data(), size);
+                    if (precision(name).roundInPlace(true)) rounded_.emplace_back(&boundPoints_[f], precision(name));
+                }
+            } else if (layout.pointCloud) {
+                for (const auto& c : kPointCloudColumns) floatVector(c.name, &(bound_.*c.member));
+            }
+            for (const auto& c : kJetFloatScalars) {
+                floatLeaf(c.name, &(bound_.*c.member), 0);
+                if (precision(c.name).roundInPlace(true)) {
+                    roundedScalars_.emplace_back(&(bound_.*c.member), precision(c.name));
+                }
+            }
+            for (const auto& c : kJetIntScalars)
+                tree_->Branch(c.name, &(bound_.*c.member), (std::string(c.name) + "/I").c_str());
+            for (const auto& c : kConstituentFloatColumns) floatVector(c.name, &(bound_.*c.member));
+            for (const auto& c : kConstituentIntColumns) tree_->Branch(c.name, &(bound_.*c.member));
+        }
+
+        int fill(JetFeatureRow& row) {
+            if (!boundImage_.empty()) std::copy(row.fj_image.begin(), row.fj_image.end(), boundImage_.begin());
+            for (size_t f = 0; f < boundPoints_.size(); ++f) {
+                const std::vector<float>& column = row.*kPointCloudColumns[f].member;
+                const size_t n = std::min(column.size(), boundPoints_[f].size());
+                std::copy(column.begin(), column.begin() + n, boundPoints_[f].begin());
+                std::fill(boundPoints_[f].begin() + n, boundPoints_[f].end(), 0.f);
+            }
+            bound_.swap(row);
+            for (const auto& [column, p] : rounded_) p.apply(*column);
+            for (const auto& [value, p] : roundedScalars_) *value = p.round(*value);
+            const int bytes = tree_->Fill();
+            bound_.swap(row);
+            return bytes;
+        }
+
+    private:
+        TTree* tree_ = nullptr;
+        JetFeatureRow bound_;
+        std::vector<float> boundImage_;
+        std::vector<std::vector<float>> boundPoints_;  // padded point cloud, per feature
+
+        // Branches rounded before the Fill; they point into the members above.
+        std::vector<std::pair<std::vector<float>*, Precision>> rounded_;
+        std::vector<std::pair<float*, Precision>> roundedScalars_;
+    };
+
+}  // namespace fatjet
+
+#endif
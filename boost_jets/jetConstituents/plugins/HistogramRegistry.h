@@ -0,0 +1,310 @@
+#ifndef HistogramRegistry_h
+#define HistogramRegistry_h
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "TH1.h"
+#include "TH2.h"
+
+#include "JetConstituentSoA.h"
+
+namespace fatjet {
+
+    // Input of the jet observables. The substructure stays at -1 when it is
+    // neither computed nor read (saveFeatureTree = False).
+    struct JetRecord {
+        float pt = 0, eta = 0, phi = 0, mass = 0;
+        int nConstituents = 0;
+        float msoftdrop = -1;
+        float tau1 = -1, tau2 = -1, tau3 = -1;
+        float n2 = -1, d2 = -1;
+    };
+
+    // Input of the constituent observables: constituent i of jet.
+    struct ConstituentRecord {
+        const JetConstituentSoA& soa;
+        int i;
+        const JetRecord& jet;
+    };
+
+    template <typename Record, typename F>
+    struct Observable {
+        const char* name;
+        F value;  // double(const Record&)
+    };
+
+    template <typename Record, typename F>
+    constexpr Observable<Record, F> observable(const char* name, F value) {
+        return {name, value};
+    }
+
+    // phi - axis wrapped to [-pi, pi) by int conversion, as in EtaPhiGrid.
+    inline double wrappedDeltaPhi(float phi, float axis) {
+        constexpr float kTwoPi = 6.28318530717958648f;
+        float dPhi = phi - axis;
+        dPhi -= kTwoPi * (static_cast<int>(dPhi * (1.f / kTwoPi) + 2.5f) - 2);
+        return dPhi;
+    }
+
+    // What a histogram axis can name. A new observable is one entry here.
+    inline constexpr auto kJetObservables = std::make_tuple(
+        observable<JetRecord>("fj_pt", [](const JetRecord& j) { return double(j.pt); }),
+        observable<JetRecord>("fj_eta", [](const JetRecord& j) { return double(j.eta); }),
+        observable<JetRecord>("fj_phi", [](const JetRecord& j) { return double(j.phi); }),
+        observable<JetRecord>("fj_mass", [](const JetRecord& j) { return double(j.mass); }),
+        observable<JetRecord>("fj_nConstituents", [](const JetRecord& j) { return double(j.nConstituents); }),
+        observable<JetRecord>("fj_msoftdrop", [](const JetRecord& j) { return double(j.msoftdrop); }),
+        observable<JetRecord>("fj_tau1", [](const JetRecord& j) { return double(j.tau1); }),
+        observable<JetRecord>("fj_tau2", [](const JetRecord& j) { return double(j.tau2); }),
+        observable<JetRecord>("fj_tau3", [](const JetRecord& j) { return double(j.tau3); }),
+        observable<JetRecord>("fj_tau21", [](const JetRecord& j) { return j.tau1 > 0 ? j.tau2 / j.tau1 : -1.; }),
+        observable<JetRecord>("fj_tau32", [](const JetRecord& j) { return j.tau2 > 0 ? j.tau3 / j.tau2 : -1.; }),
+        observable<JetRecord>("fj_n2", [](const JetRecord& j) { return double(j.n2); }),
+        observable<JetRecord>("fj_d2", [](const JetRecord& j) { return double(j.d2); }));
+
+    inline constexpr auto kConstituentObservables = std::make_tuple(
+        observable<ConstituentRecord>("pf_pt", [](const ConstituentRecord& c) { return double(c.soa.pt[c.i]); }),
+        observable<ConstituentRecord>("pf_eta", [](const ConstituentRecord& c) { return double(c.soa.eta[c.i]); }),
+        observable<ConstituentRecord>("pf_phi", [](const ConstituentRecord& c) { return double(c.soa.phi[c.i]); }),
+        observable<ConstituentRecord>("pf_deta", [](const ConstituentRecord& c) {
+            return double(c.soa.eta[c.i] - c.jet.eta);
+        }),
+        observable<ConstituentRecord>("pf_dphi", [](const ConstituentRecord& c) {
+            return wrappedDeltaPhi(c.soa.phi[c.i], c.jet.phi);
+        }),
+        observable<ConstituentRecord>("pf_ptFraction", [](const ConstituentRecord& c) {
+            return c.jet.pt > 0 ? c.soa.pt[c.i] / c.jet.pt : 0.;
+        }));
+
+    // Values of the observables of one table, one column per observable,
+    // buffered over an event. append() evaluates the used ones inline; the
+    // names are only looked up when the histograms are booked.
+    template <typename Record, const auto& Table>
+    class ObservableColumns {
+    public:
+        static constexpr size_t kSize = std::tuple_size_v<std::decay_t<decltype(Table)>>;
+
+        // -1 for a name not in Table.
+        static int index(const std::string& name) {
+            int found = -1;
+            forEachIndex([&](auto i) {
+                if (name == std::get<i>(Table).name) found = i;
+            });
+            return found;
+        }
+
+        void use(int i) {
+            used_[i] = true;
+            active_ = true;
+        }
+        bool active() const { return active_; }
+
+        void append(const Record& record) { appendUsed(record, std::make_index_sequence<kSize>()); }
+
+        // Appends the n records record(k), k in [0, n), one observable at a
+        // time: each used column grows once and is written in a tight loop.
+        template <typename MakeRecord>
+        void appendRange(int n, MakeRecord&& record) {
+            appendColumns(n, record, std::make_index_sequence<kSize>());
+            size_ += n;
+        }
+
+        size_t size() const { return size_; }
+        const std::vector<double>& column(int i) const { return columns_[i]; }
+
+        // Keeps the capacity.
+        void clear() {
+            for (auto& column : columns_) column.clear();
+            size_ = 0;
+        }
+
+    private:
+        template <typename F>
+        static void forEachIndex(F&& f) {
+            forEachIndex(f, std::make_index_sequence<kSize>());
+        }
+
+        template <typename F, size_t... I>
+        static void forEachIndex(F& f, std::index_sequence<I...>) {
+            (f(std::integral_constant<size_t, I>()), ...);
+        }
+
+        template <typename MakeRecord, size_t... I>
+        void appendColumns(int n, MakeRecord& record, std::index_sequence<I...>) {
+            (appendColumn<I>(n, record), ...);
+        }
+
+        template <size_t I, typename MakeRecord>
+        void appendColumn(int n, MakeRecord& record) {
+            if (!used_[I]) return;
+            std::vector<double>& column = columns_[I];
+            const size_t offset = column.size();
+            column.resize(offset + n);
+            double* out = column.data() + offset;
+            for (int k = 0; k < n; ++k) out[k] = std::get<I>(Table).value(record(k));
+        }
+
+        template <size_t... I>
+        void appendUsed(const Record& record, std::index_sequence<I...>) {
+            ((used_[I] ? columns_[I].push_back(std::get<I>(Table).value(record)) : void()), ...);
+            ++size_;
+        }
+
+        std::array<bool, kSize> used_{};
+        bool active_ = false;
+        std::array<std::vector<double>, kSize> columns_;
+        size_t size_ = 0;
+    };
+
+    // One histogram of the registry: x (and y for a TH2F) name observables
+    // of the same table.
+    struct HistogramSpec {
+        std::string name;
+        std::string title;
+        std::string x;
+        std::string y;  // empty: TH1F
+        int nBinsX = 100;
+        double xMin = 0, xMax = 1;
+        int nBinsY = 100;
+        double yMin = 0, yMax = 1;
+    };
+
+    // Histograms declared by HistogramSpecs. The values of a jet are
+    // buffered per observable and the histograms filled once per event
+    // with FillN, so the jet loop pays for each observable in use, not for
+    // each histogram. Each stream fills a clone; add() merges the clones.
+    class HistogramRegistry {
+    public:
+        using JetColumns = ObservableColumns<JetRecord, kJetObservables>;
+        using ConstituentColumns = ObservableColumns<ConstituentRecord, kConstituentObservables>;
+
+        // What is wrong with spec; empty if it can be booked.
+        static std::string problem(const HistogramSpec& spec) {
+            if (spec.name.empty()) return "a histogram without a name";
+            const bool jetX = JetColumns::index(spec.x) >= 0;
+            if (!jetX && ConstituentColumns::index(spec.x) < 0) return "unknown observable '" + spec.x + "'";
+            if (!spec.y.empty()) {
+                const bool jetY = JetColumns::index(spec.y) >= 0;
+                if (!jetY && ConstituentColumns::index(spec.y) < 0) return "unknown observable '" + spec.y + "'";
+                if (jetX != jetY) {
+                    return "'" + spec.x + "' and '" + spec.y + "' are not both jet or both constituent observables";
+                }
+                if (spec.nBinsY <= 0 || spec.yMax <= spec.yMin) return "bad y binning";
+            }
+            if (spec.nBinsX <= 0 || spec.xMax <= spec.xMin) return "bad x binning";
+            return "";
+        }
+
+        HistogramRegistry() = default;
+
+        // make(spec) books a TH1F, or a TH2F when spec.y is set, somewhere
+        // that owns it (the TFileService). Every spec must pass problem().
+        template <typename Make>
+        HistogramRegistry(const std::vector<HistogramSpec>& specs, Make&& make) {
+            for (const auto& spec : specs) {
+                Entry entry;
+                entry.hist = make(spec);
+                entry.hist2 = spec.y.empty() ? nullptr : static_cast<TH2*>(entry.hist);
+                entry.perConstituent = JetColumns::index(spec.x) < 0;
+                entry.x = entry.perConstituent ? ConstituentColumns::index(spec.x) : JetColumns::index(spec.x);
+                if (!spec.y.empty()) {
+                    entry.y = entry.perConstituent ? ConstituentColumns::index(spec.y) : JetColumns::index(spec.y);
+                }
+                entries_.push_back(entry);
+            }
+            for (const auto& entry : entries_) {
+                if (entry.perConstituent) {
+                    constituents_.use(entry.x);
+                    if (entry.y >= 0) constituents_.use(entry.y);
+                } else {
+                    jets_.use(entry.x);
+                    if (entry.y >= 0) jets_.use(entry.y);
+                }
+            }
+        }
+
+        HistogramRegistry(HistogramRegistry&&) = default;
+        HistogramRegistry& operator=(HistogramRegistry&&) = default;
+
+        // Empty, detached copies of the histograms, owned by the new
+        // registry. Clone() goes through gDirectory, so callers serialize.
+        HistogramRegistry clone() const {
+            HistogramRegistry copy;
+            copy.entries_ = entries_;
+            copy.jets_ = jets_;
+            copy.constituents_ = constituents_;
+            copy.jets_.clear();
+            copy.constituents_.clear();
+            for (auto& entry : copy.entries_) {
+                TH1* h = static_cast<TH1*>(entry.hist->Clone());
+                h->SetDirectory(nullptr);
+                h->Reset();
+                copy.owned_.emplace_back(h);
+                entry.hist = h;
+                if (entry.hist2 != nullptr) entry.hist2 = static_cast<TH2*>(h);
+            }
+            return copy;
+        }
+
+        size_t size() const { return entries_.size(); }
+
+        void fillJet(const JetRecord& jet) {
+            if (jets_.active()) jets_.append(jet);
+        }
+
+        void fillConstituents(const JetConstituentSoA& soa, int first, int last, const JetRecord& jet) {
+            if (!constituents_.active()) return;
+            constituents_.appendRange(last - first, [&](int k) { return ConstituentRecord{soa, first + k, jet}; });
+        }
+
+        // Fills the histograms with what was buffered since the last flush.
+        void flush() {
+            for (const auto& entry : entries_) {
+                const ColumnPair xy = entry.perConstituent ? constituentColumns(entry) : jetColumns(entry);
+                const int n = static_cast<int>(xy.first->size());
+                if (n == 0) continue;
+                if (entry.hist2 != nullptr) entry.hist2->FillN(n, xy.first->data(), xy.second->data(), nullptr);
+                else entry.hist->FillN(n, xy.first->data(), nullptr);
+            }
+            jets_.clear();
+            constituents_.clear();
+        }
+
+        // Adds the histograms of other, a clone of this registry.
+        void add(const HistogramRegistry& other) {
+            for (size_t i = 0; i < entries_.size(); ++i) entries_[i].hist->Add(other.entries_[i].hist);
+        }
+
+    private:
+        struct Entry {
+            TH1* hist = nullptr;
+            TH2* hist2 = nullptr;  // hist, when it is a TH2
+            bool perConstituent = false;
+            int x = -1, y = -1;
+        };
+
+        using ColumnPair = std::pair<const std::vector<double>*, const std::vector<double>*>;
+
+        ColumnPair jetColumns(const Entry& entry) const {
+            return {&jets_.column(entry.x), entry.y >= 0 ? &jets_.column(entry.y) : nullptr};
+        }
+
+        ColumnPair constituentColumns(const Entry& entry) const {
+            return {&constituents_.column(entry.x), entry.y >= 0 ? &constituents_.column(entry.y) : nullptr};
+        }
+
+        std::vector<Entry> entries_;
+        std::vector<std::unique_ptr<TH1>> owned_;  // clones only
+        JetColumns jets_;
+        ConstituentColumns constituents_;
+    };
+
+}  // namespace fatjet
+
+#endif
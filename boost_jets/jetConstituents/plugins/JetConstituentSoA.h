@@ -0,0 +1,55 @@
+#ifndef JetConstituentSoA_h
+#define JetConstituentSoA_h
+
+#include <cstddef>
+#include <vector>
+
+// Per-event scratch buffer with the kinematics of the constituents of every
+// selected fat jet, stored as structure-of-arrays. The mass is only kept for
+// the substructure engine and is not written out. The constituents of jet j
+// live in [begin(j), end(j)). The buffer is cleared, never shrunk, so after
+// the first few events the gathering stage runs without allocating; in the
+// analyzer its capacity is managed by BranchBufferManager.
+struct JetConstituentSoA {
+    std::vector<float> pt;
+    std::vector<float> eta;
+    std::vector<float> phi;
+    std::vector<float> mass;
+    std::vector<int>   offset{0}; // nJets() + 1 entries
+
+    void clear() {
+        pt.clear();
+        eta.clear();
+        phi.clear();
+        mass.clear();
+        offset.resize(1);
+    }
+
+    std::size_t size() const { return pt.size(); }
+    std::size_t nJets() const { return offset.size() - 1; }
+    int begin(std::size_t jet) const { return offset[jet]; }
+    int end(std::size_t jet) const { return offset[jet + 1]; }
+    int count(std::size_t jet) const { return offset[jet + 1] - offset[jet]; }
+
+    void push_back(float cPt, float cEta, float cPhi, float cMass = 0.f) {
+        pt.push_back(cPt);
+        eta.push_back(cEta);
+        phi.push_back(cPhi);
+        mass.push_back(cMass);
+    }
+
+    // Calls f(column, perConstituent) for every column, offsets included.
+    template <typename F>
+    void forEachColumn(F&& f) {
+        f(pt, true);
+        f(eta, true);
+        f(phi, true);
+        f(mass, true);
+        f(offset, false);
+    }
+
+    // Closes the jet whose constituents were pushed since the last call.
+    void closeJet() { offset.push_back(static_cast<int>(pt.size())); }
+};
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef JetImage_h
+#define JetImage_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace fatjet {
+
+    struct JetImageConfig {
+        int nPixels = 33;        // image is nPixels x nPixels
+        float halfWidth = 0.8f;  // half size of the image in eta and phi
+        bool rotate = true;      // align the principal axis with the eta axis
+        bool flip = true;        // put the hardest half-planes at positive eta/phi
+    };
+
+    // Builds pT-fraction jet images from the constituent SoA. Every pass runs
+    // over plain float arrays without branches so that the compiler can
+    // vectorize it; only the final scatter-add into the pixels is scalar.
+    // The scratch arrays are kept between calls, so one builder per stream.
+    //
+    // build() writes the dense nPixels^2 grid. buildSparse() writes the same
+    // image in COO form, the lit pixels only in increasing bin order; with
+    // about a hundred constituents on a 33x33 or larger grid that is 10-50x
+    // fewer bytes. densify() turns it back into the dense grid.
+    class JetImageBuilder {
+    public:
+        explicit JetImageBuilder(const JetImageConfig& config = JetImageConfig())
+            : config_(config),
+              invPixelWidth_(config.nPixels / (2.f * config.halfWidth)) {}
+
+        const JetImageConfig& config() const { return config_; }
+        int size() const { return config_.nPixels * config_.nPixels; }
+
+        // Fills image[nPixels * nPixels], row-major in (eta, phi), with the
+        // pT fraction of the n constituents. Eta/phi are taken relative to
+        // (axisEta, axisPhi), then centred on the pT-weighted centroid.
+        void build(const float* pt, const float* eta, const float* phi, int n,
+                   float axisEta, float axisPhi, float* image) {
+            std::fill(image, image + size(), 0.f);
+            if (!project(pt, eta, phi, n, axisEta, axisPhi)) return;
+            const int* bin = bin_.data();
+            const float* w = w_.data();
+            for (int i = 0; i < n; ++i) {
+                if (bin[i] >= 0) image[bin[i]] += w[i];
+            }
+        }
+
+        // Replaces index/value with the flat bins (as in build()) and pT
+        // fractions of the non-empty pixels.
+        void buildSparse(const float* pt, const float* eta, const float* phi, int n, float axisEta, float axisPhi,
+                         std::vector<int>& index, std::vector<float>& value) {
+            index.clear();
+            value.clear();
+            if (!project(pt, eta, phi, n, axisEta, axisPhi)) return;
+            // Pixels are summed in a dense scratch grid and flagged in a
+            // bitmask, which reads them back in bin order in O(lit + size/64)
+            // without sorting; both are reset on the way.
+            if (int(sum_.size()) != size()) {
+                sum_.assign(size(), 0.f);
+                lit_.assign((size() + 63) / 64, 0);
+            }
+            float* sum = sum_.data();
+            uint64_t* lit = lit_.data();
+            for (int i = 0; i < n; ++i) {
+                const int b = bin_[i];
+                if (b < 0) continue;
+                sum[b] += w_[i];
+                lit[b >> 6] |= uint64_t(1) << (b & 63);
+            }
+            for (size_t word = 0; word < lit_.size(); ++word) {
+                for (uint64_t bits = lit[word]; bits != 0; bits &= bits - 1) {
+                    const int b = int(word * 64) + __builtin_ctzll(bits);
+                    index.push_back(b);
+                    value.push_back(sum[b]);
+                    sum[b] = 0.f;
+                }
+                lit[word] = 0;
+            }
+        }
+
+    private:
+        // Fills w_ with the pT fractions and bin_ with the flat pixel of each
+        // constituent (-1 outside). False when there is nothing to draw.
+        bool project(const float* pt, const float* eta, const float* phi, int n, float axisEta, float axisPhi) {
+            if (n <= 0) return false;
+            x_.resize(n);
+            y_.resize(n);
+            w_.resize(n);
+            bin_.resize(n);
+            float* x = x_.data();
+            float* y = y_.data();
+            float* w = w_.data();
+            int* bin = bin_.data();
+
+            constexpr float kTwoPi = 6.28318530717958648f;
+            constexpr float kInvTwoPi = 1.f / kTwoPi;
+            float sumPt = 0.f;
+            for (int i = 0; i < n; ++i) {
+                const float dPhi = phi[i] - axisPhi;
+                x[i] = eta[i] - axisEta;
+                y[i] = dPhi - kTwoPi * std::floor(dPhi * kInvTwoPi + 0.5f);
+                sumPt += pt[i];
+            }
+            if (sumPt <= 0.f) return false;
+            const float invSumPt = 1.f / sumPt;
+
+            float meanX = 0.f, meanY = 0.f;
+            for (int i = 0; i < n; ++i) {
+                w[i] = pt[i] * invSumPt;
+                meanX += w[i] * x[i];
+                meanY += w[i] * y[i];
+            }
+            for (int i = 0; i < n; ++i) {
+                x[i] -= meanX;
+                y[i] -= meanY;
+            }
+
+            if (config_.rotate) {
+                float sxx = 0.f, syy = 0.f, sxy = 0.f;
+                for (int i = 0; i < n; ++i) {
+                    sxx += w[i] * x[i] * x[i];
+                    syy += w[i] * y[i] * y[i];
+                    sxy += w[i] * x[i] * y[i];
+                }
+                const float angle = 0.5f * std::atan2(2.f * sxy, sxx - syy);
+                const float c = std::cos(angle);
+                const float s = std::sin(angle);
+                for (int i = 0; i < n; ++i) {
+                    const float xr = c * x[i] + s * y[i];
+                    const float yr = -s * x[i] + c * y[i];
+                    x[i] = xr;
+                    y[i] = yr;
+                }
+            }
+
+            if (config_.flip) {
+                // After centring the first moments vanish, so flip on the pT
+                // balance of the half-planes instead.
+                float skewX = 0.f, skewY = 0.f;
+                for (int i = 0; i < n; ++i) {
+                    skewX += w[i] * std::copysign(1.f, x[i]);
+                    skewY += w[i] * std::copysign(1.f, y[i]);
+                }
+                const float signX = skewX < 0.f ? -1.f : 1.f;
+                const float signY = skewY < 0.f ? -1.f : 1.f;
+                for (int i = 0; i < n; ++i) {
+                    x[i] *= signX;
+                    y[i] *= signY;
+                }
+            }
+
+            const int nPixels = config_.nPixels;
+            const float halfWidth = config_.halfWidth;
+            const float invWidth = invPixelWidth_;
+            for (int i = 0; i < n; ++i) {
+                const int ix = static_cast<int>(std::floor((x[i] + halfWidth) * invWidth));
+                const int iy = static_cast<int>(std::floor((y[i] + halfWidth) * invWidth));
+                const bool inside = (ix >= 0) & (ix < nPixels) & (iy >= 0) & (iy < nPixels);
+                bin[i] = inside ? ix * nPixels + iy : -1;
+            }
+            return true;
+        }
+
+        JetImageConfig config_;
+        float invPixelWidth_;
+        std::vector<float> x_, y_, w_;
+        std::vector<int> bin_;
+        std::vector<float> sum_;     // buildSparse scratch
+        std::vector<uint64_t> lit_;  // buildSparse scratch, one bit per pixel
+    };
+
+    // Dense image[size] from the n (index, value) pairs of buildSparse.
+    inline void densify(const int* index, const float* value, int n, float* image, int size) {
+        std::fill(image, image + size, 0.f);
+        for (int k = 0; k < n; ++k) {
+            if (index[k] >= 0 && index[k] < size) image[index[k]] = value[k];
+        }
+    }
+
+}  // namespace fatjet
+
+#endif
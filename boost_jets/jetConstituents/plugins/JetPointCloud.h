@@ -0,0 +1,113 @@
+#ifndef JetPointCloud_h
+#define JetPointCloud_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <numeric>
+#include <vector>
+
+namespace fatjet {
+
+    // Per-point features of the particle-cloud output, in this order.
+    enum PointFeature { kDeta, kDphi, kLogPt, kLogE, kCharge, kPdgClass, kPuppi, kNPointFeatures };
+
+    inline constexpr const char* kPointFeatureNames[kNPointFeatures] = {"deta",   "dphi",     "logpt", "loge",
+                                                                        "charge", "pdgclass", "puppi"};
+
+    // Particle-flow category of a pdgId, as a float feature: 1 charged
+    // hadron, 2 neutral hadron, 3 photon, 4 electron, 5 muon, 6 HF hadron,
+    // 7 HF EM, 0 anything else. 0 is also the value of the padding.
+    inline float pdgClass(int pdgId) {
+        switch (std::abs(pdgId)) {
+            case 211: return 1.f;
+            case 130: return 2.f;
+            case 22: return 3.f;
+            case 11: return 4.f;
+            case 13: return 5.f;
+            case 1: return 6.f;
+            case 2: return 7.f;
+            default: return 0.f;
+        }
+    }
+
+    // Builds the pT-ordered point cloud of a jet, the input of
+    // ParticleNet-style taggers, from per-constituent arrays with eta and
+    // phi already relative to the jet axis. maxPoints > 0 keeps the hardest
+    // maxPoints constituents; the writers then pad to that size with zeros.
+    // The scratch order is kept between calls, so one builder per stream.
+    class PointCloudBuilder {
+    public:
+        explicit PointCloudBuilder(int maxPoints = 0) : maxPoints_(maxPoints) {}
+
+        int maxPoints() const { return maxPoints_; }
+
+        // Sorts the n constituents and returns the number of points kept.
+        // The arrays must stay alive until the points are read.
+        int build(const float* pt, const float* deta, const float* dphi, const float* energy, const int* charge,
+                  const int* pdgId, const float* puppi, int n) {
+            pt_ = pt;
+            deta_ = deta;
+            dphi_ = dphi;
+            energy_ = energy;
+            charge_ = charge;
+            pdgId_ = pdgId;
+            puppi_ = puppi;
+            n = std::max(n, 0);
+            kept_ = maxPoints_ > 0 ? std::min(n, maxPoints_) : n;
+            order_.resize(n);
+            std::iota(order_.begin(), order_.end(), 0);
+            const auto harder = [pt](int a, int b) { return pt[a] > pt[b]; };
+            if (kept_ < n) std::partial_sort(order_.begin(), order_.begin() + kept_, order_.end(), harder);
+            else std::sort(order_.begin(), order_.end(), harder);
+            return kept_;
+        }
+
+        int size() const { return kept_; }
+
+        // Features of the k-th hardest point.
+        void point(int k, float* features) const {
+            const int i = order_[k];
+            features[kDeta] = deta_[i];
+            features[kDphi] = dphi_[i];
+            features[kLogPt] = std::log(std::max(pt_[i], 1e-6f));
+            features[kLogE] = std::log(std::max(energy_[i], 1e-6f));
+            features[kCharge] = charge_[i];
+            features[kPdgClass] = pdgClass(pdgId_[i]);
+            features[kPuppi] = puppi_[i];
+        }
+
+        // Column-major: columns[f][k] for k < size, zero up to padTo.
+        void fillColumns(float* const* columns, int padTo) const {
+            float features[kNPointFeatures];
+            for (int k = 0; k < kept_; ++k) {
+                point(k, features);
+                for (int f = 0; f < kNPointFeatures; ++f) columns[f][k] = features[f];
+            }
+            for (int f = 0; f < kNPointFeatures; ++f) {
+                std::fill(columns[f] + kept_, columns[f] + std::max(padTo, kept_), 0.f);
+            }
+        }
+
+        // Row-major: out[k * kNPointFeatures + f], zero up to padTo points.
+        void fillRows(float* out, int padTo) const {
+            for (int k = 0; k < kept_; ++k) point(k, out + k * kNPointFeatures);
+            std::fill(out + kept_ * kNPointFeatures, out + std::max(padTo, kept_) * kNPointFeatures, 0.f);
+        }
+
+    private:
+        int maxPoints_;
+        int kept_ = 0;
+        std::vector<int> order_;
+        const float* pt_ = nullptr;
+        const float* deta_ = nullptr;
+        const float* dphi_ = nullptr;
+        const float* energy_ = nullptr;
+        const int* charge_ = nullptr;
+        const int* pdgId_ = nullptr;
+        const float* puppi_ = nullptr;
+    };
+
+}  // namespace fatjet
+
+#endif
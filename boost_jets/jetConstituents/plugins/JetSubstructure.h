@@ -0,0 +1,369 @@
+#ifndef JetSubstructure_h
+#define JetSubstructure_h
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace fatjet {
+
+    struct SubstructureConfig {
+        float nsubBeta = 1.f;          // angular exponent of tau_N
+        float nsubR0 = 0.8f;           // radius of the tau_N normalization
+        float softDropZCut = 0.1f;
+        float softDropBeta = 0.f;
+        float softDropR0 = 0.8f;
+        float ecfBeta = 1.f;           // angular exponent of N2 and D2
+        int ecfMaxConstituents = 0;    // hardest groomed constituents entering the ECFs, < 2: no ECFs
+    };
+
+    // -1 when the jet has no constituents (or too few for the ratio).
+    struct SubstructureResult {
+        float tau1 = -1, tau2 = -1, tau3 = -1;
+        float msoftdrop = -1;
+        float n2 = -1, d2 = -1;
+    };
+
+    // Jet substructure from the constituent SoA, without FastJet:
+    //  - tau_1..3, normalized measure, on exclusive-kT axes (no one-pass
+    //    minimization, so values differ at the percent level from the
+    //    OnePass_KT_Axes of NjettinessAK8Puppi)
+    //  - soft-drop mass from the Cambridge/Aachen declustering
+    //  - N2 = 2e3 / (1e2)^2 and D2 = 3e3 / (1e2)^3 on the soft-drop groomed
+    //    constituents, like the CMS ECF producers
+    // Distances are in (eta, phi). The pairwise Delta R^2 matrix is computed
+    // once per jet and shared by both clusterings and the ECFs. Its kernels
+    // and the ECF sums run on plain float arrays without compares, summing
+    // into fixed lanes, so that they vectorize without -ffast-math. The
+    // scratch arrays are kept between calls, so one engine per stream.
+    class SubstructureEngine {
+    public:
+        explicit SubstructureEngine(const SubstructureConfig& config = SubstructureConfig()) : config_(config) {}
+
+        const SubstructureConfig& config() const { return config_; }
+
+        SubstructureResult compute(const float* pt, const float* eta, const float* phi, const float* mass, int n) {
+            SubstructureResult result;
+            if (n <= 0) return result;
+            n_ = n;
+
+            // The diagonal is set far away, so that a row minimum is a nearest
+            // neighbour; the ECF sums never read it.
+            dR2_.resize(size_t(n) * n);
+            for (int i = 0; i < n; ++i) {
+                deltaR2Row(eta[i], phi[i], eta, phi, n, dR2_.data() + size_t(i) * n);
+                dR2_[size_t(i) * n + i] = kFar;
+            }
+
+            // Exclusive-kT axes: the pseudojets left when N remain.
+            cluster(pt, eta, phi, mass, true);
+            double d0 = 0;
+            for (int i = 0; i < n; ++i) d0 += pt[i];
+            d0 *= std::pow(config_.nsubR0, config_.nsubBeta);
+            float* tau[3] = {&result.tau1, &result.tau2, &result.tau3};
+            for (int nAxes = 1; nAxes <= 3 && d0 > 0; ++nAxes) {
+                *tau[nAxes - 1] = n <= nAxes ? 0.f : static_cast<float>(nsubjettiness(pt, eta, phi, nAxes) / d0);
+            }
+
+            // Soft drop on the Cambridge/Aachen tree.
+            cluster(pt, eta, phi, mass, false);
+            int node = nodes_.size() - 1;
+            while (nodes_[node].child1 >= 0) {
+                const Node& a = nodes_[nodes_[node].child1];
+                const Node& b = nodes_[nodes_[node].child2];
+                const float z = std::min(a.pt, b.pt) / (a.pt + b.pt);
+                const float dR = std::sqrt(deltaR2(a.eta, a.phi, b.eta, b.phi));
+                if (z > config_.softDropZCut * std::pow(dR / config_.softDropR0, config_.softDropBeta)) break;
+                node = a.pt >= b.pt ? nodes_[node].child1 : nodes_[node].child2;
+            }
+            const Node& groomed = nodes_[node];
+            const double m2 = groomed.e * groomed.e - groomed.px * groomed.px - groomed.py * groomed.py -
+                              groomed.pz * groomed.pz;
+            result.msoftdrop = std::sqrt(std::max(m2, 0.));
+
+            energyCorrelators(pt, node, result);
+            return result;
+        }
+
+    private:
+        static constexpr float kPi = 3.14159265358979324f;
+        static constexpr float kTwoPi = 2.f * kPi;
+        static constexpr int kLanes = 8;  // independent partial sums of the reductions
+        static constexpr float kFar = std::numeric_limits<float>::max();
+        static constexpr float kGone = 1e18f;  // eta of a merged-away slot, its Delta R^2 stays finite
+
+        // Phi wrapped to [-pi, pi) by int conversion, as in EtaPhiGrid.
+        static float deltaR2(float eta1, float phi1, float eta2, float phi2) {
+            const float dEta = eta2 - eta1;
+            float dPhi = phi2 - phi1;
+            dPhi -= kTwoPi * (static_cast<int>(dPhi * (1.f / kTwoPi) + 2.5f) - 2);
+            return dEta * dEta + dPhi * dPhi;
+        }
+
+        static void deltaR2Row(float eta0, float phi0, const float* __restrict__ eta, const float* __restrict__ phi, int n,
+                               float* __restrict__ out) {
+            int k = 0;
+            for (; k + kLanes <= n; k += kLanes) {
+                for (int l = 0; l < kLanes; ++l) out[k + l] = deltaR2(eta0, phi0, eta[k + l], phi[k + l]);
+            }
+            for (; k < n; ++k) out[k] = deltaR2(eta0, phi0, eta[k], phi[k]);
+        }
+
+        // min(a, b) without a compare.
+        static float minimum(float a, float b) { return 0.5f * (a + b - std::fabs(a - b)); }
+
+        // Delta R^beta from Delta R^2.
+        static void angularPower(float* x, int n, float beta) {
+            if (beta == 2.f) return;
+            if (beta == 1.f) {
+                for (int i = 0; i < n; ++i) x[i] = std::sqrt(x[i]);
+            } else {
+                for (int i = 0; i < n; ++i) x[i] = std::pow(x[i], 0.5f * beta);
+            }
+        }
+
+        // Clustering tree: nodes [0, n) are the constituents, node n + s is
+        // made by step s, the last node is the root.
+        struct Node {
+            double px, py, pz, e;
+            float pt, eta, phi;
+            int child1, child2;  // -1 for constituents
+            int mergedAt;        // step that consumed the node, n - 1 for the root
+        };
+
+        // Pairwise clustering with d_ij = min(kt_i^2p, kt_j^2p) Delta R_ij^2,
+        // p = 1 (kT) or 0 (C/A), E-scheme recombination and no beam distance,
+        // i.e. FastJet with R = max_allowable_R. As in FastJet, the closest
+        // pair is always a pseudojet and its geometric nearest neighbour, so
+        // the neighbours are plain row minima of the Delta R^2 matrix. They
+        // are cached and only searched again for the pseudojets that pointed
+        // at a merged one. The initial neighbours come from the constituent
+        // matrix; later rows are recomputed, which is cheaper than keeping a
+        // matrix of the pseudojets up to date column by column.
+        void cluster(const float* pt, const float* eta, const float* phi, const float* mass, bool kt) {
+            const int n = n_;
+            nodes_.resize(2 * n - 1);
+            for (int i = 0; i < n; ++i) {
+                const double px = pt[i] * std::cos(phi[i]), py = pt[i] * std::sin(phi[i]), pz = pt[i] * std::sinh(eta[i]);
+                nodes_[i] = {px, py, pz, std::sqrt(px * px + py * py + pz * pz + double(mass[i]) * mass[i]),
+                             pt[i], eta[i], phi[i], -1, -1, n - 1};
+            }
+
+            slotNode_.resize(n);
+            slotEta_.resize(n);
+            slotPhi_.resize(n);
+            slotKt2_.resize(n);
+            nn_.resize(n);
+            nnDR2_.resize(n);
+            nnDist_.resize(n);
+            active_.resize(n);
+            activePos_.resize(n);
+            rowI_.resize(n);
+            rowK_.resize(n);
+            for (int i = 0; i < n; ++i) {
+                slotNode_[i] = i;
+                slotEta_[i] = eta[i];
+                slotPhi_[i] = phi[i];
+                slotKt2_[i] = kt ? pt[i] * pt[i] : 1.f;
+                active_[i] = activePos_[i] = i;
+            }
+            for (int i = 0; i < n; ++i) nearestNeighbour(i, dR2_.data() + size_t(i) * n);
+
+            for (int step = 0; step < n - 1; ++step) {
+                const int i = argmin(nnDist_.data(), n);
+                const int j = nn_[i];
+
+                Node& a = nodes_[slotNode_[i]];
+                Node& b = nodes_[slotNode_[j]];
+                Node merged;
+                merged.px = a.px + b.px;
+                merged.py = a.py + b.py;
+                merged.pz = a.pz + b.pz;
+                merged.e = a.e + b.e;
+                const double mergedPt = std::hypot(merged.px, merged.py);
+                merged.pt = mergedPt;
+                merged.eta = mergedPt > 0 ? std::asinh(merged.pz / mergedPt) : 0.f;
+                merged.phi = std::atan2(merged.py, merged.px);
+                merged.child1 = slotNode_[i];
+                merged.child2 = slotNode_[j];
+                merged.mergedAt = n - 1;
+                a.mergedAt = b.mergedAt = step;
+                nodes_[n + step] = merged;
+
+                // The merged pseudojet takes slot i; slot j leaves every row.
+                slotNode_[i] = n + step;
+                slotNode_[j] = -1;
+                slotEta_[j] = kGone;
+                nnDist_[j] = kFar;
+                slotEta_[i] = merged.eta;
+                slotPhi_[i] = merged.phi;
+                slotKt2_[i] = kt ? merged.pt * merged.pt : 1.f;
+                active_[activePos_[j]] = active_.back();
+                activePos_[active_.back()] = activePos_[j];
+                active_.pop_back();
+
+                const float* rowI = pseudojetRow(i, rowI_.data());
+                nearestNeighbour(i, rowI);
+                for (int k : active_) {
+                    if (k == i) continue;
+                    if (nn_[k] == i || nn_[k] == j) {
+                        nearestNeighbour(k, pseudojetRow(k, rowK_.data()));
+                    } else if (rowI[k] < nnDR2_[k]) {
+                        nn_[k] = i;
+                        nnDR2_[k] = rowI[k];
+                        nnDist_[k] = std::min(slotKt2_[k], slotKt2_[i]) * rowI[k];
+                    }
+                }
+            }
+        }
+
+        // Delta R^2 from slot k to every slot, far for k itself.
+        const float* pseudojetRow(int k, float* row) const {
+            deltaR2Row(slotEta_[k], slotPhi_[k], slotEta_.data(), slotPhi_.data(), n_, row);
+            row[k] = kFar;
+            return row;
+        }
+
+        // Index of the smallest of x[0, n): the minimum is found with
+        // fixed-lane selects, which vectorize, and then located.
+        static int argmin(const float* x, int n) {
+            float lanes[kLanes];
+            std::fill(lanes, lanes + kLanes, kFar);
+            int l = 0;
+            for (; l + kLanes <= n; l += kLanes) {
+                for (int m = 0; m < kLanes; ++m) lanes[m] = x[l + m] < lanes[m] ? x[l + m] : lanes[m];
+            }
+            float best = kFar;
+            for (; l < n; ++l) best = x[l] < best ? x[l] : best;
+            for (int m = 0; m < kLanes; ++m) best = lanes[m] < best ? lanes[m] : best;
+            return std::find(x, x + n, best) - x;
+        }
+
+        // Geometric nearest neighbour of slot k, from its Delta R^2 row.
+        void nearestNeighbour(int k, const float* row) {
+            const int nearest = argmin(row, n_);
+            nn_[k] = nearest;
+            nnDR2_[k] = nearest < n_ ? row[nearest] : kFar;
+            nnDist_[k] = nearest < n_ ? std::min(slotKt2_[k], slotKt2_[nearest]) * row[nearest] : kFar;
+        }
+
+        // Unnormalized tau_N on the exclusive-kT axes of the last clustering.
+        double nsubjettiness(const float* pt, const float* eta, const float* phi, int nAxes) {
+            const int n = n_;
+            const int stage = n - nAxes;  // merges done when nAxes pseudojets remain
+            minDR2_.resize(n);
+            axisDR2_.resize(n);
+            bool first = true;
+            for (int node = 0; node < static_cast<int>(nodes_.size()); ++node) {
+                const bool created = node < n || node - n < stage;
+                if (!created || nodes_[node].mergedAt < stage) continue;
+                float* target = first ? minDR2_.data() : axisDR2_.data();
+                deltaR2Row(nodes_[node].eta, nodes_[node].phi, eta, phi, n, target);
+                if (!first) {
+                    for (int i = 0; i < n; ++i) minDR2_[i] = minimum(minDR2_[i], axisDR2_[i]);
+                }
+                first = false;
+            }
+            angularPower(minDR2_.data(), n, config_.nsubBeta);
+            return weightedSum(pt, minDR2_.data(), n);
+        }
+
+        static double weightedSum(const float* w, const float* x, int n) {
+            float lanes[kLanes] = {};
+            int i = 0;
+            for (; i + kLanes <= n; i += kLanes) {
+                for (int l = 0; l < kLanes; ++l) lanes[l] += w[i + l] * x[i + l];
+            }
+            double sum = 0;
+            for (; i < n; ++i) sum += w[i] * x[i];
+            for (int l = 0; l < kLanes; ++l) sum += lanes[l];
+            return sum;
+        }
+
+        // N2 and D2 of the constituents below the groomed node, restricted
+        // to the hardest ecfMaxConstituents of them.
+        void energyCorrelators(const float* pt, int groomedNode, SubstructureResult& result) {
+            if (config_.ecfMaxConstituents < 2) return;
+            leaves_.clear();
+            stack_.assign(1, groomedNode);
+            while (!stack_.empty()) {
+                const int node = stack_.back();
+                stack_.pop_back();
+                if (nodes_[node].child1 < 0) {
+                    leaves_.push_back(node);
+                } else {
+                    stack_.push_back(nodes_[node].child1);
+                    stack_.push_back(nodes_[node].child2);
+                }
+            }
+            const int m = std::min<int>(leaves_.size(), config_.ecfMaxConstituents);
+            if (m < 2) return;
+            std::nth_element(leaves_.begin(), leaves_.begin() + (m - 1), leaves_.end(),
+                             [pt](int a, int b) { return pt[a] > pt[b]; });
+
+            // Rows are padded with zero weights and angles to whole lanes past
+            // m, so that the k loop below needs no remainder.
+            const int stride = (m + 2 * kLanes - 2) / kLanes * kLanes;
+            z_.assign(stride, 0.f);
+            r_.assign(size_t(m) * stride, 0.f);
+            float sumPt = 0.f;
+            for (int i = 0; i < m; ++i) sumPt += pt[leaves_[i]];
+            for (int i = 0; i < m; ++i) {
+                z_[i] = pt[leaves_[i]] / sumPt;
+                const float* row = dR2_.data() + size_t(leaves_[i]) * n_;
+                for (int k = 0; k < m; ++k) r_[size_t(i) * stride + k] = row[leaves_[k]];
+            }
+            angularPower(r_.data(), m * stride, config_.ecfBeta);
+
+            // e2 = sum z_i z_j R_ij; e3 = sum z_i z_j z_k R_ij R_ik R_jk;
+            // 2e3 takes the product of the two smallest of the three angles.
+            // The lanes accumulate over all (j, k) of one i.
+            const float* z = z_.data();
+            double e2 = 0, e3 = 0, v2e3 = 0;
+            for (int i = 0; i < m; ++i) {
+                const float* ri = r_.data() + size_t(i) * stride;
+                float s3[kLanes] = {}, s2[kLanes] = {};
+                for (int j = i + 1; j < m; ++j) {
+                    const float* rj = r_.data() + size_t(j) * stride;
+                    const float rij = ri[j];
+                    const float zj = z[j];
+                    const float zjRij = zj * rij;
+                    for (int k = j + 1; k < m; k += kLanes) {
+                        for (int l = 0; l < kLanes; ++l) {
+                            const float rik = ri[k + l], rjk = rj[k + l];
+                            s3[l] += zjRij * z[k + l] * rik * rjk;
+                            s2[l] += zj * z[k + l] * minimum(minimum(rij * rik, rij * rjk), rik * rjk);
+                        }
+                    }
+                    e2 += double(z[i]) * zjRij;
+                }
+                for (int l = 0; l < kLanes; ++l) {
+                    e3 += double(z[i]) * s3[l];
+                    v2e3 += double(z[i]) * s2[l];
+                }
+            }
+            if (e2 <= 0) return;
+            result.n2 = v2e3 / (e2 * e2);
+            result.d2 = e3 / (e2 * e2 * e2);
+        }
+
+        SubstructureConfig config_;
+        int n_ = 0;
+
+        std::vector<float> dR2_;  // n x n Delta R^2 between the constituents
+        std::vector<Node> nodes_;
+        std::vector<int> slotNode_;  // -1 once merged away
+        std::vector<float> slotEta_, slotPhi_, slotKt2_;
+        std::vector<int> active_, activePos_;  // live slots, and each slot's index in active_
+        std::vector<int> nn_;
+        std::vector<float> nnDR2_, nnDist_;
+        std::vector<float> rowI_, rowK_;
+        std::vector<float> minDR2_, axisDR2_;
+        std::vector<int> leaves_, stack_;
+        std::vector<float> z_, r_;
+    };
+
+}  // namespace fatjet
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef PrecisionPolicy_h
+#define PrecisionPolicy_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace fatjet {
+
+    // Stored precision of a float branch, from a spec string:
+    //   "full"                  32-bit float
+    //   "truncate:N"            N mantissa bits, rounded; still a float, the
+    //                           zeroed low bits compress away
+    //   "quantize:min:max:N"    fixed point: clamped to [min, max] and rounded
+    //                           to a power-of-two step of at most
+    //                           (max - min) / 2^N; still a float with at most
+    //                           N significant bits
+    //   "float16:N"             ROOT Float16_t with N mantissa bits
+    //   "float16:min:max:N"     ROOT Float16_t packed as an N-bit integer in
+    //                           [min, max]
+    // Float16_t is only a leaf-list type. Vector branches get the same
+    // rounding applied in place, so their readers see the same values.
+    struct Precision {
+        enum Mode { kFull, kTruncate, kQuantize, kFloat16 };
+
+        Mode mode = kFull;
+        int bits = 23;
+        float min = 0.f, max = 0.f;  // min == max: no range
+        float step = 0.f;            // quantize: grid spacing, set by parsePrecision
+
+        bool full() const { return mode == kFull; }
+        bool hasRange() const { return max > min; }
+
+        // Leaf type for a leaf-list float branch: "F", or "f[min,max,N]".
+        std::string leafType() const {
+            if (mode != kFloat16) return "F";
+            const float lo = hasRange() ? min : 0.f;
+            const float hi = hasRange() ? max : 0.f;
+            return "f[" + number(lo) + "," + number(hi) + "," + std::to_string(bits) + "]";
+        }
+
+        // Whether a branch of this kind has to be rounded before the Fill;
+        // ROOT packs a Float16_t leaf itself.
+        bool roundInPlace(bool leafList) const { return !full() && !(leafList && mode == kFloat16); }
+
+        float round(float x) const {
+            switch (mode) {
+                case kTruncate: return truncateMantissa(x, bits);
+                case kQuantize: return quantize(x);
+                case kFloat16: return hasRange() ? float16Range(x) : truncateMantissa(x, bits);
+                default: return x;
+            }
+        }
+
+        void apply(float* values, size_t n) const {
+            if (full()) return;
+            for (size_t i = 0; i < n; ++i) values[i] = round(values[i]);
+        }
+
+        void apply(std::vector<float>& values) const { apply(values.data(), values.size()); }
+
+        // Bit layout of TBufferFile::WriteFloat16 without a range: the
+        // mantissa is rounded half up to nbits and saturates rather than
+        // carrying into the exponent.
+        static float truncateMantissa(float x, int nbits) {
+            if (nbits >= 23 || !std::isfinite(x)) return x;
+            uint32_t i;
+            std::memcpy(&i, &x, sizeof(i));
+            const uint32_t exponent = (i >> 23) & 0xff;
+            uint32_t mantissa = ((1u << (nbits + 1)) - 1) & (i >> (23 - nbits - 1));
+            mantissa = (mantissa + 1) >> 1;
+            if (mantissa & (1u << nbits)) mantissa = (1u << nbits) - 1;
+            uint32_t out = (exponent << 23) | (mantissa << (23 - nbits));
+            out |= i & 0x80000000u;
+            float y;
+            std::memcpy(&y, &out, sizeof(y));
+            return y;
+        }
+
+    private:
+        static std::string number(float x) {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.9g", x);
+            return buffer;
+        }
+
+        // TBufferFile::WriteFloat16 with a range, read back.
+        float float16Range(float x) const {
+            const double factor = std::ldexp(1.0, bits) / (double(max) - double(min));
+            x = std::clamp(x, min, max);
+            const uint32_t packed = uint32_t(0.5 + factor * (double(x) - double(min)));
+            return float(double(min) + packed / factor);
+        }
+
+        float quantize(float x) const {
+            if (!hasRange() || step <= 0.f) return x;
+            x = std::clamp(x, min, max);
+            float q = std::nearbyint(x / step) * step;
+            if (q > max) q -= step;
+            if (q < min) q += step;
+            return q;
+        }
+    };
+
+    // Parses one of the spec strings above; false on a malformed one.
+    inline bool parsePrecision(const std::string& spec, Precision& out) {
+        std::vector<std::string> fields;
+        size_t start = 0;
+        while (true) {
+            const size_t colon = spec.find(':', start);
+            fields.push_back(spec.substr(start, colon - start));
+            if (colon == std::string::npos) break;
+            start = colon + 1;
+        }
+        const auto toFloat = [](const std::string& s, float& x) {
+            char* end = nullptr;
+            x = std::strtof(s.c_str(), &end);
+            return !s.empty() && *end == '\0';
+        };
+        const auto toBits = [](const std::string& s, int lo, int hi, int& n) {
+            char* end = nullptr;
+            n = std::strtol(s.c_str(), &end, 10);
+            return !s.empty() && *end == '\0' && n >= lo && n <= hi;
+        };
+
+        Precision p;
+        const std::string& mode = fields[0];
+        if (mode == "full" && fields.size() == 1) {
+            p.mode = Precision::kFull;
+        } else if (mode == "truncate" && fields.size() == 2) {
+            p.mode = Precision::kTruncate;
+            if (!toBits(fields[1], 1, 22, p.bits)) return false;
+        } else if (mode == "quantize" && fields.size() == 4) {
+            p.mode = Precision::kQuantize;
+            if (!toFloat(fields[1], p.min) || !toFloat(fields[2], p.max) || !toBits(fields[3], 1, 24, p.bits)) {
+                return false;
+            }
+            if (!p.hasRange()) return false;
+            p.step = std::exp2(std::ceil(std::log2((p.max - p.min) / std::exp2(float(p.bits)))));
+        } else if (mode == "float16" && (fields.size() == 2 || fields.size() == 4)) {
+            p.mode = Precision::kFloat16;
+            if (fields.size() == 2) {
+                if (!toBits(fields[1], 2, 16, p.bits)) return false;
+            } else {
+                if (!toFloat(fields[1], p.min) || !toFloat(fields[2], p.max) || !toBits(fields[3], 2, 31, p.bits)) {
+                    return false;
+                }
+                if (!p.hasRange()) return false;
+            }
+        } else {
+            return false;
+        }
+        out = p;
+        return true;
+    }
+
+    // Precision of every float branch: the listed ones, the default for the
+    // others.
+    class PrecisionPolicy {
+    public:
+        PrecisionPolicy() = default;
+        PrecisionPolicy(const Precision& fallback, std::map<std::string, Precision> branches)
+            : fallback_(fallback), branches_(std::move(branches)) {}
+
+        const Precision& operator()(const std::string& branch) const {
+            const auto it = branches_.find(branch);
+            return it != branches_.end() ? it->second : fallback_;
+        }
+
+        bool full() const {
+            return fallback_.full() &&
+                   std::all_of(branches_.begin(), branches_.end(), [](const auto& b) { return b.second.full(); });
+        }
+
+    private:
+        Precision fallback_;
+        std::map<std::string, Precision> branches_;
+    };
+
+}  // namespace fatjet
+
+#endif
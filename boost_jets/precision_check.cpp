@@ -0,0 +1,268 @@
+// Reports what a reduced-precision policy costs on a FatJetAnalyzer tree file
+// written at full precision, before the policy goes into a production
+// config (defaultPrecision / branchPrecision).
+//
+// Every float branch of FatJetTree and FatJetAnalyzer_AOD (leaf lists and
+// vector<float>) is read, rounded as PrecisionPolicy.h would store it, and
+// compared with the original: max and mean absolute error, max relative
+// error, and the compressed size of the rounded values relative to the
+// original ones. The sizes are compressed in 32 kB blocks, about a basket;
+// Float16_t leaves are estimated from their rounded float values, so they
+// gain a little more on disk than shown.
+//
+//   g++ -O2 -std=c++17 -IjetConstituents/plugins -o precision_check precision_check.cpp $(root-config --cflags --libs)
+//   ./precision_check --default truncate:12 --precision fj_eta=float16:-5:5:16 -n 20000 output_trees.root
+//   ./precision_check --precision pfc_dxy_error=truncate:8 --precision pfc_dz_error=truncate:8 output_trees.root
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Compression.h>
+#include <RZip.h>
+#include <TBranch.h>
+#include <TBranchElement.h>
+#include <TCollection.h>
+#include <TDirectory.h>
+#include <TFile.h>
+#include <TKey.h>
+#include <TLeaf.h>
+#include <TObjArray.h>
+#include <TTree.h>
+
+#include "PrecisionPolicy.h"
+
+namespace {
+
+    constexpr size_t kBlockValues = 8192;  // 32 kB of floats
+
+    struct Options {
+        std::string file;
+        std::vector<std::string> trees{"FatJetTree", "FatJetAnalyzer_AOD"};
+        bool defaultTrees = true;
+        fatjet::Precision fallback;
+        std::map<std::string, fatjet::Precision> branches;
+        std::map<std::string, std::string> specs;  // as given, for the report
+        std::string defaultSpec = "full";
+        long long maxEntries = -1;
+        int algorithm = ROOT::RCompressionSetting::EAlgorithm::kZSTD;
+        int level = 5;
+    };
+
+    // Errors and compressed sizes of one branch.
+    struct BranchCheck {
+        std::string name;
+        fatjet::Precision precision;
+        std::string spec;
+        const Options* options = nullptr;
+        TLeaf* leaf = nullptr;
+        std::vector<float>* vector = nullptr;  // vector<float> branches
+
+        std::vector<float> block;
+        long long values = 0;
+        double maxError = 0, sumError = 0, maxRelative = 0;
+        long long bytesFull = 0, bytesRounded = 0;
+
+        void add(float x) {
+            block.push_back(x);
+            if (block.size() == kBlockValues) flush();
+        }
+
+        // Compares the rounded block with the original and compresses both.
+        void flush();
+    };
+
+    // Compressed size of n floats; incompressible blocks count as stored.
+    long long compressedSize(const std::vector<float>& values, const Options& options) {
+        if (values.empty()) return 0;
+        int srcSize = values.size() * sizeof(float);
+        int tgtSize = srcSize + 512;
+        std::vector<char> target(tgtSize);
+        int written = 0;
+        R__zipMultipleAlgorithm(options.level, &srcSize, reinterpret_cast<char*>(const_cast<float*>(values.data())),
+                                &tgtSize, target.data(), &written,
+                                ROOT::RCompressionSetting::EAlgorithm::EValues(options.algorithm));
+        return written > 0 ? written : srcSize;
+    }
+
+    void BranchCheck::flush() {
+        if (block.empty()) return;
+        std::vector<float> rounded(block);
+        precision.apply(rounded);
+        for (size_t i = 0; i < block.size(); ++i) {
+            const double error = std::abs(double(rounded[i]) - double(block[i]));
+            maxError = std::max(maxError, error);
+            sumError += error;
+            if (block[i] != 0.f) maxRelative = std::max(maxRelative, error / std::abs(double(block[i])));
+        }
+        values += block.size();
+        bytesFull += compressedSize(block, *options);
+        bytesRounded += compressedSize(rounded, *options);
+        block.clear();
+    }
+
+    // name at the top of the file, or one directory down (TFileService puts
+    // the trees in a directory named after the module label).
+    TTree* findTree(TFile& file, const std::string& name) {
+        if (TTree* tree = file.Get<TTree>(name.c_str())) return tree;
+        TIter next(file.GetListOfKeys());
+        while (TKey* key = static_cast<TKey*>(next())) {
+            if (!key->IsFolder()) continue;
+            TDirectory* dir = file.GetDirectory(key->GetName());
+            if (dir == nullptr) continue;
+            if (TTree* tree = dir->Get<TTree>(name.c_str())) return tree;
+        }
+        return nullptr;
+    }
+
+    std::vector<BranchCheck> bookChecks(TTree* tree, const Options& options) {
+        std::vector<BranchCheck> checks;
+        TObjArray* branches = tree->GetListOfBranches();
+        for (int i = 0; i < branches->GetEntriesFast(); ++i) {
+            TBranch* branch = static_cast<TBranch*>(branches->UncheckedAt(i));
+            const std::string name = branch->GetName();
+            const auto it = options.branches.find(name);
+            BranchCheck check;
+            check.name = name;
+            check.precision = it != options.branches.end() ? it->second : options.fallback;
+            check.spec = it != options.branches.end() ? options.specs.at(name) : options.defaultSpec;
+            check.options = &options;
+            if (check.precision.full()) continue;
+            if (auto* element = dynamic_cast<TBranchElement*>(branch)) {
+                if (std::string(element->GetClassName()) != "vector<float>") continue;
+            } else {
+                TLeaf* leaf = branch->GetLeaf(name.c_str());
+                if (leaf == nullptr || std::string(leaf->GetTypeName()) != "Float_t") continue;
+                check.leaf = leaf;
+            }
+            checks.push_back(std::move(check));
+        }
+        // The addresses are taken once the vector no longer moves.
+        for (auto& check : checks) {
+            if (check.leaf == nullptr) tree->SetBranchAddress(check.name.c_str(), &check.vector);
+        }
+        return checks;
+    }
+
+    void checkTree(TTree* tree, const Options& options) {
+        std::vector<BranchCheck> checks = bookChecks(tree, options);
+        if (checks.empty()) {
+            std::cout << tree->GetName() << ": no float branch with a reduced precision" << std::endl;
+            return;
+        }
+        tree->SetBranchStatus("*", false);
+        for (const auto& check : checks) tree->SetBranchStatus(check.name.c_str(), true);
+        const long long entries =
+            options.maxEntries >= 0 ? std::min(options.maxEntries, tree->GetEntries()) : tree->GetEntries();
+        for (long long entry = 0; entry < entries; ++entry) {
+            tree->GetEntry(entry);
+            for (auto& check : checks) {
+                if (check.vector != nullptr) {
+                    for (float x : *check.vector) check.add(x);
+                } else {
+                    for (int j = 0; j < check.leaf->GetLen(); ++j) check.add(check.leaf->GetValue(j));
+                }
+            }
+        }
+
+        std::printf("%s: %lld entries\n", tree->GetName(), entries);
+        std::printf("  %-22s %-22s %10s %11s %11s %10s %7s\n", "branch", "precision", "values", "max |err|",
+                    "mean |err|", "max rel", "size");
+        long long bytesFull = 0, bytesRounded = 0;
+        for (auto& check : checks) {
+            check.flush();
+            bytesFull += check.bytesFull;
+            bytesRounded += check.bytesRounded;
+            const double mean = check.values > 0 ? check.sumError / check.values : 0.;
+            const double size = check.bytesFull > 0 ? double(check.bytesRounded) / check.bytesFull : 1.;
+            std::printf("  %-22s %-22s %10lld %11.4g %11.4g %10.3g %6.1f%%\n", check.name.c_str(),
+                        check.spec.c_str(), check.values, check.maxError, mean, check.maxRelative, 100. * size);
+        }
+        std::printf("  compressed size of these branches: %.1f kB -> %.1f kB\n", bytesFull / 1024.,
+                    bytesRounded / 1024.);
+    }
+
+    bool parseAlgorithm(const std::string& name, int& algorithm) {
+        using Algorithm = ROOT::RCompressionSetting::EAlgorithm;
+        if (name == "ZLIB") algorithm = Algorithm::kZLIB;
+        else if (name == "LZMA") algorithm = Algorithm::kLZMA;
+        else if (name == "LZ4") algorithm = Algorithm::kLZ4;
+        else if (name == "ZSTD") algorithm = Algorithm::kZSTD;
+        else return false;
+        return true;
+    }
+
+    void usage(const char* argv0) {
+        std::cerr << "usage: " << argv0 << " [--default spec] [--precision branch=spec ...] [--tree name ...]"
+                  << " [-n entries] [--compression ZLIB|LZMA|LZ4|ZSTD] [--level n] file.root\n"
+                  << "spec: full, truncate:N, quantize:min:max:N, float16:N or float16:min:max:N" << std::endl;
+    }
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    bool ok = true;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--default" && hasValue) {
+            options.defaultSpec = argv[++i];
+            ok = ok && fatjet::parsePrecision(options.defaultSpec, options.fallback);
+        } else if (arg == "--precision" && hasValue) {
+            const std::string value = argv[++i];
+            const size_t equals = value.find('=');
+            const std::string name = value.substr(0, equals);
+            if (equals == std::string::npos || name.empty()) {
+                ok = false;
+                continue;
+            }
+            options.specs[name] = value.substr(equals + 1);
+            ok = ok && fatjet::parsePrecision(options.specs[name], options.branches[name]);
+        } else if (arg == "--tree" && hasValue) {
+            if (options.defaultTrees) options.trees.clear();
+            options.defaultTrees = false;
+            options.trees.push_back(argv[++i]);
+        } else if (arg == "-n" && hasValue) {
+            options.maxEntries = std::atoll(argv[++i]);
+        } else if (arg == "--compression" && hasValue) {
+            ok = ok && parseAlgorithm(argv[++i], options.algorithm);
+        } else if (arg == "--level" && hasValue) {
+            options.level = std::atoi(argv[++i]);
+        } else if (arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return 0;
+        } else if (options.file.empty() && arg[0] != '-') {
+            options.file = arg;
+        } else {
+            ok = false;
+        }
+    }
+    if (!ok || options.file.empty() || options.level < 1 || options.level > 9) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::unique_ptr<TFile> file(TFile::Open(options.file.c_str()));
+    if (file == nullptr || file->IsZombie()) {
+        std::cerr << "cannot open " << options.file << std::endl;
+        return 1;
+    }
+    int found = 0;
+    for (const auto& name : options.trees) {
+        TTree* tree = findTree(*file, name);
+        if (tree == nullptr) {
+            std::cerr << name << " not found in " << options.file << std::endl;
+            continue;
+        }
+        checkTree(tree, options);
+        ++found;
+    }
+    return found > 0 ? 0 : 1;
+}